@@ -0,0 +1,22 @@
+#pragma once
+
+// azimuth arithmetic of the INDI-free modules, the driver has INDI's range360()
+
+#include <cmath>
+
+// r in [0, 360)
+inline double range360(double r) {
+    r = std::fmod(r, 360.0);
+    return r < 0 ? r + 360.0 : r;
+}
+
+// a - b in [-180, 180]
+inline double angleDiff(double a, double b) {
+    double d = std::fmod(a - b, 360.0);
+    if (d > 180) {
+        d -= 360;
+    } else if (d < -180) {
+        d += 360;
+    }
+    return d;
+}
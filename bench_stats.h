@@ -0,0 +1,44 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+// samples of one quantity of a benchmark, printed as mean and percentiles
+struct Stats {
+    std::vector<double> values;
+
+    void add(double v) {
+        values.push_back(v);
+    }
+
+    double mean() const {
+        double sum = 0;
+        for (double v : values) {
+            sum += v;
+        }
+        return values.empty() ? 0 : sum / values.size();
+    }
+
+    // q from 0 to 1, 0 without samples
+    double quantile(double q) const {
+        if (values.empty()) {
+            return 0;
+        }
+        std::vector<double> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * q))];
+    }
+
+    double max() const {
+        return values.empty() ? 0 : *std::max_element(values.begin(), values.end());
+    }
+
+    void print(const char *name, const char *unit) const {
+        if (values.empty()) {
+            printf("%-28s no samples\n", name);
+            return;
+        }
+        printf("%-28s mean %9.3f  p50 %9.3f  p99 %9.3f  max %9.3f %s\n", name, mean(), quantile(0.5), quantile(0.99), max(), unit);
+    }
+};
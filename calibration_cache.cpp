@@ -0,0 +1,116 @@
+#include "calibration_cache.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#define CALIBRATION_CACHE_MAGIC 0x4f50454e  // "NEPO"
+#define CALIBRATION_CACHE_VERSION 3
+
+// the layout of version 3, all values in host byte order
+// followed by the edges of the tooth table: 2 * teeth doubles turning right, then as many turning left
+struct CalibrationCacheFile {
+    uint32_t magic;
+    uint32_t version;
+    double impCount;
+    double speed[2];
+    double impToNorthOffset;
+    double deceleration[2];
+    double azimuth;
+    // since version 2
+    int32_t teeth;
+    double northLeft;
+};
+
+bool loadCalibrationCache(const std::string &path, CalibrationCache &cache, std::string &error) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        error = "Opening " + path + " failed: " + strerror(errno);
+        return false;
+    }
+    CalibrationCacheFile file;
+    size_t read = fread(&file, sizeof(file), 1, fp);
+    if (read != 1 || file.magic != CALIBRATION_CACHE_MAGIC) {
+        fclose(fp);
+        error = path + " isn't a calibration cache";
+        return false;
+    }
+    if (file.version != CALIBRATION_CACHE_VERSION) {
+        fclose(fp);
+        error = path + " has version " + std::to_string(file.version) + " instead of " + std::to_string(CALIBRATION_CACHE_VERSION);
+        return false;
+    }
+    if (!(file.impCount >= 1) || !(file.speed[0] > 0) || !(file.speed[1] > 0) || !std::isfinite(file.azimuth)
+        || file.teeth != static_cast<int32_t>(file.impCount)) {
+        fclose(fp);
+        error = path + " contains no valid calibration";
+        return false;
+    }
+    // the table has to be in the file before it is allocated, a broken count could ask for any size
+    long start = ftell(fp);
+    fseek(fp, 0, SEEK_END);
+    long end = ftell(fp);
+    if (end - start < static_cast<long>(4 * sizeof(double)) * file.teeth) {
+        fclose(fp);
+        error = path + " ends within its tooth table";
+        return false;
+    }
+    fseek(fp, start, SEEK_SET);
+    ToothTable &table = cache.calibration.teeth;
+    table.resize(file.teeth);
+    size_t edges = static_cast<size_t>(table.edgeCount());
+    bool complete = fread(table.edges[ToothTable::RIGHT].data(), sizeof(double), edges, fp) == edges
+                    && fread(table.edges[ToothTable::LEFT].data(), sizeof(double), edges, fp) == edges;
+    fclose(fp);
+    if (!complete) {
+        error = "Reading " + path + " failed";
+        return false;
+    }
+    cache.calibration.impCount = file.impCount;
+    cache.calibration.speed[DomeController::SPEED_R] = file.speed[DomeController::SPEED_R];
+    cache.calibration.speed[DomeController::SPEED_L] = file.speed[DomeController::SPEED_L];
+    cache.calibration.impToNorthOffset = file.impToNorthOffset;
+    table.northLeft = file.northLeft;
+    cache.deceleration[DomeController::SPEED_R] = file.deceleration[DomeController::SPEED_R];
+    cache.deceleration[DomeController::SPEED_L] = file.deceleration[DomeController::SPEED_L];
+    cache.azimuth = file.azimuth;
+    return true;
+}
+
+bool saveCalibrationCache(const std::string &path, const CalibrationCache &cache, std::string &error) {
+    CalibrationCacheFile file;
+    memset(&file, 0, sizeof(file));
+    file.magic = CALIBRATION_CACHE_MAGIC;
+    file.version = CALIBRATION_CACHE_VERSION;
+    file.impCount = cache.calibration.impCount;
+    file.speed[DomeController::SPEED_R] = cache.calibration.speed[DomeController::SPEED_R];
+    file.speed[DomeController::SPEED_L] = cache.calibration.speed[DomeController::SPEED_L];
+    file.impToNorthOffset = cache.calibration.impToNorthOffset;
+    file.teeth = cache.calibration.teeth.teeth;
+    file.northLeft = cache.calibration.teeth.northLeft;
+    file.deceleration[DomeController::SPEED_R] = cache.deceleration[DomeController::SPEED_R];
+    file.deceleration[DomeController::SPEED_L] = cache.deceleration[DomeController::SPEED_L];
+    file.azimuth = cache.azimuth;
+
+    // written to a temporary file first so a crash can't leave a half written cache behind
+    std::string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        error = "Opening " + tmp + " failed: " + strerror(errno);
+        return false;
+    }
+    const ToothTable &table = cache.calibration.teeth;
+    size_t edges = static_cast<size_t>(table.edgeCount());
+    bool ok = fwrite(&file, sizeof(file), 1, fp) == 1
+              && fwrite(table.edges[ToothTable::RIGHT].data(), sizeof(double), edges, fp) == edges
+              && fwrite(table.edges[ToothTable::LEFT].data(), sizeof(double), edges, fp) == edges;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        error = "Writing " + path + " failed: " + strerror(errno);
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "dome_controller.h"
+
+#include <string>
+
+// calibration results and the last position kept between driver starts
+// stored as a small versioned binary file, a file of another version is ignored and the dome is calibrated again
+struct CalibrationCache {
+    DomeController::Calibration calibration;
+    double deceleration[2] = {0, 0};    // °/s², 0 if unknown
+    double azimuth = 0;
+};
+
+// on failure error describes what went wrong
+bool loadCalibrationCache(const std::string &path, CalibrationCache &cache, std::string &error);
+bool saveCalibrationCache(const std::string &path, const CalibrationCache &cache, std::string &error);
@@ -0,0 +1,426 @@
+#include "control_thread.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// the live state takes the controller's values as they are
+static_assert(static_cast<int>(LiveDomeState::NONE) == DomeController::RotDirection::NONE
+              && static_cast<int>(LiveDomeState::LEFT) == DomeController::RotDirection::LEFT,
+              "the rotations of the live state are the controller's");
+static_assert(static_cast<int>(LiveDomeState::CLOSED) == DomeController::ShutterAction::CLOSED
+              && static_cast<int>(LiveDomeState::STOPPED) == DomeController::ShutterAction::STOPPED,
+              "the shutter states of the live state are the controller's");
+
+// longest sleep of the idle loop in ms, the GPIO snapshot of a cycle still catches edges the alerts missed
+#define CONTROL_IDLE_TIMEOUT_MS 1000
+
+// the events after which the calibration changed
+#define CALIBRATION_EVENTS (DomeController::Event::CALIBRATION_FINISHED | DomeController::Event::CALIBRATION_VERIFIED \
+                            | DomeController::Event::CALIBRATION_UPDATED)
+
+static void notify(int fd) {
+    // a full counter wakes the loop as well
+    uint64_t one = 1;
+    ssize_t written = write(fd, &one, sizeof(one));
+    (void)written;
+}
+
+ControlThread::ControlThread(DomeController &controller, uint32_t periodUs) : controller(controller), periodUs(periodUs) {
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    controller.setEdgeListener(onEdge, this);
+    calibrationOut = controller.getCalibration();
+    publish();
+}
+
+ControlThread::~ControlThread() {
+    stop();
+    controller.setEdgeListener(nullptr, nullptr);
+    if (wakeFd >= 0) {
+        close(wakeFd);
+    }
+}
+
+void ControlThread::start() {
+    if (running.exchange(true)) {
+        return;
+    }
+    thread = std::thread(&ControlThread::run, this);
+}
+
+void ControlThread::stop() {
+    if (running.exchange(false)) {
+        notify(wakeFd);
+        thread.join();
+    }
+}
+
+bool ControlThread::setRealtime(int priority, int cpu, std::string &error) {
+    if (!thread.joinable()) {
+        error = "The control thread isn't running";
+        return false;
+    }
+    sched_param param;
+    param.sched_priority = priority;
+    int err = pthread_setschedparam(thread.native_handle(), priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param);
+    if (err) {
+        error = std::string("Setting the priority of the control thread to ") + std::to_string(priority) + " failed: " + strerror(err);
+        return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (cpu < 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            CPU_SET(i, &cpus);
+        }
+    } else {
+        CPU_SET(cpu, &cpus);
+    }
+    err = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+    if (err) {
+        error = std::string("Pinning the control thread to CPU ") + std::to_string(cpu) + " failed: " + strerror(err);
+        return false;
+    }
+    return true;
+}
+
+bool ControlThread::lockMemory(bool lock, std::string &error) {
+    if ((lock ? mlockall(MCL_CURRENT | MCL_FUTURE) : munlockall()) != 0) {
+        error = std::string(lock ? "Locking" : "Unlocking") + " the memory failed: " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+uint64_t ControlThread::send(const Command &command) {
+    Command queued = command;
+    queued.seq = sent + 1;
+    if (!commands.push(queued)) {
+        return 0;
+    }
+    wake();
+    return ++sent;
+}
+
+uint64_t ControlThread::requestStop(Stop kind) {
+    // a later stop of the same kind replaces an earlier one, the later one stops as well
+    stops[kind].store(++sent, std::memory_order_release);
+    wake();
+    return sent;
+}
+
+bool ControlThread::hasPendingStops() const {
+    for (int kind = 0; kind < STOP_KINDS; kind++) {
+        if (stops[kind].load(std::memory_order_acquire) > stopsHandled[kind]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ControlThread::handleStops(uint64_t before) {
+    for (int kind = 0; kind < STOP_KINDS; kind++) {
+        uint64_t seq = stops[kind].load(std::memory_order_acquire);
+        if (seq <= stopsHandled[kind] || seq >= before) {
+            continue;
+        }
+        switch (kind) {
+        case STOP_ROTATION:
+            controller.stop();
+            break;
+        case STOP_SHUTTER:
+            controller.stopShutter();
+            break;
+        case STOP_CALIBRATION:
+            controller.abortCalibration();
+            break;
+        }
+        stopsHandled[kind] = seq;
+        handled = std::max(handled, seq);
+    }
+}
+
+DomeController::Calibration ControlThread::getCalibration() {
+    std::lock_guard<std::mutex> lock(calibrationMutex);
+    return calibrationOut;
+}
+
+bool ControlThread::wait(uint64_t seq, int timeoutMs) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (getState().commandsHandled < seq) {
+        if (!running || std::chrono::steady_clock::now() > until) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(periodUs / 4));
+    }
+    return true;
+}
+
+uint64_t ControlThread::moveTo(double az) {
+    Command command = {};
+    command.type = Command::MOVE_TO;
+    command.azimuth = az;
+    return send(command);
+}
+
+uint64_t ControlThread::move(DomeController::RotDirection dir) {
+    Command command = {};
+    command.type = Command::MOVE;
+    command.direction = dir;
+    return send(command);
+}
+
+uint64_t ControlThread::stopRotation() {
+    return requestStop(STOP_ROTATION);
+}
+
+uint64_t ControlThread::openShutter() {
+    Command command = {};
+    command.type = Command::OPEN_SHUTTER;
+    return send(command);
+}
+
+uint64_t ControlThread::closeShutter() {
+    Command command = {};
+    command.type = Command::CLOSE_SHUTTER;
+    return send(command);
+}
+
+uint64_t ControlThread::stopShutter() {
+    return requestStop(STOP_SHUTTER);
+}
+
+uint64_t ControlThread::detectShutterState() {
+    Command command = {};
+    command.type = Command::DETECT_SHUTTER;
+    return send(command);
+}
+
+uint64_t ControlThread::setShutterTravel(const double travel[2]) {
+    Command command = {};
+    command.type = Command::SET_SHUTTER_TRAVEL;
+    command.shutterTravel[DomeController::TRAVEL_OPEN] = travel[DomeController::TRAVEL_OPEN];
+    command.shutterTravel[DomeController::TRAVEL_CLOSE] = travel[DomeController::TRAVEL_CLOSE];
+    return send(command);
+}
+
+uint64_t ControlThread::startCalibration() {
+    Command command = {};
+    command.type = Command::START_CALIBRATION;
+    return send(command);
+}
+
+uint64_t ControlThread::verifyCalibration(const DomeController::Calibration &calibration, double az, const double deceleration[2]) {
+    {
+        std::lock_guard<std::mutex> lock(calibrationMutex);
+        calibrationIn = calibration;
+    }
+    Command command = {};
+    command.type = Command::VERIFY_CALIBRATION;
+    command.azimuth = az;
+    command.deceleration[DomeController::SPEED_R] = deceleration[DomeController::SPEED_R];
+    command.deceleration[DomeController::SPEED_L] = deceleration[DomeController::SPEED_L];
+    return send(command);
+}
+
+uint64_t ControlThread::abortCalibration() {
+    return requestStop(STOP_CALIBRATION);
+}
+
+uint64_t ControlThread::setRecalibration(bool on) {
+    Command command = {};
+    command.type = Command::SET_RECALIBRATION;
+    command.enabled = on;
+    return send(command);
+}
+
+uint64_t ControlThread::setEdgeStop(bool on) {
+    Command command = {};
+    command.type = Command::SET_EDGE_STOP;
+    command.enabled = on;
+    return send(command);
+}
+
+void ControlThread::handle(const Command &command) {
+    switch (command.type) {
+    case Command::MOVE_TO:
+        controller.moveTo(command.azimuth);
+        break;
+    case Command::MOVE:
+        controller.move(command.direction);
+        break;
+    case Command::OPEN_SHUTTER:
+        controller.openShutter();
+        break;
+    case Command::CLOSE_SHUTTER:
+        controller.closeShutter();
+        break;
+    case Command::DETECT_SHUTTER:
+        controller.detectShutterState();
+        break;
+    case Command::SET_SHUTTER_TRAVEL:
+        controller.setShutterTravel(DomeController::TRAVEL_OPEN, command.shutterTravel[DomeController::TRAVEL_OPEN]);
+        controller.setShutterTravel(DomeController::TRAVEL_CLOSE, command.shutterTravel[DomeController::TRAVEL_CLOSE]);
+        break;
+    case Command::START_CALIBRATION:
+        controller.startCalibration();
+        break;
+    case Command::VERIFY_CALIBRATION: {
+        // a later verification may have replaced it meanwhile, its own command follows then
+        std::lock_guard<std::mutex> lock(calibrationMutex);
+        controller.verifyCalibration(calibrationIn, command.azimuth);
+        controller.setDeceleration(DomeController::RotDirection::RIGHT, command.deceleration[DomeController::SPEED_R]);
+        controller.setDeceleration(DomeController::RotDirection::LEFT, command.deceleration[DomeController::SPEED_L]);
+        break;
+    }
+    case Command::SET_RECALIBRATION:
+        controller.setRecalibration(command.enabled);
+        break;
+    case Command::SET_EDGE_STOP:
+        controller.setEdgeStop(command.enabled);
+        break;
+    }
+    handled = command.seq;
+}
+
+void ControlThread::publish() {
+    DomeState s;
+    s.commandsHandled = handled;
+    s.azimuth = controller.getAzimuth();
+    s.azimuthUncertainty = controller.getAzimuthUncertainty();
+    s.velocity = controller.getVelocity();
+    s.target = controller.getTarget();
+    s.targetEta = controller.getTargetEta();
+    s.coast[DomeController::SPEED_R] = controller.getCoast(DomeController::RotDirection::RIGHT);
+    s.coast[DomeController::SPEED_L] = controller.getCoast(DomeController::RotDirection::LEFT);
+    s.deceleration[DomeController::SPEED_R] = controller.getDeceleration(DomeController::RotDirection::RIGHT);
+    s.deceleration[DomeController::SPEED_L] = controller.getDeceleration(DomeController::RotDirection::LEFT);
+    s.rotation = controller.getRotation();
+    s.rotationStalled = controller.isRotationStalled();
+    s.rotationStalls = controller.getRotationStalls();
+    s.missedNorth = controller.getMissedNorth();
+    s.shutterAction = controller.getShutterAction();
+    s.shutterPosition = controller.getShutterPosition();
+    s.shutterRemaining = controller.getShutterRemaining();
+    s.shutterTravel[DomeController::TRAVEL_OPEN] = controller.getShutterTravel(DomeController::TRAVEL_OPEN);
+    s.shutterTravel[DomeController::TRAVEL_CLOSE] = controller.getShutterTravel(DomeController::TRAVEL_CLOSE);
+    s.shutterStalled = controller.isShutterStalled();
+    s.calibrationStep = controller.getCalibrationStep();
+    s.calibrationProgress = controller.getCalibrationProgress();
+    s.calibrationDrift = controller.getCalibrationDrift();
+    s.northResidual = controller.getNorthResidual();
+    s.speed[DomeController::SPEED_R] = controller.getCalibration().speed[DomeController::SPEED_R];
+    s.speed[DomeController::SPEED_L] = controller.getCalibration().speed[DomeController::SPEED_L];
+    s.movingToTarget = controller.isMovingToTarget();
+    s.calibrating = controller.isCalibrating();
+    s.still = controller.isStill();
+    s.gpioLost = controller.isGpioLost();
+    s.idle = controller.isIdle();
+    state.write(s);
+
+    if (liveState.isOpen()) {
+        LiveDomeState live = {};
+        live.azimuth = s.azimuth;
+        live.uncertainty = s.azimuthUncertainty;
+        live.velocity = s.velocity;
+        live.target = s.target;
+        live.shutterPosition = s.shutterPosition;
+        live.rotation = s.rotation;
+        live.shutter = s.shutterAction;
+        live.flags = (s.movingToTarget ? LiveDomeState::MOVING_TO_TARGET : 0) | (s.calibrating ? LiveDomeState::CALIBRATING : 0)
+                     | (s.still ? LiveDomeState::STILL : 0) | (s.rotationStalled ? LiveDomeState::ROTATION_STALLED : 0)
+                     | (s.shutterStalled ? LiveDomeState::SHUTTER_STALLED : 0);
+        liveState.write(live);
+    }
+}
+
+void ControlThread::onEdge(void *userdata) {
+    static_cast<ControlThread *>(userdata)->wake();
+}
+
+void ControlThread::wake() {
+    // pairs with the fence in sleepWhileIdle(): either the loop sees what was queued or this sees it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+        notify(wakeFd);
+    }
+}
+
+void ControlThread::sleepWhileIdle() {
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (wakeFd >= 0 && running.load(std::memory_order_relaxed) && commands.empty() && !hasPendingStops()
+        && !controller.hasPendingEdges()) {
+        pollfd fd = {wakeFd, POLLIN, 0};
+        poll(&fd, 1, CONTROL_IDLE_TIMEOUT_MS);
+    } else if (wakeFd < 0) {
+        usleep(periodUs);
+    }
+    sleeping.store(false, std::memory_order_relaxed);
+    // resetting the counter, it stays 0 if the timeout or a queue woke it
+    uint64_t count;
+    ssize_t got = read(wakeFd, &count, sizeof(count));
+    (void)got;
+}
+
+void ControlThread::run() {
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (running.load(std::memory_order_relaxed)) {
+        timespec woke;
+        if (controller.isIdle()) {
+            // an edge is handled right away, the schedule starts again from it
+            sleepWhileIdle();
+            clock_gettime(CLOCK_MONOTONIC, &woke);
+            next = woke;
+        } else {
+            next.tv_nsec += periodUs * 1000L;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+
+            clock_gettime(CLOCK_MONOTONIC, &woke);
+            int64_t late = (woke.tv_sec - next.tv_sec) * 1000000000LL + (woke.tv_nsec - next.tv_nsec);
+            timerJitter.record(late > 0 ? late : 0);
+            // after an overrun the schedule starts again from now instead of catching up
+            if (late > static_cast<int64_t>(periodUs) * 1000) {
+                next = woke;
+            }
+        }
+        wakeups.fetch_add(1, std::memory_order_relaxed);
+
+        Command command;
+        while (commands.pop(command)) {
+            handleStops(command.seq);
+            handle(command);
+        }
+        handleStops(UINT64_MAX);
+        unsigned cycleEvents = controller.update();
+        // the driver takes the calibration with the events or once it sees the dome at rest
+        bool still = controller.isStill();
+        if ((cycleEvents & CALIBRATION_EVENTS) || (still && !wasStill)) {
+            std::lock_guard<std::mutex> lock(calibrationMutex);
+            calibrationOut = controller.getCalibration();
+        }
+        wasStill = still;
+        publish();
+        events.fetch_or(cycleEvents, std::memory_order_release);
+
+        timespec done;
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        loopDuration.record((done.tv_sec - woke.tv_sec) * 1000000000LL + (done.tv_nsec - woke.tv_nsec));
+        timespec cpu;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        cpuTime.store(cpu.tv_sec * 1000000000ull + cpu.tv_nsec, std::memory_order_relaxed);
+    }
+}
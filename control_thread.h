@@ -0,0 +1,185 @@
+#pragma once
+
+#include "dome_controller.h"
+#include "latency_histogram.h"
+#include "live_state_writer.h"
+#include "seqlock.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// the dome as the control thread saw it after its last cycle
+struct DomeState {
+    uint64_t commandsHandled = 0;
+    double azimuth = 0;
+    double azimuthUncertainty = 360;
+    double velocity = 0;
+    double target = 0;
+    double targetEta = 0;
+    double coast[2] = {0, 0};
+    double deceleration[2] = {0, 0};
+    DomeController::RotDirection rotation = DomeController::RotDirection::NONE;
+    bool rotationStalled = false;
+    uint32_t rotationStalls = 0;
+    uint32_t missedNorth = 0;
+    DomeController::ShutterAction shutterAction = DomeController::ShutterAction::STOPPED;
+    double shutterPosition = 0.5;
+    double shutterRemaining = 0;
+    double shutterTravel[2] = {0, 0};
+    bool shutterStalled = false;
+    DomeController::CalibrationStep calibrationStep = DomeController::CalibrationStep::IDLE;
+    double calibrationProgress = 0;
+    double calibrationDrift = 0;
+    double northResidual = 0;
+    // of the calibration, the whole one with its tooth table is taken with ControlThread::getCalibration()
+    double speed[2] = {0, 0};
+    bool movingToTarget = false;
+    bool calibrating = false;
+    bool still = true;
+    bool gpioLost = false;
+    // the loop sleeps until an edge or a command comes, see DomeController::isIdle()
+    bool idle = true;
+};
+
+// runs the DomeController in its own thread so stop decisions never wait for the INDI event loop
+// commands go in through a lock-free queue, the state comes back as a seqlock protected snapshot and the events of
+// the cycles are collected until they are taken
+// apart from the snapshot and the events only one thread (the INDI one) may use it, and only it touches the
+// controller once the thread is started
+// while the dome is idle the loop sleeps until an edge or a command wakes it, at most CONTROL_IDLE_TIMEOUT_MS
+// stops don't go through the queue: each kind is a flag the loop checks every cycle, so a full queue never holds
+// one back; it still takes effect in order, after the commands sent before it and before those sent after it
+class ControlThread
+{
+public:
+    struct Command {
+        enum Type {
+            MOVE_TO,
+            MOVE,
+            OPEN_SHUTTER,
+            CLOSE_SHUTTER,
+            DETECT_SHUTTER,
+            SET_SHUTTER_TRAVEL,
+            START_CALIBRATION,
+            VERIFY_CALIBRATION,
+            SET_RECALIBRATION,
+            SET_EDGE_STOP
+        };
+        Type type;
+        uint64_t seq;   // set by send()
+        double azimuth;
+        DomeController::RotDirection direction;
+        double deceleration[2];
+        double shutterTravel[2];
+        bool enabled;
+    };
+
+    ControlThread(DomeController &controller, uint32_t periodUs);
+    ~ControlThread();
+
+    void start();
+    void stop();
+
+    // SCHED_FIFO with priority 1-99 or the normal scheduler with 0, pinned to cpu or to none with -1
+    bool setRealtime(int priority, int cpu, std::string &error);
+    // keeping all pages of the process in memory so the loop never waits for a page fault
+    static bool lockMemory(bool lock, std::string &error);
+
+    // the command's sequence number, 0 if the queue is full and the command was dropped
+    uint64_t send(const Command &command);
+    // waiting until the command with sequence number seq was handled, false on timeout
+    bool wait(uint64_t seq, int timeoutMs);
+
+    uint64_t moveTo(double az);
+    uint64_t move(DomeController::RotDirection dir);
+    // the stops never fail
+    uint64_t stopRotation();
+    uint64_t openShutter();
+    uint64_t closeShutter();
+    uint64_t stopShutter();
+    uint64_t detectShutterState();
+    // full travel times in s (TRAVEL_OPEN, TRAVEL_CLOSE), 0 if unknown
+    uint64_t setShutterTravel(const double travel[2]);
+    uint64_t startCalibration();
+    // a cached calibration with the dome at az, see DomeController::verifyCalibration()
+    // the calibration is handed over beside the queue, the command only says when to take it
+    uint64_t verifyCalibration(const DomeController::Calibration &calibration, double az, const double deceleration[2]);
+    uint64_t abortCalibration();
+    // refining the calibration each time the dome passes north
+    uint64_t setRecalibration(bool on);
+    // stopping slews at an edge from the alert thread, see DomeController::setEdgeStop()
+    uint64_t setEdgeStop(bool on);
+
+    DomeState getState() const { return state.read(); }
+    // the calibration as of the last event or halt, copied by the loop when a calibration event happened or the dome
+    // came to rest, before it published them
+    DomeController::Calibration getCalibration();
+    // the state is current if all commands sent were handled when it was taken
+    bool isCurrent(const DomeState &s) const { return s.commandsHandled == sent; }
+    // DomeController::Events of all cycles since the last call
+    unsigned takeEvents() { return events.exchange(0, std::memory_order_acquire); }
+
+    // how late the loop woke up against its schedule and how long a cycle took
+    LatencyHistogram &getTimerJitter() { return timerJitter; }
+    LatencyHistogram &getLoopDuration() { return loopDuration; }
+    // cycles run and CPU time the thread used in ns since the start
+    uint64_t getWakeups() const { return wakeups.load(std::memory_order_relaxed); }
+    uint64_t getCpuTime() const { return cpuTime.load(std::memory_order_relaxed); }
+    // the state for other processes, written with the snapshot once opened, open it before start()
+    LiveStateWriter &getLiveState() { return liveState; }
+
+private:
+    DomeController &controller;
+    uint32_t periodUs;
+
+    std::thread thread;
+    std::atomic<bool> running {false};
+    void run();
+    void handle(const Command &command);
+    void publish();
+
+    // the sequence number of the latest stop of each kind, 0 for none
+    enum Stop {
+        STOP_ROTATION,
+        STOP_SHUTTER,
+        STOP_CALIBRATION,
+        STOP_KINDS
+    };
+    std::atomic<uint64_t> stops[STOP_KINDS] = {};
+    // the loop's: the stops it handled
+    uint64_t stopsHandled[STOP_KINDS] = {};
+    uint64_t requestStop(Stop kind);
+    bool hasPendingStops() const;
+    // handles the stops sent before the command with sequence number before
+    void handleStops(uint64_t before);
+
+    // the calibration beside the queue, about 2 KB with its tooth table, too much to copy with every command or
+    // snapshot: in for VERIFY_CALIBRATION, out on calibration events and halts
+    std::mutex calibrationMutex;
+    DomeController::Calibration calibrationIn;
+    DomeController::Calibration calibrationOut;
+    bool wasStill = true;
+
+    // an eventfd the idle loop waits on, written only while it sleeps so moving costs no syscall per edge
+    int wakeFd = -1;
+    std::atomic<bool> sleeping {false};
+    void sleepWhileIdle();
+    void wake();
+    static void onEdge(void *userdata);
+
+    SpscQueue<Command, 64> commands;
+    uint64_t sent = 0;
+    uint64_t handled = 0;
+    Seqlock<DomeState> state;
+    LiveStateWriter liveState;
+    std::atomic<unsigned> events {0};
+
+    LatencyHistogram timerJitter;
+    LatencyHistogram loopDuration;
+    std::atomic<uint64_t> wakeups {0};
+    std::atomic<uint64_t> cpuTime {0};
+};
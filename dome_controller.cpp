@@ -0,0 +1,1318 @@
+#include "dome_controller.h"
+#include "angles.h"
+#include "dome_pins.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// impulse edges per rotation the capture has room for up front, a larger ring grows it once in the loop
+#define CALIBRATION_CAPTURE_RESERVED 512
+// time the dome keeps turning to guarantee an overshoot past north
+#define CALIBRATION_OVERSHOOT_US 1000000
+#define CALIBRATION_MAX_RETRIES 3
+// uncertainty of the position at an impulse edge and at north in °
+#define IMPULSE_SIGMA 0.1
+#define NORTH_SIGMA 0.1
+// a tracked edge refines its table entry if it was predicted at least that well, weighted by the gain
+#define TOOTH_REFINE_SIGMA 0.15
+#define TOOTH_REFINE_GAIN 0.05
+// a cached calibration has drifted if the speed changed by more than this fraction
+#define VERIFY_SPEED_TOLERANCE 0.1
+// each north crossing moves the calibration by this fraction towards what it measured
+#define RECALIBRATION_GAIN 0.2
+// a speed further off than this fraction is a disturbance, not a drift
+#define RECALIBRATION_SPEED_OUTLIER 0.2
+// crossings in a row off by more than half a tooth until the calibration counts as drifted
+#define RECALIBRATION_MAX_MISMATCHES 3
+// delays after the last edge shorter than the watchdog's resolution stop at the edge
+#define EDGE_STOP_MIN_DELAY_US 1000
+// the encoder stalled if no edge came for this factor times the widest gap between two edges
+#define STALL_GAP_FACTOR 3.0
+// spin up time allowed before the first edge while the deceleration isn't known in s
+#define STALL_SPIN_UP 2.0
+// the longest watchdog timeout pigpio takes in ms
+#define WATCHDOG_MAX_MS 60000
+// north is missed if the dome got this many teeth past its position without the sensor
+#define NORTH_MISS_MARGIN 2
+// full shutter travel in s assumed until one was measured and the limit then
+#define SHUTTER_DEFAULT_TRAVEL 30.0
+#define SHUTTER_MAX_TRAVEL 120.0
+// the shutter stalled if it takes longer than this factor times the learned travel plus the margin in s
+#define SHUTTER_STALL_FACTOR 1.5
+#define SHUTTER_STALL_MARGIN 2.0
+// weight of a new travel time measurement
+#define SHUTTER_TRAVEL_GAIN 0.3
+
+DomeController::DomeController(GpioBackend &gpio, const DomePinMap &pins)
+    : gpio(gpio), pins(pins), relaysRot(pins.rotationRelays()), relaysShutter(pins.shutterRelays()) {
+    capturedEdges[ToothTable::RIGHT].reserve(CALIBRATION_CAPTURE_RESERVED);
+    capturedEdges[ToothTable::LEFT].reserve(CALIBRATION_CAPTURE_RESERVED);
+}
+
+bool DomeController::setRelays(uint32_t group, uint32_t on) {
+    uint32_t next = (relays & ~group) | on;
+    // the relays of a group must never be switched on together
+    if ((next & relaysRot) == relaysRot || (next & relaysShutter) == relaysShutter) {
+        return false;
+    }
+    uint32_t release = relays & ~next;
+    uint32_t engage = next & ~relays;
+    if (!release && !engage) {
+        return true;
+    }
+    auto started = std::chrono::steady_clock::now();
+    if (release) {
+        driveRelays(release, false);
+    }
+    if (engage) {
+        driveRelays(engage, true);
+    }
+    relayLatency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+    relays = next;
+    recorder.record(FlightRecord::RELAYS, gpio.tick(), FlightRecord::RELAYS_BY_LOOP, relays);
+    return true;
+}
+
+void DomeController::driveRelays(uint32_t bits, bool on) {
+    // active low relays are switched on by clearing their GPIOs, active high ones by setting them
+    uint32_t high = on ? bits & pins.activeHigh : bits & ~pins.activeHigh;
+    uint32_t low = bits & ~high;
+    if (high) {
+        gpio.writeBitsSet(high);
+    }
+    if (low) {
+        gpio.writeBitsClear(low);
+    }
+}
+
+// Control funktions for motors
+void DomeController::right() {
+    disarmEdgeStop();
+    setRelays(relaysRot, pins.mask(SIGNAL_R));
+    if (curRot != RotDirection::RIGHT) {
+        segmentImpulses = 0;
+        estimator.setMotion(PositionEstimator::RIGHT, gpio.tick());
+        armStallWatchdog(RotDirection::RIGHT);
+    }
+    curRot = RotDirection::RIGHT;
+    lastRot = RotDirection::RIGHT;
+}
+
+void DomeController::left() {
+    disarmEdgeStop();
+    setRelays(relaysRot, pins.mask(SIGNAL_L));
+    if (curRot != RotDirection::LEFT) {
+        segmentImpulses = 0;
+        estimator.setMotion(PositionEstimator::LEFT, gpio.tick());
+        armStallWatchdog(RotDirection::LEFT);
+    }
+    curRot = RotDirection::LEFT;
+    lastRot = RotDirection::LEFT;
+}
+
+void DomeController::stopRot() {
+    disarmEdgeStop();
+    disarmStallWatchdog();
+    setRelays(relaysRot, 0);
+    segmentImpulses = 0;
+    estimator.setMotion(PositionEstimator::STANDING, gpio.tick());
+    curRot = RotDirection::NONE;
+}
+
+void DomeController::open() {
+    setRelays(relaysShutter, pins.mask(SIGNAL_O));
+}
+
+void DomeController::close() {
+    setRelays(relaysShutter, pins.mask(SIGNAL_C));
+}
+
+void DomeController::stopShutterMotor() {
+    setRelays(relaysShutter, 0);
+}
+
+// sensors
+DomeController::SensorState DomeController::sampleSensors() {
+    SensorState s;
+    s.tick = gpio.tick();
+    uint32_t active = pins.active(gpio.readBits());
+    s.open = active & pins.mask(SIGNAL_ISO);
+    s.closed = active & pins.mask(SIGNAL_ISC);
+    s.north = active & pins.mask(SIGNAL_ISN);
+    s.rotImp = active & pins.mask(SIGNAL_ROT);
+    relayLevels = ~active & (relaysRot | relaysShutter);
+    return s;
+}
+
+bool DomeController::init(std::string &error) {
+    // Setting up relays
+    if (!pins.validate(error)) {
+        return false;
+    }
+    // all relays released before they become outputs, so none is switched on for a moment
+    driveRelays(relaysRot | relaysShutter, false);
+    for (int i = FIRST_RELAY; i <= LAST_RELAY; i++) {
+        int err = gpio.setMode(pins.gpio[i], PI_OUTPUT);
+        if (err) {
+            error = std::string("Setting the mode of GPIO ") + DOME_SIGNAL_NAMES[i] + " (" + std::to_string(pins.gpio[i]) + ") failed. Error code: " + std::to_string(err);
+            return false;
+        }
+    }
+    relays = 0;
+
+    // Setting up sensors
+    for (int i = FIRST_SENSOR; i <= LAST_SENSOR; i++) {
+        int err = gpio.setMode(pins.gpio[i], PI_INPUT);
+        if (err) {
+            error = std::string("Setting the mode of GPIO ") + DOME_SIGNAL_NAMES[i] + " (" + std::to_string(pins.gpio[i]) + ") failed. Error code: " + std::to_string(err);
+            return false;
+        }
+        err = gpio.setPullUpDown(pins.gpio[i], pins.pull[i]);
+        if (err) {
+            error = std::string("Setting the pull of GPIO ") + DOME_SIGNAL_NAMES[i] + " (" + std::to_string(pins.gpio[i]) + ") failed. Error code: " + std::to_string(err);
+            return false;
+        }
+    }
+
+    curRot = RotDirection::NONE;
+    return true;
+}
+
+void DomeController::onSensorEdge(int gpio, int level, uint32_t tick, void *userdata) {
+    // runs in the alert thread: only hand the edge over to the control loop
+    DomeController *controller = static_cast<DomeController *>(userdata);
+    bool queued = controller->sensorEdges.push({static_cast<uint8_t>(gpio), static_cast<uint8_t>(level), tick});
+    if (!queued) {
+        controller->droppedEdges.fetch_add(1, std::memory_order_relaxed);
+    }
+    // except the shutter reaching its limit switch, its motor is stopped right away
+    // releasing relays never breaks an interlock, the control loop notices it from the relay levels
+    uint32_t limit = controller->shutterLimit.load(std::memory_order_relaxed);
+    if (level != PI_TIMEOUT && gpio < 32 && limit == (1u << gpio) && controller->isActive(gpio, level)
+        && controller->shutterLimit.compare_exchange_strong(limit, 0, std::memory_order_relaxed)) {
+        controller->driveRelays(controller->relaysShutter, false);
+    }
+    // and the dome reaching the edge it is stopped at
+    if (gpio == static_cast<int>(controller->pins.gpio[SIGNAL_ROT]) && (queued || level == PI_TIMEOUT)) {
+        controller->alertEdgeStop(level, tick);
+    }
+    EdgeListener listener = controller->edgeListener.load(std::memory_order_acquire);
+    if (listener && queued) {
+        listener(controller->edgeListenerData.load(std::memory_order_relaxed));
+    }
+}
+
+void DomeController::setEdgeListener(EdgeListener listener, void *userdata) {
+    edgeListenerData.store(userdata, std::memory_order_relaxed);
+    edgeListener.store(listener, std::memory_order_release);
+}
+
+void DomeController::alertEdgeStop(int level, uint32_t tick) {
+    // the edges are counted like the control loop pops them, so it can arm a stop some edges ahead
+    unsigned pin = pins.gpio[SIGNAL_ROT];
+    uint64_t arm = stopArm.load(std::memory_order_acquire);
+    if (level == PI_TIMEOUT) {
+        if (!stopPending) {
+            alertStall(tick);
+            return;
+        }
+        // the delay after the armed edge passed
+        bool due = arm == stopPending;
+        stopPending = 0;
+        if (due) {
+            fireEdgeStop(arm, tick);
+        } else {
+            gpio.setWatchdog(pin, stallTimeout.load(std::memory_order_relaxed));
+        }
+        return;
+    }
+    uint32_t seq = rotEdgesSeen.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (stopPending) {
+        bool overran = arm == stopPending;
+        stopPending = 0;
+        if (overran) {
+            // another edge before the watchdog: the dome is faster than expected and already past the stop point
+            fireEdgeStop(arm, tick);
+            return;
+        }
+        gpio.setWatchdog(pin, stallTimeout.load(std::memory_order_relaxed));
+    } else if (stallSpinUp.exchange(false, std::memory_order_relaxed)) {
+        // the dome turns, from now on the edges have to come at full speed
+        gpio.setWatchdog(pin, stallTimeout.load(std::memory_order_relaxed));
+    }
+    if (!arm || static_cast<uint32_t>(arm) != seq) {
+        return;
+    }
+    uint32_t delay = arm >> 32;
+    if (delay < EDGE_STOP_MIN_DELAY_US) {
+        fireEdgeStop(arm, tick);
+    } else {
+        stopPending = arm;
+        gpio.setWatchdog(pin, (delay + 500) / 1000);
+    }
+}
+
+void DomeController::fireEdgeStop(uint64_t arm, uint32_t tick) {
+    // a stop the control loop disarmed meanwhile isn't carried out
+    if (stopArm.compare_exchange_strong(arm, 0, std::memory_order_relaxed)) {
+        driveRelays(relaysRot, false);
+        // coasting to a halt isn't a stall
+        stallTimeout.store(0, std::memory_order_relaxed);
+        gpio.setWatchdog(pins.gpio[SIGNAL_ROT], 0);
+        stopFiredTick.store(tick, std::memory_order_relaxed);
+        stopFired.store(arm, std::memory_order_release);
+    } else {
+        gpio.setWatchdog(pins.gpio[SIGNAL_ROT], stallTimeout.load(std::memory_order_relaxed));
+    }
+}
+
+void DomeController::alertStall(uint32_t tick) {
+    // a timeout left over from a watchdog the control loop disarmed meanwhile only cancels it
+    uint32_t timeout = stallTimeout.load(std::memory_order_relaxed);
+    gpio.setWatchdog(pins.gpio[SIGNAL_ROT], 0);
+    if (timeout && stallTimeout.compare_exchange_strong(timeout, 0, std::memory_order_relaxed)) {
+        driveRelays(relaysRot, false);
+        stallFiredTick.store(tick, std::memory_order_relaxed);
+        stallFired.store(true, std::memory_order_release);
+    }
+}
+
+bool DomeController::startEdgeAlerts(std::string &error) {
+    for (int i = FIRST_SENSOR; i <= LAST_SENSOR; i++) {
+        int err = gpio.setAlertFunc(pins.gpio[i], onSensorEdge, this);
+        if (err) {
+            error = "Registering the edge alert of GPIO " + std::to_string(pins.gpio[i]) + " failed. Error code: " + std::to_string(err);
+            return false;
+        }
+    }
+    // the levels are read after registering so no edge can get lost in between
+    syncSensorStates();
+    return true;
+}
+
+void DomeController::stopEdgeAlerts() {
+    gpio.setWatchdog(pins.gpio[SIGNAL_ROT], 0);
+    for (int i = FIRST_SENSOR; i <= LAST_SENSOR; i++) {
+        gpio.setAlertFunc(pins.gpio[i], nullptr, nullptr);
+    }
+}
+
+void DomeController::syncSensorStates() {
+    sensorEdges.clear();
+    sensors = sampleSensors();
+    prevImpState = sensors.rotImp;
+    northActive = sensors.north;
+    openActive = sensors.open;
+    closedActive = sensors.closed;
+    sensorMismatch = 0;
+}
+
+void DomeController::setCalibration(const Calibration &c) {
+    calibration = c;
+    if (calibration.teeth.teeth != static_cast<int>(calibration.impCount)) {
+        // without a measured table the teeth are assumed even, half of each period active
+        calibration.teeth.fillEven(static_cast<int>(calibration.impCount), calibration.impToNorthOffset, 0.5);
+    }
+    // °/ms to °/s
+    estimator.setVelocity(PositionEstimator::RIGHT, calibration.speed[SPEED_R] * 1000);
+    estimator.setVelocity(PositionEstimator::LEFT, calibration.speed[SPEED_L] * 1000);
+}
+
+double DomeController::getDeceleration(RotDirection dir) const {
+    if (dir == RotDirection::RIGHT) {
+        return estimator.getDeceleration(PositionEstimator::RIGHT);
+    } else if (dir == RotDirection::LEFT) {
+        return estimator.getDeceleration(PositionEstimator::LEFT);
+    }
+    return 0;
+}
+
+void DomeController::setDeceleration(RotDirection dir, double deceleration) {
+    if (dir == RotDirection::RIGHT) {
+        estimator.setDeceleration(PositionEstimator::RIGHT, deceleration);
+    } else if (dir == RotDirection::LEFT) {
+        estimator.setDeceleration(PositionEstimator::LEFT, deceleration);
+    }
+}
+
+double DomeController::getVelocity() const {
+    if (curRot == RotDirection::RIGHT) {
+        return estimator.getVelocity(PositionEstimator::RIGHT);
+    } else if (curRot == RotDirection::LEFT) {
+        return -estimator.getVelocity(PositionEstimator::LEFT);
+    }
+    return 0;
+}
+
+double DomeController::getCoast(RotDirection dir) const {
+    if (dir == RotDirection::RIGHT) {
+        return estimator.getCoast(PositionEstimator::RIGHT);
+    } else if (dir == RotDirection::LEFT) {
+        return estimator.getCoast(PositionEstimator::LEFT);
+    }
+    return 0;
+}
+
+void DomeController::fixAtNorth(RotDirection rot, uint32_t tick) {
+    // turning left north is entered at the other end of its zone
+    double az = rot == RotDirection::LEFT ? calibration.teeth.northLeft : 0;
+    estimator.fix(az, tick, NORTH_SIGMA);
+    placeEdges(az);
+}
+
+void DomeController::recalibrateAtNorth(RotDirection rot, uint32_t tick, unsigned &events) {
+    ToothTable &table = calibration.teeth;
+    // only a crossing at full speed with the position taken from the edges of this motion tells something
+    if (!recalibrate || table.teeth < 1 || curRot != rot || segmentImpulses <= 2) {
+        return;
+    }
+    double expected = rot == RotDirection::RIGHT ? 0 : table.northLeft;
+    northResidual = std::remainder(estimator.estimate(tick) - expected, 360.0);
+    if (std::fabs(northResidual) > 180.0 / table.teeth) {
+        // impulses were lost or counted twice, once is a glitch, again and again the tooth count is wrong
+        if (++northMismatches >= RECALIBRATION_MAX_MISMATCHES) {
+            northMismatches = 0;
+            calibrationDrift = northResidual;
+            events |= Event::CALIBRATION_DRIFTED;
+        }
+        return;
+    }
+    northMismatches = 0;
+
+    if (rot == RotDirection::RIGHT) {
+        // the edges are measured from north, an offset here means they moved against it
+        table.shift(-RECALIBRATION_GAIN * northResidual);
+        calibration.impToNorthOffset -= RECALIBRATION_GAIN * northResidual;
+    } else {
+        table.northLeft += RECALIBRATION_GAIN * northResidual;
+    }
+    // the estimator follows the speed all the time, the calibration keeps it for the next start
+    int s = rot == RotDirection::RIGHT ? SPEED_R : SPEED_L;
+    double measured = estimator.getVelocity(rot == RotDirection::RIGHT ? PositionEstimator::RIGHT : PositionEstimator::LEFT) / 1000;
+    if (std::fabs(measured - calibration.speed[s]) <= RECALIBRATION_SPEED_OUTLIER * calibration.speed[s]) {
+        calibration.speed[s] += RECALIBRATION_GAIN * (measured - calibration.speed[s]);
+    }
+    events |= Event::CALIBRATION_UPDATED;
+}
+
+void DomeController::holdInNorth(uint32_t tick) {
+    double az = std::remainder(estimator.estimate(tick), 360.0);
+    double inZone = std::min(std::max(az, 0.0), calibration.teeth.northLeft);
+    if (std::fabs(az - inZone) > NORTH_SIGMA) {
+        estimator.fix(inZone, tick, NORTH_SIGMA);
+        placeEdges(inZone);
+    }
+}
+
+void DomeController::placeEdges(double az) {
+    int count = calibration.teeth.edgeCount();
+    nextEdge = calibration.teeth.locate(az, prevImpState);
+    if (count == 0) {
+        return;
+    }
+    // the count over full turns stays continuous
+    int moved = (nextEdge - northEdges) % count;
+    moved = moved < 0 ? moved + count : moved;
+    northEdges += moved <= count / 2 ? moved : moved - count;
+}
+
+void DomeController::trackEdge(RotDirection rot, bool active, uint32_t tick) {
+    ToothTable &table = calibration.teeth;
+    int dir = rot == RotDirection::RIGHT ? ToothTable::RIGHT : ToothTable::LEFT;
+    // turning right an impulse starts at an even edge, turning left at an odd one
+    // a level not fitting the expected edge means one was missed
+    int e;
+    if (rot == RotDirection::RIGHT) {
+        e = (nextEdge % 2 == 0) == active ? nextEdge : table.next(nextEdge);
+        nextEdge = table.next(e);
+    } else {
+        e = table.previous(nextEdge);
+        e = (e % 2 == 1) == active ? e : table.previous(e);
+        nextEdge = e;
+    }
+    // running steadily the position predicted from the last edge is good enough to refine this one
+    if (curRot == rot && segmentImpulses > 2 && estimator.uncertainty(tick) < TOOTH_REFINE_SIGMA) {
+        table.refine(dir, e, estimator.estimate(tick), TOOTH_REFINE_GAIN);
+    }
+    estimator.impulse(table.edges[dir][e], tick, IMPULSE_SIGMA);
+    if (active) {
+        // the time between two impulses refines the velocity of this direction
+        if (curRot != RotDirection::NONE && ++segmentImpulses > 2) {
+            int before = table.previous(table.previous(e));
+            double degrees = rot == RotDirection::RIGHT ? table.distance(dir, before, e) : table.distance(dir, e, table.next(table.next(e)));
+            estimator.impulseInterval(estimator.getMotion(), degrees, tick - lastImpTick);
+        }
+        lastImpTick = tick;
+    }
+}
+
+void DomeController::handleEdge(const SensorEdge &edge, unsigned &events) {
+    bool active = isActive(edge.gpio, edge.level);
+    // while calibrating the impulse positions aren't known yet, while verifying they are taken from the cache
+    bool tracking = calibrationStep == CalibrationStep::IDLE || isVerifying();
+    RotDirection rot;
+    switch (pins.signal(edge.gpio)) {
+    case SIGNAL_ROT:
+        // the position at an impulse edge is exactly known
+        // after the motor was stopped the dome still coasts in the last direction
+        rot = curRot != RotDirection::NONE ? curRot : lastRot;
+        if (tracking && active != prevImpState && rot != RotDirection::NONE && calibration.teeth.teeth > 0) {
+            int previous = nextEdge;
+            trackEdge(rot, active, edge.tick);
+            countNorthEdges(previous, events);
+        }
+        prevImpState = active;
+        break;
+    case SIGNAL_ISN:
+        northActive = active;
+        // while verifying the tracked position is compared at north, it mustn't be reset before
+        if (active && calibrationStep == CalibrationStep::IDLE) {
+            rot = curRot != RotDirection::NONE ? curRot : lastRot;
+            recalibrateAtNorth(rot, edge.tick, events);
+            fixAtNorth(rot, edge.tick);
+        }
+        if (active && tracking && calibration.teeth.teeth > 0) {
+            northSeen = true;
+            northSeenAt = northEdges;
+            northDue = false;
+        }
+        break;
+    case SIGNAL_ISO:
+        openActive = active;
+        if (active && currentShutterAction == ShutterAction::OPENING) {
+            finishShutter(edge.tick, events);
+        }
+        break;
+    case SIGNAL_ISC:
+        closedActive = active;
+        if (active && currentShutterAction == ShutterAction::CLOSING) {
+            finishShutter(edge.tick, events);
+        }
+        break;
+    }
+    if (calibrationStep != CalibrationStep::IDLE) {
+        stepCalibration(edge, active, events);
+    }
+}
+
+void DomeController::checkSensors(uint32_t newer, unsigned &events) {
+    uint32_t tracked = (openActive ? pins.mask(SIGNAL_ISO) : 0) | (closedActive ? pins.mask(SIGNAL_ISC) : 0)
+                       | (northActive ? pins.mask(SIGNAL_ISN) : 0) | (prevImpState ? pins.mask(SIGNAL_ROT) : 0);
+    uint32_t sampled = (sensors.open ? pins.mask(SIGNAL_ISO) : 0) | (sensors.closed ? pins.mask(SIGNAL_ISC) : 0)
+                       | (sensors.north ? pins.mask(SIGNAL_ISN) : 0) | (sensors.rotImp ? pins.mask(SIGNAL_ROT) : 0);
+    // alerts arrive with a delay, only a mismatch lasting two snapshots is a missed edge
+    uint32_t mismatch = (tracked ^ sampled) & ~newer;
+    uint32_t missed = mismatch & sensorMismatch;
+    sensorMismatch = mismatch & ~missed;
+    for (int i = FIRST_SENSOR; i <= LAST_SENSOR; i++) {
+        uint32_t mask = pins.mask(i);
+        if (missed & mask) {
+            // the level changed unnoticed some time before the snapshot
+            uint8_t level = ((sampled & mask) != 0) == pins.isActiveHigh(i) ? 1 : 0;
+            handleEdge({static_cast<uint8_t>(pins.gpio[i]), level, sensors.tick}, events);
+            resyncedEdges.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void DomeController::startCalibration() {
+    recorder.record(FlightRecord::COMMAND, gpio.tick(), FlightRecord::START_CALIBRATION, 0);
+    calibrationRetries = 0;
+    moveToTarget = false;
+    // moving to the leftmost point that's north
+    right();
+    unsigned events = 0;
+    setCalibrationStep(CalibrationStep::RIGHT_SEEK_NORTH, gpio.tick(), events);
+}
+
+void DomeController::verifyCalibration(const Calibration &c, double az) {
+    recorder.recordValues(FlightRecord::COMMAND, gpio.tick(), FlightRecord::VERIFY_CALIBRATION, range360(az));
+    calibrationRetries = 0;
+    moveToTarget = false;
+    setCalibration(c);
+    estimator.fix(az, gpio.tick(), 180.0 / calibration.impCount);
+    placeEdges(az);
+    // north is always entered turning right, like when it was calibrated
+    unsigned events = 0;
+    if (northActive) {
+        left();
+        setCalibrationStep(CalibrationStep::VERIFY_LEFT_LEAVE_NORTH, gpio.tick(), events);
+    } else if (range360(az) >= 180) {
+        right();
+        setCalibrationStep(CalibrationStep::VERIFY_RIGHT_SEEK_NORTH, gpio.tick(), events);
+    } else {
+        left();
+        setCalibrationStep(CalibrationStep::VERIFY_LEFT_SEEK_NORTH, gpio.tick(), events);
+    }
+}
+
+void DomeController::assumeAzimuth(double az) {
+    estimator.fix(az, gpio.tick(), 180.0 / calibration.impCount);
+    placeEdges(az);
+}
+
+void DomeController::abortCalibration() {
+    recorder.record(FlightRecord::COMMAND, gpio.tick(), FlightRecord::ABORT_CALIBRATION, 0);
+    stopRot();
+    unsigned events = 0;
+    setCalibrationStep(CalibrationStep::IDLE, gpio.tick(), events);
+}
+
+double DomeController::getCalibrationProgress() const {
+    if (isVerifying()) {
+        return 100.0 * (calibrationStep - CalibrationStep::VERIFY_LEFT_SEEK_NORTH) / (CalibrationStep::VERIFY_RIGHT_SEEK_NORTH - CalibrationStep::VERIFY_LEFT_SEEK_NORTH + 1);
+    }
+    return 100.0 * calibrationStep / (CalibrationStep::RETURN_NORTH + 1);
+}
+
+void DomeController::setCalibrationStep(CalibrationStep step, uint32_t tick, unsigned &events) {
+    calibrationStep = step;
+    calibrationStepTick = tick;
+    events |= Event::CALIBRATION_PROGRESS;
+}
+
+void DomeController::stepCalibration(const SensorEdge &edge, bool active, unsigned &events) {
+    // edges from before the current step belong to the previous motion
+    if (static_cast<int32_t>(edge.tick - calibrationStepTick) < 0) {
+        return;
+    }
+    bool northEntered = edge.gpio == pins.gpio[SIGNAL_ISN] && active;
+    bool northLeft = edge.gpio == pins.gpio[SIGNAL_ISN] && !active;
+
+    switch (calibrationStep) {
+    case CalibrationStep::RIGHT_SEEK_NORTH:
+        if (northEntered) {
+            // start of time meassurement of a full right/clockwise rotation (leftmost north to leftmost north)
+            // counting edges (both kinds) of rotation impuls sensor at the same time
+            calibrationTimeStarted = edge.tick;
+            calibrationEdges = 0;
+            capturedEdges[ToothTable::RIGHT].clear();
+            captureStart[ToothTable::RIGHT] = edge.tick;
+            toothTableBuilt = false;
+            setCalibrationStep(CalibrationStep::RIGHT_MEASURE, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::RIGHT_MEASURE:
+        if (edge.gpio == pins.gpio[SIGNAL_ROT]) {
+            calibrationEdges++;
+            captureEdge(ToothTable::RIGHT, edge, active);
+        } else if (northEntered) {
+            captureEnd[ToothTable::RIGHT] = edge.tick;
+            // the Count of impulses has to be half of the amount of edges because every impuls is counted twice: rising edge and falling edge
+            calibration.impCount = calibrationEdges / 2;
+            // the speed is meassured in °/ms
+            calibration.speed[SPEED_R] = 360.0 / ((edge.tick - calibrationTimeStarted) / 1000.0);
+            // the modell overshoots sometimes after rotating clockwise and is therefore rotated slightly right of the north
+            // that's why it's rotating counterclockwise back to north
+            // to still be reliable it rotates 1 second to the right to guarantee an overshoot
+            setCalibrationStep(CalibrationStep::RIGHT_OVERSHOOT, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::LEFT_SEEK_NORTH:
+        if (northEntered) {
+            setCalibrationStep(CalibrationStep::LEFT_LEAVE_NORTH, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::LEFT_LEAVE_NORTH:
+        if (northLeft) {
+            // meassuring the time a full left/counterclockwise rotation
+            calibrationTimeStarted = edge.tick;
+            capturedEdges[ToothTable::LEFT].clear();
+            captureStart[ToothTable::LEFT] = edge.tick;
+            setCalibrationStep(CalibrationStep::LEFT_MEASURE_ENTER, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::LEFT_MEASURE_ENTER:
+        if (edge.gpio == pins.gpio[SIGNAL_ROT]) {
+            captureEdge(ToothTable::LEFT, edge, active);
+        } else if (northEntered) {
+            captureNorthLeft = edge.tick;
+            setCalibrationStep(CalibrationStep::LEFT_MEASURE_LEAVE, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::LEFT_MEASURE_LEAVE:
+        if (edge.gpio == pins.gpio[SIGNAL_ROT]) {
+            captureEdge(ToothTable::LEFT, edge, active);
+        } else if (northLeft) {
+            captureEnd[ToothTable::LEFT] = edge.tick;
+            // both rotations are measured, returning to north needs where it's entered turning left
+            toothTableBuilt = buildToothTable();
+            calibration.speed[SPEED_L] = 360.0 / ((edge.tick - calibrationTimeStarted) / 1000.0);
+            // again creating an overshoot/offset (this time to the left)
+            setCalibrationStep(CalibrationStep::LEFT_OVERSHOOT, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::OFFSET_SEEK_NORTH:
+        if (northEntered) {
+            if (prevImpState) { // avoid meassuring uncertainty in the case at north is also a imp
+                calibration.impToNorthOffset = 0;
+                finishCalibration(0, edge.tick, events);
+            } else {
+                calibrationTimeStarted = edge.tick;
+                setCalibrationStep(CalibrationStep::OFFSET_SEEK_IMP, edge.tick, events);
+            }
+        }
+        break;
+    case CalibrationStep::OFFSET_SEEK_IMP:
+        if (edge.gpio == pins.gpio[SIGNAL_ROT] && active) {
+            calibration.impToNorthOffset = calibration.speed[SPEED_R] * ((edge.tick - calibrationTimeStarted) / 1000.0);
+            // again creating an overshoot/offset (to the right)
+            setCalibrationStep(CalibrationStep::OFFSET_OVERSHOOT, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::RETURN_NORTH:
+        if (northEntered) {
+            // turning left north is entered at the other end of its zone
+            finishCalibration(calibration.teeth.northLeft, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::VERIFY_LEFT_SEEK_NORTH:
+        if (northEntered) {
+            setCalibrationStep(CalibrationStep::VERIFY_LEFT_LEAVE_NORTH, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::VERIFY_LEFT_LEAVE_NORTH:
+        if (northLeft) {
+            setCalibrationStep(CalibrationStep::VERIFY_LEFT_PASS_IMP, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::VERIFY_LEFT_PASS_IMP:
+        if (edge.gpio == pins.gpio[SIGNAL_ROT] && !active) {
+            // letting the dome come to a halt before reversing so the coasting impulses are still counted left
+            stopRot();
+            setCalibrationStep(CalibrationStep::VERIFY_LEFT_OVERSHOOT, edge.tick, events);
+        }
+        break;
+    case CalibrationStep::VERIFY_RIGHT_SEEK_NORTH:
+        if (northEntered) {
+            finishVerification(edge.tick, events);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void DomeController::stepCalibrationTimer(uint32_t now, unsigned &events) {
+    // the overshoot steps only end by time
+    if (static_cast<int32_t>(now - calibrationStepTick) < CALIBRATION_OVERSHOOT_US) {
+        return;
+    }
+    switch (calibrationStep) {
+    case CalibrationStep::RIGHT_OVERSHOOT:
+        left();
+        setCalibrationStep(northActive ? CalibrationStep::LEFT_LEAVE_NORTH : CalibrationStep::LEFT_SEEK_NORTH, gpio.tick(), events);
+        break;
+    case CalibrationStep::LEFT_OVERSHOOT:
+        //meassuring the positions of the imps
+        right();
+        setCalibrationStep(CalibrationStep::OFFSET_SEEK_NORTH, gpio.tick(), events);
+        break;
+    case CalibrationStep::VERIFY_LEFT_OVERSHOOT:
+        right();
+        setCalibrationStep(CalibrationStep::VERIFY_RIGHT_SEEK_NORTH, gpio.tick(), events);
+        break;
+    case CalibrationStep::OFFSET_OVERSHOOT:
+        //returning to North
+        left();
+        if (northActive) {
+            // somewhere in the north zone
+            finishCalibration(calibration.teeth.northLeft / 2, gpio.tick(), events);
+        } else {
+            setCalibrationStep(CalibrationStep::RETURN_NORTH, gpio.tick(), events);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void DomeController::captureEdge(int dir, const SensorEdge &edge, bool active) {
+    capturedEdges[dir].push_back({edge.tick, active});
+}
+
+bool DomeController::buildToothTable() {
+    ToothTable &table = calibration.teeth;
+    int edges = static_cast<int>(capturedEdges[ToothTable::RIGHT].size());
+    if (edges < 2 || edges % 2 || static_cast<int>(capturedEdges[ToothTable::LEFT].size()) != edges) {
+        return false;
+    }
+    table.resize(edges / 2);
+
+    // turning right at constant speed from north (0°) to north again
+    double period = static_cast<int32_t>(captureEnd[ToothTable::RIGHT] - captureStart[ToothTable::RIGHT]);
+    const CapturedEdge *captured = capturedEdges[ToothTable::RIGHT].data();
+    // starting inside a tooth its end comes first, it belongs to the last tooth
+    int first = captured[0].active ? 0 : 1;
+    for (int i = 0; i < edges; i++) {
+        const CapturedEdge &c = captured[(i + first) % edges];
+        if (c.active != (i % 2 == 0)) {
+            return false;
+        }
+        double az = 360.0 * static_cast<int32_t>(c.tick - captureStart[ToothTable::RIGHT]) / period;
+        table.edges[ToothTable::RIGHT][i] = i + first >= edges ? az + 360 : az;
+    }
+
+    // turning left from leaving north (0°) to leaving it again, the edges come in reverse order
+    period = static_cast<int32_t>(captureEnd[ToothTable::LEFT] - captureStart[ToothTable::LEFT]);
+    captured = capturedEdges[ToothTable::LEFT].data();
+    auto leftAz = [&](uint32_t tick) {
+        return 360.0 - 360.0 * static_cast<int32_t>(tick - captureStart[ToothTable::LEFT]) / period;
+    };
+    table.northLeft = range360(leftAz(captureNorthLeft));
+    // the first edge is the nearest one of its kind, turning left rising edges end a tooth
+    int e = 0;
+    double nearest = INFINITY;
+    double az = leftAz(captured[0].tick);
+    for (int i = captured[0].active ? 1 : 0; i < edges; i += 2) {
+        double d = std::fabs(std::remainder(az - table.edges[ToothTable::RIGHT][i], 360.0));
+        if (d < nearest) {
+            nearest = d;
+            e = i;
+        }
+    }
+    for (int i = 0; i < edges; i++, e = table.previous(e)) {
+        if (captured[i].active != (e % 2 == 1)) {
+            return false;
+        }
+        double right = table.edges[ToothTable::RIGHT][e];
+        table.edges[ToothTable::LEFT][e] = right + std::remainder(leftAz(captured[i].tick) - right, 360.0);
+    }
+    return true;
+}
+
+void DomeController::finishCalibration(double az, uint32_t tick, unsigned &events) {
+    if (!toothTableBuilt || calibration.impCount < 1 || calibration.impToNorthOffset > (360.0 / calibration.impCount)) {
+        if (++calibrationRetries > CALIBRATION_MAX_RETRIES) {
+            stopRot();
+            setCalibrationStep(CalibrationStep::IDLE, gpio.tick(), events);
+            events |= Event::CALIBRATION_FAILED;
+            return;
+        }
+        events |= Event::CALIBRATION_RETRY;
+        right();
+        setCalibrationStep(CalibrationStep::RIGHT_SEEK_NORTH, gpio.tick(), events);
+        return;
+    }
+
+    setCalibrationStep(CalibrationStep::IDLE, gpio.tick(), events);
+    setCalibration(calibration);
+    // fixed while still turning so the coasting after stopping is extrapolated from there
+    estimator.fix(az, tick, NORTH_SIGMA);
+    placeEdges(az);
+    stopRot();
+    events |= Event::CALIBRATION_FINISHED;
+}
+
+void DomeController::finishVerification(uint32_t tick, unsigned &events) {
+    stopRot();
+    // entering north turning right the tracked position has to be 0 again
+    calibrationDrift = std::remainder(estimator.estimate(tick), 360.0);
+    double speed = estimator.getVelocity(PositionEstimator::RIGHT) / 1000;
+    bool drifted = std::fabs(calibrationDrift) > 180.0 / calibration.impCount
+                   || std::fabs(speed - calibration.speed[SPEED_R]) > VERIFY_SPEED_TOLERANCE * calibration.speed[SPEED_R];
+    setCalibrationStep(CalibrationStep::IDLE, tick, events);
+    fixAtNorth(RotDirection::RIGHT, tick);
+    events |= drifted ? Event::CALIBRATION_DRIFTED : Event::CALIBRATION_VERIFIED;
+}
+
+unsigned DomeController::update() {
+    unsigned events = 0;
+    // no edge, watchdog or write gets through anymore, tracking and stopping on them would only pretend
+    if (gpioLost || gpio.isLost()) {
+        if (!gpioLost) {
+            gpioLost = true;
+            moveToTarget = false;
+            disarmEdgeStop();
+            if (calibrationStep != CalibrationStep::IDLE) {
+                setCalibrationStep(CalibrationStep::IDLE, gpio.tick(), events);
+                events |= Event::CALIBRATION_FAILED;
+            }
+            events |= Event::GPIO_LOST;
+        }
+        return events;
+    }
+
+    // handle dome rotation
+    // every edge fixes the position at the exact time it happened, in between it is estimated
+    // the sensors are sampled once per cycle, the edges up to then have to end in the same levels
+    sensors = sampleSensors();
+    uint32_t now = sensors.tick;
+    recorder.keepTime(now);
+    // shutter relays the alert thread released at a limit switch
+    uint32_t released = relays & relaysShutter & relayLevels;
+    if (released) {
+        relays &= ~released;
+        recorder.record(FlightRecord::RELAYS, now, FlightRecord::RELAYS_BY_ALERT, relays);
+    }
+    // and the rotation the alert thread stopped, the edges after it were already coasting
+    uint64_t fired = stopFired.exchange(0, std::memory_order_acquire);
+    uint32_t firedTick = stopFiredTick.load(std::memory_order_relaxed);
+    uint32_t newer = 0;
+    SensorEdge edge;
+    while (sensorEdges.pop(edge)) {
+        recorder.record(FlightRecord::EDGE, edge.tick, edge.gpio, edge.level);
+        if (edge.level == PI_TIMEOUT) {
+            continue;
+        }
+        if (fired && static_cast<int32_t>(edge.tick - firedTick) > 0) {
+            edgeStopped(fired, firedTick, events);
+            fired = 0;
+        }
+        if (edge.gpio == pins.gpio[SIGNAL_ROT]) {
+            rotEdgesHandled++;
+        }
+        // edges arriving while draining the queue are newer than now
+        int32_t latency = static_cast<int32_t>(now - edge.tick);
+        edgeLatency.record(latency > 0 ? static_cast<uint64_t>(latency) * 1000 : 0);
+        if (latency < 0) {
+            newer |= 1u << edge.gpio;
+        }
+        handleEdge(edge, events);
+        if (edge.gpio == pins.gpio[SIGNAL_ROT] || edge.gpio == pins.gpio[SIGNAL_ISN]) {
+            recorder.recordValues(FlightRecord::ESTIMATE, edge.tick, curRot, range360(estimator.estimate(edge.tick)), estimator.uncertainty(edge.tick));
+        }
+    }
+    if (fired) {
+        edgeStopped(fired, firedTick, events);
+    }
+    if (stallFired.exchange(false, std::memory_order_acquire)) {
+        stalled(stallFiredTick.load(std::memory_order_relaxed), events);
+    }
+    checkSensors(newer, events);
+    now = gpio.tick();
+    // the loop period sets how early a stop has to be decided
+    if (lastUpdateTick != 0 && !idleCycle) {
+        loopPeriod += 0.1 * (static_cast<double>(now - lastUpdateTick) - loopPeriod);
+    }
+    lastUpdateTick = now;
+    if (calibrationStep != CalibrationStep::IDLE) {
+        stepCalibrationTimer(now, events);
+    } else if (northActive && curRot == RotDirection::NONE) {
+        holdInNorth(now);
+    }
+    double nextPos = estimator.estimate(now);
+    azimuthSigma = estimator.uncertainty(now);
+    bool wasStill = still;
+    still = curRot == RotDirection::NONE && !estimator.isCoasting(now);
+    if (still && !wasStill) {
+        haltTick = now;
+    }
+    // while the dome moves the dead reckoning of every cycle too
+    if (!still) {
+        recorder.recordValues(FlightRecord::ESTIMATE, now, curRot, range360(nextPos), azimuthSigma);
+    }
+
+    // handle shutter movement
+    updateShutter(now, events);
+
+    // update variables
+    azimuth = range360(nextPos);
+
+    if (moveToTarget) {
+        // the dome keeps coasting after the motor is switched off, so it is stopped before the target
+        // the decision is due now if waiting one more loop would end further from the target
+        RotDirection dir = targetDir;
+        PositionEstimator::Motion motion = dir == RotDirection::RIGHT ? PositionEstimator::RIGHT : PositionEstimator::LEFT;
+        double remaining = dir == RotDirection::RIGHT ? range360(targetedAz - azimuth) : range360(azimuth - targetedAz);
+        // passing the target makes the remaining distance jump up by a full turn
+        bool crossed = curRot == dir && remaining > targetRemaining + 180;
+        targetRemaining = remaining;
+        targetEta = planner.planDirection(planDome(), motion == PositionEstimator::RIGHT ? SlewPlanner::RIGHT : SlewPlanner::LEFT,
+                                          azimuth, currentVelocity(now), targetedAz).eta;
+        double perLoop = estimator.getVelocity(motion) * loopPeriod / 1e6;
+        double stopDistance = remaining - estimator.getCoast(motion);
+        if (curRot == dir && !crossed) {
+            armEdgeStop(dir, stopDistance, now);
+        }
+        // with an armed edge stop the loop only steps in if the alert thread missed it
+        double late = stopArmed ? -perLoop / 2 : perLoop / 2;
+        if (curRot == dir && (crossed || stopDistance <= late)) {
+            // target crossed or reached
+            moveToTarget = false;
+            stopRot();
+            events |= Event::TARGET_REACHED;
+        } else if (curRot != RotDirection::NONE && curRot != dir) {
+            // reversing: the dome has to come to a halt first
+            stopRot();
+        } else if (curRot == RotDirection::NONE) {
+            // starting motion once it's safe to
+            bool coastingAlong = estimator.isCoasting(now) && lastRot == dir;
+            bool reversible = still && (lastRot == dir || static_cast<int32_t>(now - haltTick) >= planner.getConfig().reversalDeadTime * 1e6);
+            if (coastingAlong || reversible) {
+                if (dir == RotDirection::RIGHT) {
+                    right();
+                } else {
+                    left();
+                }
+            }
+        }
+    }
+
+    if (events) {
+        recorder.record(FlightRecord::EVENTS, now, 0, events);
+    }
+    idleCycle = isIdle();
+    return events;
+}
+
+bool DomeController::isIdle() const {
+    // a lost backend reports nothing to wait for
+    return gpioLost || (still && curRot == RotDirection::NONE && !moveToTarget && calibrationStep == CalibrationStep::IDLE
+                        && currentShutterAction != ShutterAction::OPENING && currentShutterAction != ShutterAction::CLOSING);
+}
+
+void DomeController::setEdgeStop(bool on) {
+    edgeStop = on;
+    if (!on) {
+        disarmEdgeStop();
+    }
+}
+
+void DomeController::armEdgeStop(RotDirection dir, double stopDistance, uint32_t now) {
+    const ToothTable &table = calibration.teeth;
+    // the armed edge already passed, the alert thread is timing the rest
+    if (stopArmed && static_cast<int32_t>(static_cast<uint32_t>(stopArmed) - rotEdgesHandled) <= 0) {
+        return;
+    }
+    PositionEstimator::Motion motion = dir == RotDirection::RIGHT ? PositionEstimator::RIGHT : PositionEstimator::LEFT;
+    double v = estimator.getVelocity(motion);
+    // until the deceleration is learned the loop stops, it stops between the edges and the coast passes some of them
+    bool learned = estimator.getDeceleration(motion) > 0;
+    if (!edgeStop || !learned || calibrationStep != CalibrationStep::IDLE || table.teeth == 0 || v <= 0 || stopDistance <= 0) {
+        disarmEdgeStop();
+        return;
+    }
+    // walking the edges ahead up to the stop point
+    double pos = estimator.estimate(now);
+    int t = dir == RotDirection::RIGHT ? ToothTable::RIGHT : ToothTable::LEFT;
+    int e = dir == RotDirection::RIGHT ? nextEdge : table.previous(nextEdge);
+    double ahead = dir == RotDirection::RIGHT ? std::remainder(table.edges[t][e] - pos, 360.0) : std::remainder(pos - table.edges[t][e], 360.0);
+    ahead = std::max(ahead, 0.0);
+    uint32_t n = 0;
+    double last = 0;
+    while (ahead <= stopDistance && n < static_cast<uint32_t>(table.edgeCount())) {
+        n++;
+        last = ahead;
+        int following = dir == RotDirection::RIGHT ? table.next(e) : table.previous(e);
+        ahead += dir == RotDirection::RIGHT ? table.distance(t, e, following) : table.distance(t, following, e);
+        e = following;
+    }
+    if (n == 0) {
+        disarmEdgeStop();
+        return;
+    }
+    uint32_t seq = rotEdgesHandled + n;
+    // the delay is fixed once armed for an edge, the alert thread may already be timing it
+    if (stopArmed && static_cast<uint32_t>(stopArmed) == seq) {
+        return;
+    }
+    uint64_t delay = static_cast<uint64_t>(std::llround((stopDistance - last) / v * 1e6));
+    stopArmed = std::min<uint64_t>(delay, 60000000) << 32 | seq;
+    stopArm.store(stopArmed, std::memory_order_release);
+}
+
+void DomeController::disarmEdgeStop() {
+    if (stopArmed) {
+        stopArm.store(0, std::memory_order_release);
+        stopArmed = 0;
+    }
+}
+
+void DomeController::edgeStopped(uint64_t fired, uint32_t tick, unsigned &events) {
+    // the alert thread released the rotation relays at tick
+    relays &= ~relaysRot;
+    recorder.record(FlightRecord::RELAYS, tick, FlightRecord::RELAYS_BY_ALERT, relays);
+    if (curRot != RotDirection::NONE) {
+        segmentImpulses = 0;
+        estimator.setMotion(PositionEstimator::STANDING, tick);
+        curRot = RotDirection::NONE;
+    }
+    if (fired == stopArmed && moveToTarget) {
+        moveToTarget = false;
+        events |= Event::TARGET_REACHED;
+    }
+    stopArmed = 0;
+}
+
+void DomeController::armStallWatchdog(RotDirection dir) {
+    // the widest gap between two edges at full speed, without a table the teeth are assumed even
+    PositionEstimator::Motion motion = dir == RotDirection::RIGHT ? PositionEstimator::RIGHT : PositionEstimator::LEFT;
+    const ToothTable &table = calibration.teeth;
+    double gap = 0;
+    if (table.teeth > 0) {
+        int t = dir == RotDirection::RIGHT ? ToothTable::RIGHT : ToothTable::LEFT;
+        for (int e = 0; e < table.edgeCount(); e++) {
+            gap = std::max(gap, table.distance(t, e, table.next(e)));
+        }
+    } else if (calibration.impCount > 0) {
+        gap = 360.0 / calibration.impCount;
+    }
+    double v = estimator.getVelocity(motion);
+    if (gap <= 0 || v <= 0) {
+        disarmStallWatchdog();
+        return;
+    }
+    double deceleration = estimator.getDeceleration(motion);
+    double spinUp = deceleration > 0 ? v / deceleration : STALL_SPIN_UP;
+    double running = STALL_GAP_FACTOR * gap / v * 1000;
+    uint32_t timeout = static_cast<uint32_t>(std::min(std::ceil(running), static_cast<double>(WATCHDOG_MAX_MS)));
+    uint32_t first = static_cast<uint32_t>(std::min(std::ceil(running + spinUp * 1000), static_cast<double>(WATCHDOG_MAX_MS)));
+    rotationStalled = false;
+    stallTimeout.store(timeout, std::memory_order_relaxed);
+    stallSpinUp.store(true, std::memory_order_relaxed);
+    gpio.setWatchdog(pins.gpio[SIGNAL_ROT], first);
+}
+
+void DomeController::disarmStallWatchdog() {
+    if (stallTimeout.exchange(0, std::memory_order_relaxed)) {
+        stallSpinUp.store(false, std::memory_order_relaxed);
+        gpio.setWatchdog(pins.gpio[SIGNAL_ROT], 0);
+    }
+}
+
+void DomeController::stalled(uint32_t tick, unsigned &events) {
+    // the alert thread released the rotation relays at tick
+    relays &= ~relaysRot;
+    recorder.record(FlightRecord::RELAYS, tick, FlightRecord::RELAYS_BY_ALERT, relays);
+    disarmEdgeStop();
+    moveToTarget = false;
+    if (curRot != RotDirection::NONE) {
+        // the dome stuck somewhere between the last edge and the next one, not where it was dead reckoned to
+        const ToothTable &table = calibration.teeth;
+        if (table.teeth > 0) {
+            int t = curRot == RotDirection::RIGHT ? ToothTable::RIGHT : ToothTable::LEFT;
+            double from = table.edges[t][table.previous(nextEdge)];
+            double to = from + table.distance(t, table.previous(nextEdge), nextEdge);
+            estimator.setMotion(PositionEstimator::STANDING, tick);
+            estimator.fix((from + to) / 2, tick, (to - from) / 2);
+        } else {
+            estimator.setMotion(PositionEstimator::STANDING, tick);
+        }
+        segmentImpulses = 0;
+        curRot = RotDirection::NONE;
+    }
+    if (calibrationStep != CalibrationStep::IDLE) {
+        setCalibrationStep(CalibrationStep::IDLE, tick, events);
+        events |= Event::CALIBRATION_FAILED;
+    }
+    rotationStalled = true;
+    rotationStalls++;
+    events |= Event::ROTATION_STALLED;
+}
+
+void DomeController::countNorthEdges(int previous, unsigned &events) {
+    // the dome passes the position of north where nextEdge wraps to 0: turning right from the last edge, turning
+    // left from edge 1
+    int count = calibration.teeth.edgeCount();
+    int steps = (nextEdge - previous + count) % count;
+    int from = northEdges;
+    northEdges += steps <= count / 2 ? steps : steps - count;
+    auto turn = [count](int u) { return u >= 0 ? u / count : -((count - 1 - u) / count); };
+    bool crossed = false;
+    int at = 0;
+    if (turn(northEdges) > turn(from)) {
+        crossed = true;
+        at = turn(northEdges) * count;
+    } else if (turn(northEdges - 1) < turn(from - 1)) {
+        crossed = true;
+        at = turn(from - 1) * count;
+    }
+    // turning left the sensor is reached before the position is, turning right after it
+    // a dome standing in the north zone doesn't enter it anymore
+    int margin = 2 * NORTH_MISS_MARGIN;
+    if (northActive) {
+        northSeen = true;
+        northSeenAt = northEdges;
+        northDue = false;
+    } else if (northSeen && std::abs(northEdges - northSeenAt) > margin) {
+        northSeen = false;
+    }
+    if (crossed && !northDue && !northSeen) {
+        northDue = true;
+        northDueAt = at;
+    }
+    if (northDue && std::abs(northEdges - northDueAt) > margin) {
+        northDue = false;
+        missedNorth++;
+        events |= Event::NORTH_MISSED;
+    }
+}
+
+void DomeController::moveTo(double az) {
+    targetedAz = range360(az);
+    moveToTarget = true;
+    uint32_t now = gpio.tick();
+    recorder.recordValues(FlightRecord::COMMAND, now, FlightRecord::MOVE_TO, targetedAz);
+    double from = range360(estimator.estimate(now));
+    SlewPlanner::Plan plan = planner.plan(planDome(), from, currentVelocity(now), targetedAz);
+    targetDir = plan.direction == SlewPlanner::RIGHT ? RotDirection::RIGHT : RotDirection::LEFT;
+    targetRemaining = plan.distance;
+    targetEta = plan.eta;
+}
+
+SlewPlanner::Dome DomeController::planDome() const {
+    SlewPlanner::Dome dome;
+    dome.velocity[SlewPlanner::RIGHT] = estimator.getVelocity(PositionEstimator::RIGHT);
+    dome.velocity[SlewPlanner::LEFT] = estimator.getVelocity(PositionEstimator::LEFT);
+    dome.deceleration[SlewPlanner::RIGHT] = estimator.getDeceleration(PositionEstimator::RIGHT);
+    dome.deceleration[SlewPlanner::LEFT] = estimator.getDeceleration(PositionEstimator::LEFT);
+    return dome;
+}
+
+double DomeController::currentVelocity(uint32_t tick) const {
+    if (curRot != RotDirection::NONE) {
+        return getVelocity();
+    }
+    double coasting = estimator.getCoastVelocity(tick);
+    return estimator.getCoastDirection() == PositionEstimator::LEFT ? -coasting : coasting;
+}
+
+void DomeController::move(RotDirection dir) {
+    recorder.record(FlightRecord::COMMAND, gpio.tick(), FlightRecord::MOVE, dir);
+    moveToTarget = false;
+    if (dir == RotDirection::RIGHT) {
+        right();
+    } else if (dir == RotDirection::LEFT) {
+        left();
+    } else {
+        stopRot();
+    }
+}
+
+void DomeController::stop() {
+    move(RotDirection::NONE);
+}
+
+DomeController::ShutterAction DomeController::detectShutterState() {
+    SensorState s = sampleSensors();
+    if (s.open) {
+        currentShutterAction = ShutterAction::OPEN;
+        shutterPosition = 1;
+    } else if (s.closed) {
+        currentShutterAction = ShutterAction::CLOSED;
+        shutterPosition = 0;
+    } else {
+        //Dome isn't open or closed
+        currentShutterAction = ShutterAction::STOPPED;
+    }
+    return currentShutterAction;
+}
+
+void DomeController::openShutter() {
+    recorder.record(FlightRecord::COMMAND, gpio.tick(), FlightRecord::OPEN_SHUTTER, 0);
+    if (currentShutterAction != ShutterAction::OPEN && currentShutterAction != ShutterAction::OPENING) {
+        startShutter(ShutterAction::OPENING);
+    }
+}
+
+void DomeController::closeShutter() {
+    recorder.record(FlightRecord::COMMAND, gpio.tick(), FlightRecord::CLOSE_SHUTTER, 0);
+    if (currentShutterAction != ShutterAction::CLOSED && currentShutterAction != ShutterAction::CLOSING) {
+        startShutter(ShutterAction::CLOSING);
+    }
+}
+
+void DomeController::stopShutter() {
+    recorder.record(FlightRecord::COMMAND, gpio.tick(), FlightRecord::STOP_SHUTTER, 0);
+    if (currentShutterAction == ShutterAction::OPENING || currentShutterAction == ShutterAction::CLOSING) {
+        unsigned events = 0;
+        updateShutter(gpio.tick(), events);
+    }
+    shutterLimit.store(0, std::memory_order_relaxed);
+    stopShutterMotor();
+    currentShutterAction = ShutterAction::STOPPED;
+}
+
+void DomeController::startShutter(ShutterAction action) {
+    uint32_t now = gpio.tick();
+    if (currentShutterAction == ShutterAction::OPENING || currentShutterAction == ShutterAction::CLOSING) {
+        // reversing: the position so far is where the new travel starts
+        unsigned events = 0;
+        updateShutter(now, events);
+    }
+    currentShutterAction = action;
+    shutterStalled = false;
+    shutterStartTick = now;
+    shutterStartPosition = shutterPosition;
+    // already at the limit switch update() finishes it right away
+    if (action == ShutterAction::OPENING) {
+        shutterFromLimit = closedActive;
+        if (!openActive) {
+            // armed before the relay is switched so the limit can't be passed in between
+            shutterLimit.store(pins.mask(SIGNAL_ISO), std::memory_order_relaxed);
+            open();
+        }
+    } else {
+        shutterFromLimit = openActive;
+        if (!closedActive) {
+            shutterLimit.store(pins.mask(SIGNAL_ISC), std::memory_order_relaxed);
+            close();
+        }
+    }
+}
+
+double DomeController::shutterTravelTime(ShutterAction action) const {
+    double travel = shutterTravel[action == ShutterAction::OPENING ? TRAVEL_OPEN : TRAVEL_CLOSE];
+    return travel > 0 ? travel : SHUTTER_DEFAULT_TRAVEL;
+}
+
+double DomeController::getShutterRemaining() const {
+    if (currentShutterAction == ShutterAction::OPENING) {
+        return (1 - shutterPosition) * shutterTravelTime(currentShutterAction);
+    } else if (currentShutterAction == ShutterAction::CLOSING) {
+        return shutterPosition * shutterTravelTime(currentShutterAction);
+    }
+    return 0;
+}
+
+void DomeController::updateShutter(uint32_t now, unsigned &events) {
+    bool opening = currentShutterAction == ShutterAction::OPENING;
+    if (!opening && currentShutterAction != ShutterAction::CLOSING) {
+        return;
+    }
+    // the limit switches are edge triggered, the snapshot only catches what the edges haven't told yet
+    if (opening ? (openActive || sensors.open) : (closedActive || sensors.closed)) {
+        finishShutter(now, events);
+        return;
+    }
+
+    double elapsed = static_cast<int32_t>(now - shutterStartTick) / 1e6;
+    double moved = elapsed / shutterTravelTime(currentShutterAction);
+    // the limit switch decides when it's done, until then it is never estimated there
+    shutterPosition = std::min(std::max(shutterStartPosition + (opening ? moved : -moved), 0.01), 0.99);
+
+    int travel = opening ? TRAVEL_OPEN : TRAVEL_CLOSE;
+    double remaining = opening ? 1 - shutterStartPosition : shutterStartPosition;
+    double bound = shutterTravel[travel] > 0 ? remaining * shutterTravel[travel] * SHUTTER_STALL_FACTOR + SHUTTER_STALL_MARGIN : SHUTTER_MAX_TRAVEL;
+    if (elapsed > bound) {
+        shutterLimit.store(0, std::memory_order_relaxed);
+        stopShutterMotor();
+        currentShutterAction = ShutterAction::STOPPED;
+        shutterStalled = true;
+        events |= Event::SHUTTER_STALLED;
+    } else if (opening && !(relays & pins.mask(SIGNAL_O))) {
+        // released by the alert thread for a limit that was armed before reversing
+        shutterLimit.store(pins.mask(SIGNAL_ISO), std::memory_order_relaxed);
+        open();
+    } else if (!opening && !(relays & pins.mask(SIGNAL_C))) {
+        shutterLimit.store(pins.mask(SIGNAL_ISC), std::memory_order_relaxed);
+        close();
+    }
+}
+
+void DomeController::finishShutter(uint32_t tick, unsigned &events) {
+    bool opened = currentShutterAction == ShutterAction::OPENING;
+    shutterLimit.store(0, std::memory_order_relaxed);
+    stopShutterMotor();
+    if (shutterFromLimit) {
+        // a full travel from one limit switch to the other
+        double *travel = &shutterTravel[opened ? TRAVEL_OPEN : TRAVEL_CLOSE];
+        double measured = static_cast<int32_t>(tick - shutterStartTick) / 1e6;
+        *travel = *travel > 0 ? *travel + SHUTTER_TRAVEL_GAIN * (measured - *travel) : measured;
+    }
+    shutterPosition = opened ? 1 : 0;
+    currentShutterAction = opened ? ShutterAction::OPEN : ShutterAction::CLOSED;
+    events |= opened ? Event::SHUTTER_OPENED : Event::SHUTTER_CLOSED;
+}
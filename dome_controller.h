@@ -0,0 +1,390 @@
+#pragma once
+
+#include "dome_pins.h"
+#include "flight_recorder.h"
+#include "gpio_backend.h"
+#include "latency_histogram.h"
+#include "position_estimator.h"
+#include "slew_planner.h"
+#include "spsc_queue.h"
+#include "tooth_table.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// hardware side of the dome: relays, sensors, position tracking and calibration
+// it doesn't know anything about INDI so it can also be run against a simulated dome
+class DomeController
+{
+public:
+    enum RotDirection {
+        RIGHT,
+        LEFT,
+        NONE
+    };
+
+    enum ShutterAction {
+        OPEN,
+        OPENING,
+        STOPPED,
+        CLOSING,
+        CLOSED
+    };
+
+    // calibration is a state machine driven by sensor edges and the control loop so it never blocks
+    enum CalibrationStep {
+        IDLE,
+        RIGHT_SEEK_NORTH,       // turning right until north is reached
+        RIGHT_MEASURE,          // one full right rotation: counting impulses and timing it
+        RIGHT_OVERSHOOT,        // turning on to the right for a moment
+        LEFT_SEEK_NORTH,        // turning left until north is reached
+        LEFT_LEAVE_NORTH,       // turning left until north is left
+        LEFT_MEASURE_ENTER,     // one full left rotation: until north is reached again
+        LEFT_MEASURE_LEAVE,     // and left again
+        LEFT_OVERSHOOT,         // turning on to the left for a moment
+        OFFSET_SEEK_NORTH,      // turning right until north is reached
+        OFFSET_SEEK_IMP,        // turning right until the next impulse
+        OFFSET_OVERSHOOT,       // turning on to the right for a moment
+        RETURN_NORTH,           // turning left back to north
+        // verifying a cached calibration by homing to north, the position is tracked meanwhile
+        VERIFY_LEFT_SEEK_NORTH, // turning left until north is reached
+        VERIFY_LEFT_LEAVE_NORTH,// turning left until north is left
+        VERIFY_LEFT_PASS_IMP,   // turning left past the next impulse, it gives an exact position on the way back
+        VERIFY_LEFT_OVERSHOOT,  // coasting to a halt left of north
+        VERIFY_RIGHT_SEEK_NORTH // turning right until north is reached, there the tracked position has to be 0
+    };
+
+    // things that happened during update() the caller may want to report
+    enum Event {
+        TARGET_REACHED = 1 << 0,
+        SHUTTER_OPENED = 1 << 1,
+        SHUTTER_CLOSED = 1 << 2,
+        CALIBRATION_PROGRESS = 1 << 3,
+        CALIBRATION_FINISHED = 1 << 4,
+        CALIBRATION_RETRY = 1 << 5,
+        CALIBRATION_FAILED = 1 << 6,
+        CALIBRATION_VERIFIED = 1 << 7,
+        CALIBRATION_DRIFTED = 1 << 8,
+        SHUTTER_STALLED = 1 << 9,
+        CALIBRATION_UPDATED = 1 << 10,
+        ROTATION_STALLED = 1 << 11,
+        NORTH_MISSED = 1 << 12,
+        GPIO_LOST = 1 << 13
+    };
+
+    enum {
+        SPEED_R,
+        SPEED_L
+    };
+    enum {
+        TRAVEL_OPEN,
+        TRAVEL_CLOSE
+    };
+    struct Calibration {
+        double impCount = 0;
+        double speed[2] = {0, 0};   // °/ms
+        double impToNorthOffset = 0;
+        // learned angle of every encoder edge
+        ToothTable teeth;
+    };
+
+    // all sensors sampled at one instant: a single gpioRead_Bits_0_31 and the gpioTick taken with it
+    struct SensorState {
+        uint32_t tick;
+        bool open : 1;
+        bool closed : 1;
+        bool north : 1;
+        bool rotImp : 1;
+    };
+
+    explicit DomeController(GpioBackend &gpio, const DomePinMap &pins = DomePinMap());
+
+    // setting up the GPIOs, on failure error describes what went wrong
+    bool init(std::string &error);
+    // from now on sensor changes are reported as edges
+    bool startEdgeAlerts(std::string &error);
+    // no more alerts or watchdog timeouts reach the controller, the backend may go on serving other domes
+    void stopEdgeAlerts();
+    const DomePinMap &getPins() const { return pins; }
+
+    // one cycle of the control loop, returns the Events that happened
+    unsigned update();
+    // nothing changes until a sensor edge or a command comes: the dome and the shutter stand and no calibration runs
+    // the loop may sleep then
+    bool isIdle() const;
+    // edges queued for the next update(), only from the thread calling update()
+    bool hasPendingEdges() const { return !sensorEdges.empty(); }
+    // called from the alert thread after each queued edge, to wake a sleeping loop, nullptr for none
+    typedef void (*EdgeListener)(void *userdata);
+    void setEdgeListener(EdgeListener listener, void *userdata);
+
+    // motion
+    void moveTo(double az);
+    void move(RotDirection dir);
+    void stop();
+
+    // shutter, the current state is derived from the limit switches
+    // a limit switch stops the motor already in the alert thread, the control loop only catches up
+    ShutterAction detectShutterState();
+    void openShutter();
+    void closeShutter();
+    void stopShutter();
+    // estimated position of the shutter: 0 closed, 1 open
+    double getShutterPosition() const { return shutterPosition; }
+    // estimated time until the moving shutter reaches its limit switch in s
+    double getShutterRemaining() const;
+    // learned time of a full travel (TRAVEL_OPEN or TRAVEL_CLOSE) in s, 0 if unknown
+    double getShutterTravel(int travel) const { return shutterTravel[travel]; }
+    void setShutterTravel(int travel, double s) { shutterTravel[travel] = s; }
+    // the shutter didn't reach the limit switch in time and was stopped
+    bool isShutterStalled() const { return shutterStalled; }
+
+    void startCalibration();
+    // using a cached calibration with the dome at az, it is verified by homing to north
+    void verifyCalibration(const Calibration &c, double az);
+    // taking az as the position without verifying it, like replaying a trace that starts with the dome there
+    void assumeAzimuth(double az);
+    void abortCalibration();
+
+    double getAzimuth() const { return azimuth; }
+    // standard deviation of the azimuth estimate in °
+    double getAzimuthUncertainty() const { return azimuthSigma; }
+    // current angular velocity in °/s, positive clockwise
+    double getVelocity() const;
+    // distance the dome coasts after stopping from full speed in direction dir in °
+    double getCoast(RotDirection dir) const;
+    double getTarget() const { return targetedAz; }
+    // expected time until the dome halts at the target in s, 0 if it isn't moving to one
+    double getTargetEta() const { return moveToTarget ? targetEta : 0; }
+    // the slew direction is planned by the arrival time, see SlewPlanner
+    void setSlewPlanner(const SlewPlanner::Config &config) { planner.setConfig(config); }
+    // the alert thread stops a slew at the last edge before the stop point and a watchdog times the rest
+    // off, or without an edge before the stop point, the control loop decides
+    void setEdgeStop(bool on);
+    bool getEdgeStop() const { return edgeStop; }
+    // no encoder edge came in time while the motor was on, the alert thread switched it off
+    bool isRotationStalled() const { return rotationStalled; }
+    // encoder stalls and turns past north without its sensor since the start
+    uint32_t getRotationStalls() const { return rotationStalls; }
+    uint32_t getMissedNorth() const { return missedNorth; }
+    bool isMovingToTarget() const { return moveToTarget; }
+    // the backend lost the GPIOs, see GpioBackend::isLost(): the controller stopped where it was, whatever the relays
+    // do now nobody sees it
+    bool isGpioLost() const { return gpioLost; }
+    RotDirection getRotation() const { return curRot; }
+    ShutterAction getShutterAction() const { return currentShutterAction; }
+    bool isCalibrating() const { return calibrationStep != CalibrationStep::IDLE; }
+    bool isVerifying() const { return calibrationStep >= CalibrationStep::VERIFY_LEFT_SEEK_NORTH; }
+    // difference between the tracked position and north at the end of the last verification in °
+    double getCalibrationDrift() const { return calibrationDrift; }
+    // passing north at full speed refines the calibration, see recalibrateAtNorth()
+    void setRecalibration(bool on) { recalibrate = on; }
+    bool getRecalibration() const { return recalibrate; }
+    // difference between the tracked position and north at the last crossing that was measured in °
+    double getNorthResidual() const { return northResidual; }
+    CalibrationStep getCalibrationStep() const { return calibrationStep; }
+    double getCalibrationProgress() const;
+    const Calibration &getCalibration() const { return calibration; }
+    void setCalibration(const Calibration &c);
+    // learned deceleration after switching off the motor in °/s², 0 if unknown
+    double getDeceleration(RotDirection dir) const;
+    void setDeceleration(RotDirection dir, double deceleration);
+    // the dome stands still: the motor is off and it isn't coasting anymore
+    bool isStill() const { return still; }
+    // time from a sensor edge to its handling in update() and time a relay command takes
+    LatencyHistogram &getEdgeLatency() { return edgeLatency; }
+    LatencyHistogram &getRelayLatency() { return relayLatency; }
+    // number of edges lost because the queue was full since the last call
+    uint32_t takeDroppedEdges() { return droppedEdges.exchange(0, std::memory_order_relaxed); }
+    // number of edges the alerts missed but the snapshots revealed since the last call
+    uint32_t takeResyncedEdges() { return resyncedEdges.exchange(0, std::memory_order_relaxed); }
+    // the snapshot of the last update()
+    const SensorState &getSensors() const { return sensors; }
+    // records edges, relays, estimates, commands and events once it is opened, only from the thread calling update()
+    FlightRecorder &getRecorder() { return recorder; }
+
+private:
+    GpioBackend &gpio;
+    FlightRecorder recorder;
+    // the wiring and the masks of its relay groups
+    const DomePinMap pins;
+    const uint32_t relaysRot;
+    const uint32_t relaysShutter;
+
+    // control funktions for motors
+    // the relays are switched as masks: released ones first, then the switched on ones, so no interlocked pair is
+    // ever switched on together, not even in between
+    uint32_t relays = 0;    // switched on relays
+    bool setRelays(uint32_t group, uint32_t on);
+    // writing the levels that switch the relays in bits on or release them, also from the alert thread
+    void driveRelays(uint32_t bits, bool on);
+    void right();
+    void left();
+    void stopRot();
+    void open();
+    void close();
+    void stopShutterMotor();
+
+    // sensors, sampled once per cycle
+    SensorState sampleSensors();
+    SensorState sensors = {};
+
+    // level change of a sensor GPIO as reported by the alert thread
+    struct SensorEdge {
+        uint8_t gpio;
+        uint8_t level;
+        uint32_t tick;
+    };
+    static void onSensorEdge(int gpio, int level, uint32_t tick, void *userdata);
+    // whether the level of a sensor edge means its signal is active
+    bool isActive(unsigned gpio, unsigned level) const { return (level != 0) == ((pins.activeHigh >> gpio) & 1); }
+    void syncSensorStates();
+    void handleEdge(const SensorEdge &edge, unsigned &events);
+    // checking the levels tracked from the edges against the snapshot, newer are the sensors with edges after it
+    void checkSensors(uint32_t newer, unsigned &events);
+    uint32_t sensorMismatch = 0;
+    std::atomic<uint32_t> resyncedEdges {0};
+    // entering north fixes the position, turning right it is 0 there
+    void fixAtNorth(RotDirection rot, uint32_t tick);
+    // the position at an impulse edge is taken from the tooth table
+    void trackEdge(RotDirection rot, bool active, uint32_t tick);
+    // standing in the north zone the position can't be outside of it
+    void holdInNorth(uint32_t tick);
+    SpscQueue<SensorEdge, 1024> sensorEdges;
+    std::atomic<uint32_t> droppedEdges {0};
+    std::atomic<EdgeListener> edgeListener {nullptr};
+    std::atomic<void *> edgeListenerData {nullptr};
+    LatencyHistogram edgeLatency;
+    LatencyHistogram relayLatency;
+    bool northActive = false;
+    bool openActive = false;
+    bool closedActive = false;
+
+    RotDirection curRot = RotDirection::NONE;
+    // direction of the last motion, the dome may still be coasting in it
+    RotDirection lastRot = RotDirection::NONE;
+    ShutterAction currentShutterAction = ShutterAction::STOPPED;
+    // the limit switch the alert thread stops the shutter motor at, 0 if none
+    std::atomic<uint32_t> shutterLimit {0};
+    // relays released according to the last snapshot, to notice the ones the alert thread released
+    uint32_t relayLevels = 0;
+
+    // the stop the alert thread carries out: the sequence number of the rotation edge and the delay after it in µs
+    // packed so it is armed with one store, 0 if none
+    std::atomic<uint64_t> stopArm {0};
+    // rotation edges the alert thread has seen and the stop it carried out at stopFiredTick
+    std::atomic<uint32_t> rotEdgesSeen {0};
+    std::atomic<uint64_t> stopFired {0};
+    std::atomic<uint32_t> stopFiredTick {0};
+    // only used by the alert thread: the armed edge passed, the watchdog times the delay
+    uint64_t stopPending = 0;
+    void alertEdgeStop(int level, uint32_t tick);
+    void fireEdgeStop(uint64_t arm, uint32_t tick);
+    // the control loop's side
+    bool edgeStop = true;
+    uint64_t stopArmed = 0;
+    uint32_t rotEdgesHandled = 0;
+    void armEdgeStop(RotDirection dir, double stopDistance, uint32_t now);
+    void disarmEdgeStop();
+    void edgeStopped(uint64_t fired, uint32_t tick, unsigned &events);
+
+    // the watchdog on the rotation pin stops the motor if no edge comes for stallTimeout ms, the first edge after
+    // starting may take the spin up longer, then the alert thread tightens it
+    // it is shared with the edge stop, which times its delay with it and hands it back afterwards
+    std::atomic<uint32_t> stallTimeout {0};
+    std::atomic<bool> stallSpinUp {false};
+    std::atomic<bool> stallFired {false};
+    std::atomic<uint32_t> stallFiredTick {0};
+    void alertStall(uint32_t tick);
+    bool gpioLost = false;
+    // the control loop's side
+    bool rotationStalled = false;
+    uint32_t rotationStalls = 0;
+    void armStallWatchdog(RotDirection dir);
+    void disarmStallWatchdog();
+    void stalled(uint32_t tick, unsigned &events);
+
+    uint32_t shutterStartTick = 0;
+    double shutterStartPosition = 0.5;
+    double shutterPosition = 0.5;
+    // travels starting at a limit switch are full ones, they teach the travel time
+    bool shutterFromLimit = false;
+    double shutterTravel[2] = {0, 0};
+    bool shutterStalled = false;
+    void startShutter(ShutterAction action);
+    void updateShutter(uint32_t now, unsigned &events);
+    void finishShutter(uint32_t tick, unsigned &events);
+    double shutterTravelTime(ShutterAction action) const;
+
+    CalibrationStep calibrationStep = CalibrationStep::IDLE;
+    uint32_t calibrationStepTick = 0;
+    uint32_t calibrationTimeStarted = 0;
+    int calibrationEdges = 0;
+    int calibrationRetries = 0;
+    void setCalibrationStep(CalibrationStep step, uint32_t tick, unsigned &events);
+    void stepCalibration(const SensorEdge &edge, bool active, unsigned &events);
+    void stepCalibrationTimer(uint32_t now, unsigned &events);
+    // the dome was at az at tick when the calibration finished
+    void finishCalibration(double az, uint32_t tick, unsigned &events);
+    // impulse edges of the measured full rotations, turning right from entering north, turning left from leaving it
+    struct CapturedEdge {
+        uint32_t tick;
+        bool active;
+    };
+    std::vector<CapturedEdge> capturedEdges[2];
+    uint32_t captureStart[2] = {0, 0};
+    uint32_t captureEnd[2] = {0, 0};
+    uint32_t captureNorthLeft = 0;
+    bool toothTableBuilt = false;
+    void captureEdge(int dir, const SensorEdge &edge, bool active);
+    bool buildToothTable();
+    void finishVerification(uint32_t tick, unsigned &events);
+    double calibrationDrift = 0;
+    // moves the north offset, where north is entered turning left and the speed towards what this crossing measured
+    // the tracked position is taken before it's fixed at north
+    void recalibrateAtNorth(RotDirection rot, uint32_t tick, unsigned &events);
+    bool recalibrate = true;
+    double northResidual = 0;
+    // crossings in a row off by more than half a tooth
+    int northMismatches = 0;
+    // setting the next edge for the dome being at az
+    void placeEdges(double az);
+
+    Calibration calibration;
+    PositionEstimator estimator;
+    double azimuth = 0;
+    double azimuthSigma = 360;
+    // impulses since the motor was switched, the first interval is skipped because of the spin up
+    int segmentImpulses = 0;
+    uint32_t lastImpTick = 0;
+    // the edge the dome reaches next turning right, turning left it is the one before
+    int nextEdge = 0;
+    // nextEdge counted on over full turns, north lies where it is a multiple of the edge count
+    int northEdges = 0;
+    // where north was seen last and where it is overdue since the dome passed its position
+    bool northSeen = false;
+    int northSeenAt = 0;
+    bool northDue = false;
+    int northDueAt = 0;
+    uint32_t missedNorth = 0;
+    void countNorthEdges(int previous, unsigned &events);
+    bool prevImpState = false;
+    bool still = true;
+    double targetedAz = 0;
+    bool moveToTarget = false;
+    SlewPlanner planner;
+    RotDirection targetDir = RotDirection::NONE;
+    double targetRemaining = 0;
+    double targetEta = 0;
+    // when the dome came to a halt, it isn't started the other way before the reversal dead time passed
+    uint32_t haltTick = 0;
+    SlewPlanner::Dome planDome() const;
+    // velocity at tick, positive right, also while coasting
+    double currentVelocity(uint32_t tick) const;
+    uint32_t lastUpdateTick = 0;
+    double loopPeriod = 10000;  // µs
+    // the loop may have slept after an idle cycle, that gap isn't its period
+    bool idleCycle = false;
+};
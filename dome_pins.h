@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// wiring of the dome to the GPIOs of the Raspberry Pi, see DomePinMap
+
+enum DomeSignal {
+    // relays
+    SIGNAL_R,
+    SIGNAL_L,
+    SIGNAL_O,
+    SIGNAL_C,
+    // sensors
+    SIGNAL_ISO,
+    SIGNAL_ISC,
+    SIGNAL_ISN,
+    SIGNAL_ROT,
+    SIGNAL_COUNT
+};
+
+// indexed by DomeSignal
+constexpr const char *DOME_SIGNAL_NAMES[SIGNAL_COUNT] = {
+    "right", "left", "open", "close", "is open", "is closed", "is northed", "rotation meassuring impuls"
+};
+
+// the GPIOs of the real dome, indexed by DomeSignal
+constexpr unsigned DOME_DEFAULT_GPIOS[SIGNAL_COUNT] = {22, 23, 24, 25, 26, 16, 13, 12};
+
+#define FIRST_RELAY SIGNAL_R
+#define LAST_RELAY SIGNAL_C
+#define FIRST_SENSOR SIGNAL_ISO
+#define LAST_SENSOR SIGNAL_ROT
+
+// pull of the sensor inputs, the values of PI_PUD_OFF, PI_PUD_DOWN and PI_PUD_UP
+enum DomePull {
+    PULL_OFF,
+    PULL_DOWN,
+    PULL_UP
+};
+
+// the wiring of one dome: the GPIO of every signal, which signals are active high and how the sensors are pulled
+// by default DOME_DEFAULT_GPIOS, all active low with the sensors pulled down
+// domes driven by one process each need GPIOs of their own
+struct DomePinMap {
+    unsigned gpio[SIGNAL_COUNT];
+    uint32_t activeHigh = 0;        // mask of the GPIOs whose signal is active high
+    DomePull pull[SIGNAL_COUNT];    // only used for the sensors
+
+    DomePinMap() {
+        for (int i = 0; i < SIGNAL_COUNT; i++) {
+            gpio[i] = DOME_DEFAULT_GPIOS[i];
+            pull[i] = PULL_DOWN;
+        }
+    }
+
+    uint32_t mask(int signal) const { return 1u << gpio[signal]; }
+    uint32_t rotationRelays() const { return mask(SIGNAL_R) | mask(SIGNAL_L); }
+    uint32_t shutterRelays() const { return mask(SIGNAL_O) | mask(SIGNAL_C); }
+    uint32_t relays() const { return rotationRelays() | shutterRelays(); }
+    uint32_t sensors() const { return mask(SIGNAL_ISO) | mask(SIGNAL_ISC) | mask(SIGNAL_ISN) | mask(SIGNAL_ROT); }
+    bool isActiveHigh(int signal) const { return activeHigh & mask(signal); }
+    // the signal on the GPIO, -1 if none
+    int signal(unsigned g) const {
+        for (int i = 0; i < SIGNAL_COUNT; i++) {
+            if (gpio[i] == g) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    // levels of the GPIOs 0-31 as one bit per GPIO whose signal is active
+    uint32_t active(uint32_t levels) const { return ~(levels ^ activeHigh); }
+    // the level of the GPIO of a signal while it is active or not
+    unsigned level(int signal, bool active) const { return active == isActiveHigh(signal) ? 1 : 0; }
+
+    bool operator==(const DomePinMap &other) const {
+        for (int i = 0; i < SIGNAL_COUNT; i++) {
+            if (gpio[i] != other.gpio[i] || (i >= FIRST_SENSOR && pull[i] != other.pull[i])) {
+                return false;
+            }
+        }
+        return activeHigh == other.activeHigh;
+    }
+    bool operator!=(const DomePinMap &other) const { return !(*this == other); }
+
+    // as text like "gpio 22,23,24,25,26,16,13,12 active_high 0x0 pull 1,1,1,1", the pulls are the sensors'
+    std::string toText() const {
+        char text[128];
+        snprintf(text, sizeof(text), "gpio %u,%u,%u,%u,%u,%u,%u,%u active_high 0x%x pull %d,%d,%d,%d", gpio[0], gpio[1],
+                 gpio[2], gpio[3], gpio[4], gpio[5], gpio[6], gpio[7], activeHigh, pull[SIGNAL_ISO], pull[SIGNAL_ISC],
+                 pull[SIGNAL_ISN], pull[SIGNAL_ROT]);
+        return text;
+    }
+    // from toText(), false and unchanged if it isn't one
+    bool fromText(const std::string &text) {
+        DomePinMap pins;
+        int pulls[4];
+        if (sscanf(text.c_str(), "gpio %u,%u,%u,%u,%u,%u,%u,%u active_high %x pull %d,%d,%d,%d", &pins.gpio[0], &pins.gpio[1],
+                   &pins.gpio[2], &pins.gpio[3], &pins.gpio[4], &pins.gpio[5], &pins.gpio[6], &pins.gpio[7], &pins.activeHigh,
+                   &pulls[0], &pulls[1], &pulls[2], &pulls[3]) != 13) {
+            return false;
+        }
+        for (int i = FIRST_SENSOR; i <= LAST_SENSOR; i++) {
+            if (pulls[i - FIRST_SENSOR] < PULL_OFF || pulls[i - FIRST_SENSOR] > PULL_UP) {
+                return false;
+            }
+            pins.pull[i] = static_cast<DomePull>(pulls[i - FIRST_SENSOR]);
+        }
+        std::string error;
+        if (!pins.validate(error)) {
+            return false;
+        }
+        *this = pins;
+        return true;
+    }
+
+    // every signal needs a GPIO of its own out of the 0-31 gpioRead_Bits_0_31 covers
+    bool validate(std::string &error) const {
+        uint32_t used = 0;
+        for (int i = 0; i < SIGNAL_COUNT; i++) {
+            if (gpio[i] > 31) {
+                error = std::string("GPIO ") + std::to_string(gpio[i]) + " of " + DOME_SIGNAL_NAMES[i] + " isn't one of 0-31";
+                return false;
+            }
+            if (used & mask(i)) {
+                error = std::string("GPIO ") + std::to_string(gpio[i]) + " of " + DOME_SIGNAL_NAMES[i] + " is used twice";
+                return false;
+            }
+            used |= mask(i);
+        }
+        return true;
+    }
+};
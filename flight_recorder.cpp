@@ -0,0 +1,168 @@
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FLIGHT_RECORDER_MAGIC 0x314345524f50454eull  // "NEPOREC1"
+#define FLIGHT_RECORDER_VERSION 3
+
+static_assert(sizeof(FlightRecord) == 16, "records are 16 bytes");
+
+DomePinMap FlightRecorder::Header::pinMap() const {
+    DomePinMap pins;
+    for (int i = 0; i < SIGNAL_COUNT; i++) {
+        pins.gpio[i] = gpio[i];
+        pins.pull[i] = static_cast<DomePull>(pull[i]);
+    }
+    pins.activeHigh = activeHigh;
+    return pins;
+}
+
+void FlightRecorder::Header::setPinMap(const DomePinMap &pins) {
+    for (int i = 0; i < SIGNAL_COUNT; i++) {
+        gpio[i] = static_cast<uint8_t>(pins.gpio[i]);
+        pull[i] = static_cast<uint8_t>(pins.pull[i]);
+    }
+    activeHigh = pins.activeHigh;
+}
+
+bool FlightRecorder::open(const std::string &path, uint32_t capacity, const DomePinMap &pins, std::string &error) {
+    close();
+    uint32_t rounded = 1;
+    while (rounded < capacity && rounded < (1u << 31)) {
+        rounded <<= 1;
+    }
+    size_t wanted = sizeof(Header) + static_cast<size_t>(rounded) * sizeof(FlightRecord);
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error = "Opening " + path + " failed: " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != wanted;
+    if (fresh && ftruncate(fd, wanted) != 0) {
+        error = "Resizing " + path + " failed: " + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, wanted, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        error = "Mapping " + path + " failed: " + strerror(errno);
+        return false;
+    }
+    header = static_cast<Header *>(mapped);
+    records = reinterpret_cast<FlightRecord *>(static_cast<char *>(mapped) + sizeof(Header));
+    size = wanted;
+    if (fresh || header->magic != FLIGHT_RECORDER_MAGIC || header->version != FLIGHT_RECORDER_VERSION
+        || header->recordSize != sizeof(FlightRecord) || header->capacity != rounded || header->pinMap() != pins) {
+        // the records of another wiring can't be told apart from the new ones, they are dropped with the rest
+        memset(mapped, 0, sizeof(Header));
+        header->magic = FLIGHT_RECORDER_MAGIC;
+        header->version = FLIGHT_RECORDER_VERSION;
+        header->recordSize = sizeof(FlightRecord);
+        header->capacity = rounded;
+        header->setPinMap(pins);
+        header->head.store(0, std::memory_order_relaxed);
+    }
+    marked = false;
+    return true;
+}
+
+void FlightRecorder::mark(uint32_t tick, uint8_t arg) {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t us = now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+    marked = true;
+    lastMarker = tick;
+    record(FlightRecord::MARKER, tick, arg, static_cast<uint32_t>(us), static_cast<uint32_t>(us >> 32));
+}
+
+void FlightRecorder::close() {
+    if (header) {
+        munmap(header, size);
+        header = nullptr;
+        records = nullptr;
+        size = 0;
+    }
+}
+
+bool readFlightRecording(const std::string &path, std::vector<FlightRecord> &records, DomePinMap &pins, std::string &error) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        error = "Opening " + path + " failed: " + strerror(errno);
+        return false;
+    }
+    FlightRecorder::Header header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != FLIGHT_RECORDER_MAGIC) {
+        fclose(fp);
+        error = path + " isn't a flight recording";
+        return false;
+    }
+    if (header.version != FLIGHT_RECORDER_VERSION || header.recordSize != sizeof(FlightRecord)) {
+        fclose(fp);
+        error = path + " has version " + std::to_string(header.version) + " instead of " + std::to_string(FLIGHT_RECORDER_VERSION);
+        return false;
+    }
+    pins = header.pinMap();
+    std::vector<FlightRecord> ring(header.capacity);
+    size_t read = fread(ring.data(), sizeof(FlightRecord), ring.size(), fp);
+    fclose(fp);
+    if (read != ring.size()) {
+        error = path + " is truncated";
+        return false;
+    }
+
+    uint32_t head = header.head.load(std::memory_order_relaxed);
+    uint32_t count = head < header.capacity ? head : header.capacity;
+    records.clear();
+    records.reserve(count);
+    for (uint32_t n = head - count; n != head; n++) {
+        const FlightRecord &r = ring[n & (header.capacity - 1)];
+        if (r.seq != static_cast<uint16_t>(n)) {
+            continue;
+        }
+        records.push_back(r);
+    }
+    return true;
+}
+
+std::vector<uint64_t> unwrapFlightTicks(const std::vector<FlightRecord> &records) {
+    // the ticks wrap every 71.6 minutes, the difference of two of them is only certain within ±35.8 minutes: within a
+    // run the markers keep neighbouring records closer, a new run is placed after the marker before it by the wall clock
+    std::vector<int64_t> times(records.size());
+    int64_t first = 0;
+    bool marked = false;
+    int64_t markerTime = 0;
+    int64_t markerWall = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        const FlightRecord &r = records[i];
+        if (i > 0) {
+            times[i] = times[i - 1] + static_cast<int32_t>(r.tick - records[i - 1].tick);
+        }
+        if (r.type == FlightRecord::MARKER) {
+            int64_t wall = static_cast<int64_t>((static_cast<uint64_t>(r.b.bits) << 32) | r.a.bits);
+            if (r.arg == FlightRecord::MARKER_OPENED && marked) {
+                // a clock set back can't put it before what was recorded already
+                times[i] = std::max(times[i - 1], markerTime + (wall - markerWall));
+            }
+            marked = true;
+            markerTime = times[i];
+            markerWall = wall;
+        }
+        first = std::min(first, times[i]);
+    }
+    std::vector<uint64_t> unwrapped(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        unwrapped[i] = static_cast<uint64_t>(times[i] - first);
+    }
+    return unwrapped;
+}
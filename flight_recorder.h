@@ -0,0 +1,149 @@
+#pragma once
+
+#include "dome_pins.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// longest time between two markers in µs, well within the ±35.8 minutes a tick difference covers
+#define FLIGHT_MARKER_INTERVAL_US 600000000u
+
+// one entry of the flight recorder, 16 bytes
+struct FlightRecord {
+    enum Type : uint8_t {
+        EDGE,       // arg: GPIO, a: level (PI_TIMEOUT for a watchdog)
+        RELAYS,     // arg: RELAYS_BY_LOOP or RELAYS_BY_ALERT, a: mask of the switched on relays afterwards
+        ESTIMATE,   // arg: RotDirection, a: azimuth in °, b: its uncertainty in °
+        COMMAND,    // arg: Command, a and b: its arguments
+        EVENTS,     // a: DomeController::Event mask of a cycle
+        MARKER      // arg: MARKER_OPENED or MARKER_PERIODIC, a and b: low and high word of CLOCK_REALTIME in µs
+    };
+    enum Command : uint8_t {
+        MOVE_TO,            // a: azimuth
+        MOVE,               // a: RotDirection
+        OPEN_SHUTTER,
+        CLOSE_SHUTTER,
+        STOP_SHUTTER,
+        START_CALIBRATION,
+        VERIFY_CALIBRATION, // a: azimuth
+        ABORT_CALIBRATION
+    };
+    enum {
+        MARKER_OPENED,      // the first record after FlightRecorder::open(), the ticks before it are of another run
+        MARKER_PERIODIC
+    };
+    enum {
+        RELAYS_BY_LOOP,
+        RELAYS_BY_ALERT     // released by the alert thread, recorded when the control loop noticed it
+    };
+    union Value {
+        uint32_t bits;
+        float value;
+    };
+
+    uint32_t tick;      // µs, the tick of the GPIO backend
+    uint8_t type;
+    uint8_t arg;
+    uint16_t seq;       // low bits of the record's number, a slot overwritten while crashing doesn't match
+    Value a;
+    Value b;
+};
+
+// black box of the control loop: sensor edges, relay commands, position estimates, commands and events in a ring of
+// fixed size records in a memory mapped file
+// the mapped pages belong to the page cache, what was recorded survives a crash of the driver
+// recording is a store into the mapping without a syscall or lock, so only one thread may record, in the driver the
+// control thread
+// markers tie the ticks to the wall clock: one with the first tick after open() and then one every
+// FLIGHT_MARKER_INTERVAL_US of the control loop, idle or not, so a long idle time or a restart doesn't scramble the timeline
+// the header holds the wiring the GPIOs of the records belong to
+// nepo_dome_dump converts a recording to CSV or VCD
+class FlightRecorder
+{
+public:
+    ~FlightRecorder() { close(); }
+
+    // maps path with room for at least capacity records of a dome wired like pins, a recording of the same size and
+    // wiring there is continued
+    bool open(const std::string &path, uint32_t capacity, const DomePinMap &pins, std::string &error);
+    void close();
+    bool isOpen() const { return records != nullptr; }
+
+    void record(FlightRecord::Type type, uint32_t tick, uint8_t arg, uint32_t a, uint32_t b = 0) {
+        FlightRecord::Value va, vb;
+        va.bits = a;
+        vb.bits = b;
+        append(type, tick, arg, va, vb);
+    }
+    void recordValues(FlightRecord::Type type, uint32_t tick, uint8_t arg, float a, float b = 0) {
+        FlightRecord::Value va, vb;
+        va.value = a;
+        vb.value = b;
+        append(type, tick, arg, va, vb);
+    }
+    // called by the control loop every cycle, it runs while the dome is idle as well
+    void keepTime(uint32_t tick) {
+        if (!records) {
+            return;
+        }
+        if (!marked) {
+            mark(tick, FlightRecord::MARKER_OPENED);
+        } else if (static_cast<uint32_t>(tick - lastMarker) >= FLIGHT_MARKER_INTERVAL_US) {
+            mark(tick, FlightRecord::MARKER_PERIODIC);
+        }
+    }
+
+private:
+    // the file starts with it, the records follow
+    struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t capacity;  // a power of two, so the ring keeps its order when head wraps
+        std::atomic<uint32_t> head;     // records written so far
+        // DomePinMap
+        uint8_t gpio[SIGNAL_COUNT];
+        uint8_t pull[SIGNAL_COUNT];
+        uint32_t activeHigh;
+
+        DomePinMap pinMap() const;
+        void setPinMap(const DomePinMap &pins);
+    };
+
+    void append(FlightRecord::Type type, uint32_t tick, uint8_t arg, FlightRecord::Value a, FlightRecord::Value b) {
+        if (!records) {
+            return;
+        }
+        if (!marked) {
+            mark(tick, FlightRecord::MARKER_OPENED);
+        }
+        uint32_t n = header->head.load(std::memory_order_relaxed);
+        FlightRecord &r = records[n & (header->capacity - 1)];
+        r.tick = tick;
+        r.type = type;
+        r.arg = arg;
+        r.seq = static_cast<uint16_t>(n);
+        r.a = a;
+        r.b = b;
+        header->head.store(n + 1, std::memory_order_release);
+    }
+
+    // a MARKER record with the wall clock now, taken as the time of tick
+    void mark(uint32_t tick, uint8_t arg);
+
+    Header *header = nullptr;
+    FlightRecord *records = nullptr;
+    size_t size = 0;
+    bool marked = false;
+    uint32_t lastMarker = 0;
+
+    friend bool readFlightRecording(const std::string &path, std::vector<FlightRecord> &records, DomePinMap &pins,
+                                    std::string &error);
+};
+
+// the records of a recording, oldest first, a torn last record is left out, and the wiring they were recorded with
+bool readFlightRecording(const std::string &path, std::vector<FlightRecord> &records, DomePinMap &pins, std::string &error);
+// the time of every record in µs since the earliest one, the ticks unwrapped and the runs placed by their markers
+std::vector<uint64_t> unwrapFlightTicks(const std::vector<FlightRecord> &records);
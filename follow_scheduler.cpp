@@ -0,0 +1,81 @@
+#include "follow_scheduler.h"
+#include "angles.h"
+
+#include <cmath>
+
+void FollowScheduler::reset() {
+    samples.clear();
+    rate = 0;
+}
+
+void FollowScheduler::request(double az, double t) {
+    if (!samples.empty()) {
+        // a jump away from the prediction is a new target, the old samples don't tell anything about it anymore
+        if (std::fabs(std::remainder(az - predict(t), 360.0)) > config.tolerance) {
+            samples.clear();
+        }
+    }
+    if (samples.empty()) {
+        firstAz = az;
+    }
+    // unwrapped so the fit isn't broken by passing north
+    double last = samples.empty() ? 0 : samples.back().az;
+    samples.push_back({last + std::remainder(az - firstAz - last, 360.0), t});
+    while (samples.size() > 2 && t - samples.front().t > config.window) {
+        samples.pop_front();
+    }
+    fit();
+}
+
+void FollowScheduler::fit() {
+    // least squares line through the samples
+    rate = 0;
+    if (samples.size() < 2) {
+        return;
+    }
+    double t0 = samples.front().t;
+    double n = samples.size();
+    double st = 0, sa = 0, stt = 0, sta = 0;
+    for (const Sample &s : samples) {
+        double t = s.t - t0;
+        st += t;
+        sa += s.az;
+        stt += t * t;
+        sta += t * s.az;
+    }
+    double d = n * stt - st * st;
+    if (d > 0) {
+        rate = (n * sta - st * sa) / d;
+    }
+}
+
+double FollowScheduler::predict(double t) const {
+    if (samples.empty()) {
+        return 0;
+    }
+    const Sample &last = samples.back();
+    // a slewing mount isn't extrapolated
+    double r = std::fabs(rate) > config.maxTrackingRate ? 0 : rate;
+    return range360(firstAz + last.az + r * (t - last.t));
+}
+
+bool FollowScheduler::due(double domeAz, double t, double domeSpeed, double &target) const {
+    if (samples.empty()) {
+        return false;
+    }
+    // hysteresis: nothing happens as long as the aperture stays inside the slit for the lookahead
+    double now = std::remainder(predict(t) - domeAz, 360.0);
+    double ahead = std::remainder(predict(t + config.lookahead) - domeAz, 360.0);
+    if (std::fabs(now) <= config.tolerance && std::fabs(ahead) <= config.tolerance) {
+        return false;
+    }
+    target = predict(t);
+    bool tracking = std::fabs(rate) <= config.maxTrackingRate && samples.size() >= 2;
+    if (tracking && domeSpeed > 0) {
+        // the mount keeps moving while the dome travels, then the dome is put ahead of it
+        double travel = std::fabs(std::remainder(target - domeAz, 360.0)) / domeSpeed;
+        target = predict(t + travel) + (rate >= 0 ? 1 : -1) * config.lead * config.tolerance;
+    }
+    target = range360(target);
+    return true;
+}
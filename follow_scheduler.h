@@ -0,0 +1,49 @@
+#pragma once
+
+#include <deque>
+
+// decides when and where the dome moves while it follows the mount
+// the azimuth the mount requires is sampled whenever it moves, its rate is fitted over the recent samples
+// a move is only started when the required azimuth would leave the slit within the lookahead, the dome is then
+// moved ahead of the mount so the mount tracks across the whole slit before the next move is due
+// all times in s, angles in °
+class FollowScheduler
+{
+public:
+    struct Config {
+        double tolerance = 3.0;     // the required azimuth may be this far from the slit center before the aperture clips
+        double lookahead = 10.0;    // a move is started when the aperture would clip within this time
+        double lead = 0.8;          // part of the tolerance the dome is moved ahead of the mount
+        double window = 120.0;      // samples this old are dropped from the rate fit
+        double maxTrackingRate = 0.5;   // faster the mount is slewing and the dome is moved to its latest position
+    };
+
+    void setConfig(const Config &config) { this->config = config; }
+    const Config &getConfig() const { return config; }
+    void reset();
+
+    // the mount requires the dome at az at time t
+    void request(double az, double t);
+    bool hasRequest() const { return !samples.empty(); }
+
+    // required azimuth predicted for time t
+    double predict(double t) const;
+    // fitted rate of the required azimuth in °/s
+    double getRate() const { return rate; }
+
+    // true if the dome at domeAz has to start moving at time t, target is where to
+    // domeSpeed (°/s) is used to lead the mount by the time the move takes
+    bool due(double domeAz, double t, double domeSpeed, double &target) const;
+
+private:
+    struct Sample {
+        double az;      // unwrapped relative to the first sample
+        double t;
+    };
+    std::deque<Sample> samples;
+    double firstAz = 0;
+    double rate = 0;
+    Config config;
+
+    void fit();
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <pigpio/pigpio.h>
+
+#include <cstdint>
+
+// hardware abstraction of the few GPIO functions the dome needs
+// the functions mirror the pigpio ones: same arguments, same return values and constants
+class GpioBackend
+{
+public:
+    virtual ~GpioBackend() = default;
+
+    virtual int initialise() = 0;
+    virtual void terminate() = 0;
+
+    virtual int setMode(unsigned gpio, unsigned mode) = 0;
+    virtual int setPullUpDown(unsigned gpio, unsigned pud) = 0;
+    virtual int read(unsigned gpio) = 0;
+    // levels of all GPIOs 0-31 at one instant, one bit each
+    virtual uint32_t readBits() = 0;
+    virtual int write(unsigned gpio, unsigned level) = 0;
+    // setting (high) or clearing (low) all GPIOs 0-31 in the mask with one register write
+    virtual int writeBitsSet(uint32_t bits) = 0;
+    virtual int writeBitsClear(uint32_t bits) = 0;
+
+    // microseconds since an arbitrary start, wraps around like gpioTick()
+    virtual uint32_t tick() = 0;
+
+    // the callback is called from a background thread for every level change of the gpio
+    virtual int setAlertFunc(unsigned gpio, gpioAlertFuncEx_t f, void *userdata) = 0;
+    // the callback is also called with PI_TIMEOUT every timeout ms without a level change, 0 cancels it
+    virtual int setWatchdog(unsigned gpio, unsigned timeout) = 0;
+
+    // the GPIOs became unreachable after initialise(): no write, alert or watchdog gets through anymore
+    // only a remote backend can lose them
+    virtual bool isLost() const { return false; }
+};
+
+// the real hardware on a Raspberry Pi
+// pigpio maps the peripherals and runs its alert thread once per process, the backends of several domes share them:
+// the first initialise() calls gpioInitialise(), the last terminate() gpioTerminate()
+// each backend owns the GPIOs it set up, another one gets PI_GPIO_IN_USE for them
+class PigpioBackend : public GpioBackend
+{
+public:
+    ~PigpioBackend() override;
+
+    int initialise() override;
+    // only this backend's alerts and watchdogs end, the GPIOs of the other domes keep going
+    void terminate() override;
+
+    int setMode(unsigned gpio, unsigned mode) override;
+    int setPullUpDown(unsigned gpio, unsigned pud) override;
+    int read(unsigned gpio) override;
+    uint32_t readBits() override;
+    int write(unsigned gpio, unsigned level) override;
+    int writeBitsSet(uint32_t bits) override;
+    int writeBitsClear(uint32_t bits) override;
+
+    uint32_t tick() override;
+
+    int setAlertFunc(unsigned gpio, gpioAlertFuncEx_t f, void *userdata) override;
+    int setWatchdog(unsigned gpio, unsigned timeout) override;
+
+private:
+    bool initialised = false;
+    // GPIOs this backend set the mode of or registered an alert on
+    uint32_t owned = 0;
+    bool claim(unsigned gpio);
+};
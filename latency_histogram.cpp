@@ -0,0 +1,54 @@
+#include "latency_histogram.h"
+
+#include <cinttypes>
+
+void LatencyHistogram::reset() {
+    for (std::atomic<uint64_t> &count : counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    maximum.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::lowerBound(int bucket) {
+    if (bucket < 32) {
+        return bucket;
+    }
+    int shift = bucket / 16 - 1;
+    return static_cast<uint64_t>(bucket % 16 + 16) << shift;
+}
+
+double LatencyHistogram::getMean() const {
+    uint64_t n = getCount();
+    return n ? static_cast<double>(sum.load(std::memory_order_relaxed)) / n : 0;
+}
+
+uint64_t LatencyHistogram::getQuantile(double q) const {
+    uint64_t n = getCount();
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * n);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            // the maximum is exact, a bucket bound may lie above it
+            return upperBound(i) < getMax() ? upperBound(i) : getMax();
+        }
+    }
+    return getMax();
+}
+
+void LatencyHistogram::dump(FILE *fp, const char *name) const {
+    fprintf(fp, "# %s: count %" PRIu64 ", mean %.0f ns, max %" PRIu64 " ns\n", name, getCount(), getMean(), getMax());
+    fprintf(fp, "# from_ns to_ns count\n");
+    for (int i = 0; i < BUCKETS; i++) {
+        uint64_t count = counts[i].load(std::memory_order_relaxed);
+        if (count) {
+            fprintf(fp, "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n", lowerBound(i), upperBound(i), count);
+        }
+    }
+    fprintf(fp, "\n");
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+// lock-free histogram of latencies in ns with fixed memory, in the style of HdrHistogram
+// below 32 ns every value has its own bucket, above every power of two is split into 16 buckets, so a value is
+// recorded with a precision of 1/16; values from 2^40 ns (18 minutes) on end up in the last bucket
+// record() can be called from any thread, the readers see a consistent enough picture without locking
+class LatencyHistogram
+{
+public:
+    static const int BUCKETS = 592;
+
+    void record(uint64_t ns) {
+        counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t m = maximum.load(std::memory_order_relaxed);
+        while (ns > m && !maximum.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    void reset();
+
+    uint64_t getCount() const { return total.load(std::memory_order_relaxed); }
+    uint64_t getMax() const { return maximum.load(std::memory_order_relaxed); }
+    double getMean() const;
+    // upper bound of the bucket the q-quantile (0..1) falls in
+    uint64_t getQuantile(double q) const;
+
+    // one line per non-empty bucket: lower bound, upper bound, count
+    void dump(FILE *fp, const char *name) const;
+
+    // bounds of a bucket in ns
+    static uint64_t lowerBound(int bucket);
+    static uint64_t upperBound(int bucket) { return bucket + 1 < BUCKETS ? lowerBound(bucket + 1) - 1 : UINT64_MAX; }
+
+private:
+    static int bucket(uint64_t ns) {
+        if (ns < 32) {
+            return static_cast<int>(ns);
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        if (msb > 39) {
+            return BUCKETS - 1;
+        }
+        int shift = msb - 4;
+        return shift * 16 + static_cast<int>(ns >> shift);
+    }
+
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> total {0};
+    std::atomic<uint64_t> sum {0};
+    std::atomic<uint64_t> maximum {0};
+};
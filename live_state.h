@@ -0,0 +1,133 @@
+#pragma once
+
+// the dome's live state in POSIX shared memory, for guiding, scheduling and camera processes on the same machine
+// the driver writes it from its control loop after every cycle: on every edge and position estimate while the dome
+// moves, at least once a second while it rests
+// this header is all a reader needs, together with seqlock.h:
+//   LiveStateReader reader;
+//   if (reader.open(liveStateName("Nepo Dome Driver"), error) && reader.read(state)) ... state.azimuth ...
+// a reader maps the segment read only and never waits for the driver
+// the segment stays when the driver ends, the age of the last write tells it's stale
+
+#include "seqlock.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LIVE_STATE_MAGIC 0x3156494c4f50454eull   // "NEPOLIV1"
+#define LIVE_STATE_VERSION 1
+
+// the words are shared between processes, so they have to work without a lock
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "64 bit atomics have to be lock free");
+
+struct LiveDomeState {
+    enum Rotation : uint8_t {
+        RIGHT,
+        LEFT,
+        NONE
+    };
+    enum Shutter : uint8_t {
+        OPEN,
+        OPENING,
+        STOPPED,
+        CLOSING,
+        CLOSED
+    };
+    enum Flags : uint8_t {
+        MOVING_TO_TARGET = 1 << 0,
+        CALIBRATING = 1 << 1,
+        STILL = 1 << 2,
+        ROTATION_STALLED = 1 << 3,
+        SHUTTER_STALLED = 1 << 4
+    };
+
+    uint64_t updates;           // counts the writes, the same value twice means nothing new
+    int64_t monotonicNs;        // CLOCK_MONOTONIC of the write, to tell its age and to extrapolate with the velocity
+    int64_t realtimeNs;         // CLOCK_REALTIME of the same instant
+    double azimuth;             // °
+    double uncertainty;         // ° one sigma, 360 while the position is unknown
+    double velocity;            // °/s, positive clockwise
+    double target;              // ° while moving to a target
+    double shutterPosition;     // 0 closed, 1 open
+    uint8_t rotation;           // Rotation
+    uint8_t shutter;            // Shutter
+    uint8_t flags;              // Flags
+    uint8_t reserved[5];
+};
+
+// the whole segment, the header never changes once the driver created it
+struct LiveStateSegment {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t stateSize;
+    Seqlock<LiveDomeState> state;
+};
+
+// the segment name of a driver device: '/', "nepo_dome_" and the device name with '_' for what isn't a letter or digit
+inline std::string liveStateName(const std::string &device) {
+    std::string name = "/nepo_dome_";
+    for (char c : device) {
+        name += isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    }
+    return name;
+}
+
+class LiveStateReader
+{
+public:
+    ~LiveStateReader() { close(); }
+
+    // maps the segment of the name, see liveStateName(); fails while the driver never connected
+    bool open(const std::string &name, std::string &error) {
+        close();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            error = "Opening " + name + " failed: " + strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(LiveStateSegment)) {
+            ::close(fd);
+            error = name + " is too small for the dome's state";
+            return false;
+        }
+        void *mapped = mmap(nullptr, sizeof(LiveStateSegment), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            error = "Mapping " + name + " failed: " + strerror(errno);
+            return false;
+        }
+        segment = static_cast<const LiveStateSegment *>(mapped);
+        if (segment->magic != LIVE_STATE_MAGIC || segment->version != LIVE_STATE_VERSION
+            || segment->stateSize != sizeof(LiveDomeState)) {
+            error = name + " has version " + std::to_string(segment->version) + " instead of " + std::to_string(LIVE_STATE_VERSION);
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (segment) {
+            munmap(const_cast<LiveStateSegment *>(segment), sizeof(LiveStateSegment));
+            segment = nullptr;
+        }
+    }
+
+    bool isOpen() const { return segment != nullptr; }
+
+    // a consistent copy, false if a write kept getting in the way, only when the driver died in the middle of one
+    bool read(LiveDomeState &state, int attempts = 1000) const {
+        return segment && segment->state.tryRead(state, attempts);
+    }
+
+private:
+    const LiveStateSegment *segment = nullptr;
+};
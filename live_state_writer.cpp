@@ -0,0 +1,66 @@
+#include "live_state_writer.h"
+
+#include <new>
+#include <time.h>
+
+// reads of a segment left by an earlier run until it counts as torn, nobody else writes it
+#define LIVE_STATE_OPEN_ATTEMPTS 1000
+
+bool LiveStateWriter::open(const std::string &name, std::string &error) {
+    close();
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error = "Opening " + name + " failed: " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != sizeof(LiveStateSegment);
+    if (fresh && ftruncate(fd, sizeof(LiveStateSegment)) != 0) {
+        error = "Resizing " + name + " failed: " + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, sizeof(LiveStateSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        error = "Mapping " + name + " failed: " + strerror(errno);
+        return false;
+    }
+    segment = static_cast<LiveStateSegment *>(mapped);
+    // the readers of the earlier run keep counting, unless it died in the middle of a write and left the sequence odd
+    LiveDomeState last = {};
+    if (fresh || segment->magic != LIVE_STATE_MAGIC || segment->version != LIVE_STATE_VERSION
+        || segment->stateSize != sizeof(LiveDomeState) || !segment->state.tryRead(last, LIVE_STATE_OPEN_ATTEMPTS)) {
+        // the magic comes last, a reader doesn't take the segment before it's complete
+        segment->magic = 0;
+        new (&segment->state) Seqlock<LiveDomeState>();
+        segment->version = LIVE_STATE_VERSION;
+        segment->stateSize = sizeof(LiveDomeState);
+        std::atomic_thread_fence(std::memory_order_release);
+        segment->magic = LIVE_STATE_MAGIC;
+        last = {};
+    }
+    updates = last.updates;
+    return true;
+}
+
+void LiveStateWriter::close() {
+    if (segment) {
+        munmap(segment, sizeof(LiveStateSegment));
+        segment = nullptr;
+    }
+}
+
+void LiveStateWriter::write(LiveDomeState state) {
+    if (!segment) {
+        return;
+    }
+    timespec monotonic;
+    timespec realtime;
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    state.updates = ++updates;
+    state.monotonicNs = monotonic.tv_sec * 1000000000LL + monotonic.tv_nsec;
+    state.realtimeNs = realtime.tv_sec * 1000000000LL + realtime.tv_nsec;
+    segment->state.write(state);
+}
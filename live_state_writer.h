@@ -0,0 +1,26 @@
+#pragma once
+
+#include "live_state.h"
+
+#include <cstdint>
+#include <string>
+
+// the driver's side of the live state, see live_state.h
+// only one thread may write, in the driver the control thread
+class LiveStateWriter
+{
+public:
+    ~LiveStateWriter() { close(); }
+
+    // creates the segment or continues the one of an earlier run
+    bool open(const std::string &name, std::string &error);
+    void close();
+    bool isOpen() const { return segment != nullptr; }
+
+    // the updates count and the timestamps are filled in
+    void write(LiveDomeState state);
+
+private:
+    LiveStateSegment *segment = nullptr;
+    uint64_t updates = 0;
+};
@@ -1,94 +1,76 @@
 #include <pigpio/pigpio.h>
+#include <pigpio/pigpiod_if2.h>
 #include <iostream>
-#include <chrono>
 
 #include "nepo_dome.h"
 #include "config.h"
+#include "simulated_dome.h"
 
 #include "libindi/indicom.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <memory>
-
-#define PIN_R 22
-#define PIN_L 23
-#define PIN_O 24
-#define PIN_C 25
-
-#define PIN_ISO 26
-#define PIN_ISC 16
-#define PIN_ISN 13
-#define PIN_ROT 12
-
-
-static std::unique_ptr<NepoDomeDriver> nepoDomeDriver(new NepoDomeDriver());
-
-NepoDomeDriver::NepoDomeDriver() {
-    SetDomeCapability(DOME_CAN_ABORT | DOME_CAN_ABS_MOVE | DOME_CAN_REL_MOVE | DOME_CAN_PARK | DOME_HAS_SHUTTER);
-}
-
-inline long getMillis() {
-    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-}
-
-// Control funktions for motors
-enum RotDirection {
-    RIGHT,
-    LEFT,
-    NONE
-};
-RotDirection curRot = RotDirection::NONE;
-
-void right() {
-    gpioWrite(PIN_L, PI_ON);
-    gpioWrite(PIN_R, PI_OFF);
-    curRot = RotDirection::RIGHT;
-}
-
-void left() {
-    gpioWrite(PIN_R, PI_ON);
-    gpioWrite(PIN_L, PI_OFF);
-    curRot = RotDirection::LEFT;
-}
-
-void stopRot() {
-    gpioWrite(PIN_R, PI_ON);
-    gpioWrite(PIN_L, PI_ON);
-    curRot = RotDirection::NONE;
-}
-
-void open() {
-    gpioWrite(PIN_C, PI_ON);
-    gpioWrite(PIN_O, PI_OFF);
-}
-
-void close() {
-    gpioWrite(PIN_O, PI_ON);
-    gpioWrite(PIN_C, PI_OFF);
-}
-
-void stopShutter() {
-    gpioWrite(PIN_O, PI_ON);
-    gpioWrite(PIN_C, PI_ON);
-}
-
-// check funktions for sensors
-bool isOpen() {
-    return 0 == gpioRead(PIN_ISO);
+#include <vector>
+
+
+// 16 MB, about three hours of slewing
+#define FLIGHT_RECORDER_RECORDS (1u << 20)
+// TimerHit only reports, the control thread decides
+#define POLL_ACTIVE_MS 10
+#define POLL_IDLE_MS 500
+
+#define WIRING_TAB "Wiring"
+
+// indexed by DomeSignal
+static const char *SIGNAL_NAMES[SIGNAL_COUNT] = {"RIGHT", "LEFT", "OPEN", "CLOSE", "IS_OPEN", "IS_CLOSED", "IS_NORTH", "ROTATION"};
+static const char *SIGNAL_LABELS[SIGNAL_COUNT] = {"Right relay", "Left relay", "Open relay", "Close relay", "Is open",
+                                                  "Is closed", "Is north", "Rotation impulse"};
+
+// NEPO_DOME_DEVICES="Dome,Roof" drives a dome by each name from this process, they share pigpio, see PigpioBackend
+static std::vector<std::unique_ptr<NepoDomeDriver>> createDrivers() {
+    std::vector<std::unique_ptr<NepoDomeDriver>> drivers;
+    const char *devices = getenv("NEPO_DOME_DEVICES");
+    std::string names = devices ? devices : "";
+    size_t start = 0;
+    while (start < names.size()) {
+        size_t end = std::min(names.find(',', start), names.size());
+        if (end > start) {
+            drivers.emplace_back(new NepoDomeDriver(names.substr(start, end - start)));
+        }
+        start = end + 1;
+    }
+    if (drivers.empty()) {
+        drivers.emplace_back(new NepoDomeDriver());
+    }
+    return drivers;
 }
 
-bool isClosed() {
-    return 0 == gpioRead(PIN_ISC);
-}
+static std::vector<std::unique_ptr<NepoDomeDriver>> nepoDomeDrivers = createDrivers();
 
-bool isNorthed() {
-    return 0 == gpioRead(PIN_ISN);
+NepoDomeDriver::NepoDomeDriver(const std::string &name) {
+    if (!name.empty()) {
+        setDeviceName(name.c_str());
+    }
+    SetDomeCapability(DOME_CAN_ABORT | DOME_CAN_ABS_MOVE | DOME_CAN_REL_MOVE | DOME_CAN_PARK | DOME_HAS_SHUTTER);
 }
 
-bool isRotImp() {
-    return 0 == gpioRead(PIN_ROT);
+void NepoDomeDriver::ISGetProperties(const char *dev)
+{
+    INDI::Dome::ISGetProperties(dev);
+
+    // the wiring is needed before connecting
+    defineProperty(PinsNP);
+    defineProperty(ActiveHighSP);
+    defineProperty(SensorPullNP);
+    loadConfig(true, PinsNP.getName());
+    loadConfig(true, ActiveHighSP.getName());
+    loadConfig(true, SensorPullNP.getName());
 }
 
 const char* NepoDomeDriver::getDefaultName()
@@ -98,17 +80,40 @@ const char* NepoDomeDriver::getDefaultName()
 
 bool NepoDomeDriver::Connect()
 {
-    if (isOpen()) {
-        currentShutterAction = ShutterAction::OPEN;
+    // the GPIOs, the control thread and the calibration only run while connected
+    auto started = std::chrono::steady_clock::now();
+    if (!initPiGPIO()) {
+        releasePiGPIO();
+        return false;
+    }
+    // options loaded from the config or set before, the queue is empty yet and takes them all
+    control->setRecalibration(RecalibrationSP.findOnSwitchIndex() == RECALIBRATION_ON);
+    control->setEdgeStop(EdgeStopSP.findOnSwitchIndex() == EDGE_STOP_ON);
+    double travel[2] = {ShutterTravelNP[DomeController::TRAVEL_OPEN].getValue(), ShutterTravelNP[DomeController::TRAVEL_CLOSE].getValue()};
+    control->setShutterTravel(travel);
+    if (RealtimeNP[REALTIME_PRIORITY].getValue() > 0 || RealtimeNP[REALTIME_CPU].getValue() >= 0) {
+        std::string error;
+        if (!control->setRealtime(RealtimeNP[REALTIME_PRIORITY].getValue(), RealtimeNP[REALTIME_CPU].getValue(), error)) {
+            LOG_WARN(error.c_str());
+        }
+    }
+
+    // the limit switches are read by the control thread
+    if (!control->wait(control->detectShutterState(), 1000)) {
+        LOG_ERROR("The control thread doesn't respond");
+        releasePiGPIO();
+        return false;
+    }
+    state = control->getState();
+    DomeController::ShutterAction shutter = state.shutterAction;
+    if (shutter == DomeController::ShutterAction::OPEN) {
         DomeShutterSP[0].setState(ISS_ON);
         DomeShutterSP[1].setState(ISS_OFF);
-    } else if (isClosed()) {
-        currentShutterAction = ShutterAction::CLOSED;
+    } else if (shutter == DomeController::ShutterAction::CLOSED) {
         DomeShutterSP[0].setState(ISS_OFF);
         DomeShutterSP[1].setState(ISS_ON);
     } else {
         //Dome isn't open or closed
-        currentShutterAction = ShutterAction::STOPPED;
         DomeShutterSP.setState(IPS_ALERT);
         DomeShutterSP[0].setState(ISS_OFF);
         DomeShutterSP[1].setState(ISS_OFF);
@@ -123,142 +128,214 @@ bool NepoDomeDriver::Connect()
     LOGF_INFO("    Rotation impulses per complete rotation: %f", impCount[0].getValue());
     LOG_INFO("Calibration:");
 
+    // calibrating in the background, a cached calibration is only verified
+    CalibrationCache cache;
+    std::string error;
+    if (loadCalibrationCache(calibrationCachePath, cache, error)) {
+        startVerification(cache);
+    } else {
+        LOGF_INFO("No cached calibration: %s", error.c_str());
+        startCalibration();
+    }
+
+    // starting Timer loop
+    pollTimer = SetTimer(POLL_ACTIVE_MS);
+
+    StartupNP[STARTUP_CONNECT].setValue(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count());
+    LOGF_INFO("Connected in %.0f ms, %.0f ms of it initialising the GPIOs", StartupNP[STARTUP_CONNECT].getValue(),
+              StartupNP[STARTUP_GPIO].getValue());
+
     return true;
 }
 
 bool NepoDomeDriver::Disconnect() {
+    RemoveTimer(pollTimer);
+    pollTimer = -1;
+    pollIdle = false;
+    releasePiGPIO();
     LOG_INFO("Dome disconnected successfully!");
     return true;
 }
 
 bool NepoDomeDriver::initPiGPIO() {
-    // Initialization of PIGPIO
-    if (gpioInitialise() < 0) {
-        LOG_ERROR("Initialization of PIGPIO failed");
+    DomePinMap pins = pinMap();
+    std::string error;
+    if (!pins.validate(error)) {
+        LOG_ERROR(error.c_str());
         return false;
     }
 
-    // Setting up relays
-    int relay_pins[] = {PIN_R, PIN_L, PIN_O, PIN_C};
-    std::string relay_names[] = {"right", "left", "open", "close"};
-    for (int i = 0; i < 4; i++) {
-        int err = gpioSetMode(relay_pins[i], PI_OUTPUT);
-        if (err) {
-            LOG_ERROR((std::string("Setting the mode of GPIO ") + relay_names[i] + std::string(" (" + std::to_string(relay_pins[i]) + ") failed. Error code: " + std::to_string(err))).c_str());
-            return false;
-        }
-        gpioWrite(relay_pins[i], PI_ON);
+    // NEPO_DOME_SIMULATION=<time scale> runs the driver against a simulated dome instead of the GPIOs
+    // NEPO_DOME_PIGPIOD=<host>[:<port>] uses the GPIOs of a Raspberry Pi on the network through its pigpiod
+    const char *simulation = getenv("NEPO_DOME_SIMULATION");
+    const char *remote = getenv("NEPO_DOME_PIGPIOD");
+    if (simulation) {
+        double timeScale = atof(simulation) > 0 ? atof(simulation) : 1;
+        SimulatedDome *dome = new SimulatedDome(SimulatedDome::defaultConfig(pins));
+        dome->start(timeScale);
+        gpio.reset(dome);
+        LOGF_INFO("Running against a simulated dome at %gx real time", timeScale);
+    } else if (remote) {
+        // the port follows the last ':', without one it's pigpiod's default
+        std::string address = remote;
+        size_t colon = address.rfind(':');
+        std::string host = colon == std::string::npos ? address : address.substr(0, colon);
+        std::string port = colon == std::string::npos ? "" : address.substr(colon + 1);
+        pigpiod = new PigpiodBackend(host, port);
+        gpio.reset(pigpiod);
+        LOGF_INFO("Using pigpiod on %s", remote);
+    } else {
+        gpio.reset(new PigpioBackend());
     }
 
-    // Setting up sensors
-    int sensor_pins[] = {PIN_ISO, PIN_ISC, PIN_ISN, PIN_ROT};
-    std::string sensor_names[] = {"is open", "is closed", "is northed", "rotation meassuring impuls"};
-    for (int i = 0; i < 4; i++) {
-        int err = gpioSetMode(sensor_pins[i], PI_INPUT);
-        if (err) {
-            LOG_ERROR((std::string("Setting the mode of GPIO ") + sensor_names[i] + std::string(" (" + std::to_string(sensor_pins[i]) + ") failed. Error code: " + std::to_string(err))).c_str());
-            return false;
-        }
-        err = gpioSetPullUpDown(sensor_pins[i], PI_PUD_DOWN);
-        if (err) {
-            LOG_ERROR((std::string("Setting the pull down of GPIO ") + sensor_names[i] + std::string(" (" + std::to_string(sensor_pins[i]) + ") failed. Error code: " + std::to_string(err))).c_str());
-            return false;
+    // Initialization of PIGPIO: DMA channels, the peripherals and its threads, only for the first dome of the process
+    // remote: the sockets to pigpiod and the offset to its tick
+    auto started = std::chrono::steady_clock::now();
+    int err = gpio->initialise();
+    if (err < 0) {
+        if (pigpiod) {
+            LOGF_ERROR("Connecting to pigpiod on %s failed: %s", remote, pigpio_error(err));
+        } else {
+            LOG_ERROR("Initialization of PIGPIO failed");
         }
+        gpio.reset();
+        pigpiod = nullptr;
+        return false;
+    }
+    StartupNP[STARTUP_GPIO].setValue(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count());
+
+    controller.reset(new DomeController(*gpio, pins));
+    if (controller->getRecorder().open(flightRecorderPath, FLIGHT_RECORDER_RECORDS, pins, error)) {
+        LOGF_INFO("Recording to %s", flightRecorderPath.c_str());
+    } else {
+        LOGF_WARN("No flight recording: %s", error.c_str());
+    }
+    if (!controller->init(error)) {
+        LOG_ERROR(error.c_str());
+        return false;
     }
 
+    // sensor changes are reported as edges
+    if (!controller->startEdgeAlerts(error)) {
+        LOG_ERROR(error.c_str());
+        return false;
+    }
+
+    // from now on only the control thread touches the controller
+    control.reset(new ControlThread(*controller, 10000));
+    if (control->getLiveState().open(liveStateSegment, error)) {
+        LOGF_INFO("Sharing the live state as %s", liveStateSegment.c_str());
+    } else {
+        LOGF_WARN("No live state: %s", error.c_str());
+    }
+    control->start();
+    state = control->getState();
+
     return true;
 }
 
-void NepoDomeDriver::calibrate() {
-    // calibrating rotational meassurements
-    // moving to the leftmost point that's north
+void NepoDomeDriver::releasePiGPIO() {
+    // the control thread ends first so the relays can be released from here, then the alerts so none can reach the
+    // controller anymore, the last dome of the process gives the DMA channels back with gpioTerminate()
+    if (control) {
+        control->stop();
+    }
+    if (controller) {
+        controller->stop();
+        controller->stopShutter();
+        controller->stopEdgeAlerts();
+    }
+    if (gpio) {
+        gpio->terminate();
+    }
+    control.reset();
+    controller.reset();
+    gpio.reset();
+    pigpiod = nullptr;
+}
+
+bool NepoDomeDriver::queued(uint64_t seq) {
+    if (seq == 0) {
+        LOG_ERROR("The control thread's command queue is full, the command was dropped");
+    }
+    return seq != 0;
+}
+
+void NepoDomeDriver::startCalibration() {
+    shallPark = false;
+    if (!queued(control->startCalibration())) {
+        CalibrateSP.setState(IPS_ALERT);
+        CalibrateSP.apply();
+        return;
+    }
     LOG_INFO("Started calibration");
+    pollSoon();
     DomeAbsPosNP.setState(IPS_BUSY);
-    DomeAbsPosNP.apply();
-    right();
-    while (!isNorthed()) {};
-    // start of time meassurement of a full right/clockwise rotation (leftmost north to leftmost north)
-    long time_started = getMillis();
-    // counting edges (both kinds) of rotation impuls sensor while turning around 360°
-    // time meassurement and counting of rotation impulses happens at the same time to save time
-    int edges = 0;
-    bool prevState = isRotImp();
-    while (isNorthed()) {
-        bool currState = isRotImp();
-        edges += prevState != currState;
-        prevState = currState;
-    }
-    while (!isNorthed()) {
-        bool currState = isRotImp();
-        edges += prevState != currState;
-        prevState = currState;
-    }
-    long time_finished = getMillis();
-    // the Count of impulses has to be half of the amount of edges because every impuls is counted twice: rising edge and falling edge
-    impCount[0].setValue(edges / 2);
-    impCount.apply();
-    // the speed is meassured in °/ms
-    speed[SPEED_R].setValue(360.0/(time_finished - time_started));
-
-    // meassuring the time a full left/counterclockwise rotation (leftmost north to leftmost north)
-    // the modell overshoots sometimes after rotating clockwise and is therefore rotated slightly right of the north that's why it's rotating counterclockwise back to north
-    // to still be reliable it rotates 1 second to the right to guarantee an overshoot
-    sleep(1);
-    left();
-    while (!isNorthed()) {};
-    while (isNorthed()) {};
-    time_started = getMillis();
-    while (!isNorthed()) {};
-    while (isNorthed()) {};
-    time_finished = getMillis();
-    speed[SPEED_L].setValue(360.0/(time_finished - time_started));
-    speed.apply();
+    publisher.touch(DomeAbsPosNP);
+    CalibrateSP.setState(IPS_BUSY);
+    CalibrateSP.apply();
+    CalibrationProgressNP[0].setValue(0);
+    CalibrationProgressNP.setState(IPS_BUSY);
+    CalibrationProgressNP.apply();
+}
 
-    // again creating an overshoot/offset (this time to the left)
-    sleep(1);
-    right();
-    //meassuring the positions of the imps
-    while (!isNorthed()) {};
-    if (isRotImp()) { // avoid meassuring uncertainty in the case at north is also a imp
-        stopRot();
-        impToNorthOffset[0].setValue(0);
-        nextRightImpAz = 360.0 / impCount[0].getValue();
-        nextLeftImpAz = -360.0 / impCount[0].getValue();
-    } else {
-        time_started = getMillis();
-        while (!isRotImp()) {};
-        time_finished = getMillis();
-        impToNorthOffset[0].setValue(speed[SPEED_R].getValue()*(time_finished-time_started));
-        nextRightImpAz = impToNorthOffset[0].getValue();
-        nextLeftImpAz = nextRightImpAz - 360.0 / impCount[0].getValue();
-        // again creating an overshoot/offset (to the right)
-        sleep(1);
-        //returning to North
-        left();
-        while (!isNorthed()) {};
-        stopRot();
+void NepoDomeDriver::startVerification(const CalibrationCache &cache) {
+    LOGF_INFO("Verifying the cached calibration by homing to north from %.1f°", cache.azimuth);
+    shallPark = false;
+    if (!queued(control->verifyCalibration(cache.calibration, cache.azimuth, cache.deceleration))) {
+        CalibrateSP.setState(IPS_ALERT);
+        CalibrateSP.apply();
+        return;
     }
-    impToNorthOffset.apply();
+    pollSoon();
+    DomeAbsPosNP.setState(IPS_BUSY);
+    publisher.touch(DomeAbsPosNP);
+    CalibrateSP.setState(IPS_BUSY);
+    CalibrateSP.apply();
+    CalibrationProgressNP[0].setValue(0);
+    CalibrationProgressNP.setState(IPS_BUSY);
+    CalibrationProgressNP.apply();
+}
 
-    if (impToNorthOffset[0].getValue() > (360.0 / impCount[0].getValue())){
-        LOG_WARN("Calibration failed: retrying");
-        calibrate();
-        return;
+void NepoDomeDriver::storeCalibrationCache() {
+    CalibrationCache cache;
+    cache.calibration = control->getCalibration();
+    cache.deceleration[SPEED_R] = state.deceleration[SPEED_R];
+    cache.deceleration[SPEED_L] = state.deceleration[SPEED_L];
+    cache.azimuth = state.azimuth;
+    std::string error;
+    if (!saveCalibrationCache(calibrationCachePath, cache, error)) {
+        LOG_WARN(error.c_str());
     }
+}
 
-    DomeAbsPosNP[0].setValue(0);
-    DomeAbsPosNP.setState(IPS_OK);
-    DomeAbsPosNP.apply();
+void NepoDomeDriver::abortCalibration() {
+    control->abortCalibration();
+    pollSoon();
+    LOG_WARN("Calibration aborted");
+    DomeAbsPosNP.setState(IPS_ALERT);
+    publisher.touch(DomeAbsPosNP);
+    CalibrateSP.reset();
+    CalibrateSP.setState(IPS_ALERT);
+    CalibrateSP.apply();
+    CalibrationProgressNP.setState(IPS_IDLE);
+    CalibrationProgressNP.apply();
+}
 
-    LOGF_INFO("Offset between north and its right impuls: %f°", impToNorthOffset[0].getValue());
-    LOGF_INFO("Counterclockwise speed: %f°/ms", speed[SPEED_L].getValue());
-    LOGF_INFO("Clockwise speed: %f°/ms", speed[SPEED_R].getValue());
-    LOGF_INFO("Rotation impulses per complete rotation: %f", impCount[0].getValue());
-    LOG_INFO("Finished calibration");
+void NepoDomeDriver::publishCalibration() {
+    DomeController::Calibration calibration = control->getCalibration();
+    impCount[0].setValue(calibration.impCount);
+    impCount.apply();
+    speed[SPEED_R].setValue(calibration.speed[DomeController::SPEED_R]);
+    speed[SPEED_L].setValue(calibration.speed[DomeController::SPEED_L]);
+    speed.apply();
+    impToNorthOffset[0].setValue(calibration.impToNorthOffset);
+    impToNorthOffset.apply();
 }
 
 bool NepoDomeDriver::initProperties()
 {
+    auto started = std::chrono::steady_clock::now();
     INDI::Dome::initProperties();
 
     SetParkDataType(PARK_AZ);
@@ -266,13 +343,27 @@ bool NepoDomeDriver::initProperties()
 
     addAuxControls();
 
-    // initialization of PiGPIO
-    bool ok = initPiGPIO();
-    if (!ok) {
-        return false;
+    // files are kept next to the config
+    const char *home = getenv("HOME");
+    std::string configPrefix = std::string(home ? home : ".") + "/.indi/" + getDeviceName();
+    latencyDumpPath = configPrefix + "_latency.txt";
+    // NEPO_DOME_CALIBRATION_CACHE=<file> overrides where the calibration is cached
+    const char *cachePath = getenv("NEPO_DOME_CALIBRATION_CACHE");
+    if (cachePath) {
+        calibrationCachePath = cachePath;
+    } else {
+        calibrationCachePath = configPrefix + (getenv("NEPO_DOME_SIMULATION") ? "_calibration_sim.bin" : "_calibration.bin");
     }
-
-    calibrate();
+    // NEPO_DOME_FLIGHT_RECORDER=<file> overrides where the flight recorder writes to
+    const char *recorderPath = getenv("NEPO_DOME_FLIGHT_RECORDER");
+    if (recorderPath) {
+        flightRecorderPath = recorderPath;
+    } else {
+        flightRecorderPath = configPrefix + (getenv("NEPO_DOME_SIMULATION") ? "_flight_sim.rec" : "_flight.rec");
+    }
+    // NEPO_DOME_LIVE_STATE=<name> overrides the shared memory segment of the live state, see live_state.h
+    const char *liveState = getenv("NEPO_DOME_LIVE_STATE");
+    liveStateSegment = liveState ? liveState : liveStateName(getDeviceName());
 
     CalibrateSP[0].fill(
         "Calibrate",
@@ -293,16 +384,281 @@ bool NepoDomeDriver::initProperties()
 
     CalibrateSP.onUpdate([this]
     {
-        CalibrateSP.setState(IPS_BUSY);
-        CalibrateSP.apply();
-        calibrate();
-        CalibrateSP.reset();
-        CalibrateSP.setState(IPS_OK);
-        CalibrateSP.apply();
+        if (state.calibrating) {
+            LOG_WARN("Calibration is already running");
+            return;
+        }
+        startCalibration();
     });
 
-    // starting Timer loop
-    SetTimer(10);
+    CalibrationProgressNP[0].fill(
+        "Progress",
+        "Progress [%]",
+        "%.0f",
+        0,
+        100,
+        1,
+        0
+    );
+
+    CalibrationProgressNP.fill(
+        getDeviceName(),
+        "CalibrationProgress",
+        "Calibration",
+        MAIN_CONTROL_TAB,
+        IP_RO,
+        0,
+        IPS_IDLE
+    );
+
+    AzEstimateNP[AZ_ESTIMATE].fill("AZ_ESTIMATE", "Azimuth [°]", "%.2f", 0, 360, 0, 0);
+    AzEstimateNP[AZ_UNCERTAINTY].fill("AZ_UNCERTAINTY", "Uncertainty [°]", "%.2f", 0, 360, 0, 360);
+    AzEstimateNP[AZ_VELOCITY].fill("AZ_VELOCITY", "Velocity [°/s]", "%.3f", -100, 100, 0, 0);
+    AzEstimateNP.fill(
+        getDeviceName(),
+        "AZ_ESTIMATE",
+        "Position estimate",
+        MAIN_CONTROL_TAB,
+        IP_RO,
+        0,
+        IPS_IDLE
+    );
+
+    SlewEtaNP[0].fill("ETA", "Arrival in [s]", "%.1f", 0, 3600, 0, 0);
+    SlewEtaNP.fill(
+        getDeviceName(),
+        "DOME_ETA",
+        "Slew",
+        MAIN_CONTROL_TAB,
+        IP_RO,
+        0,
+        IPS_IDLE
+    );
+
+    CoastNP[SPEED_R].fill("COAST_R", "Clockwise [°]", "%.3f", 0, 360, 0, 0);
+    CoastNP[SPEED_L].fill("COAST_L", "Counterclockwise [°]", "%.3f", 0, 360, 0, 0);
+    CoastNP.fill(
+        getDeviceName(),
+        "DOME_COAST",
+        "Coast after stop",
+        MAIN_CONTROL_TAB,
+        IP_RO,
+        0,
+        IPS_IDLE
+    );
+
+    RotationFaultsNP[FAULT_STALLS].fill("FAULT_STALLS", "Encoder stalls", "%.0f", 0, 1e9, 0, 0);
+    RotationFaultsNP[FAULT_MISSED_NORTH].fill("FAULT_MISSED_NORTH", "North missed", "%.0f", 0, 1e9, 0, 0);
+    RotationFaultsNP.fill(
+        getDeviceName(),
+        "ROTATION_FAULTS",
+        "Rotation faults",
+        MAIN_CONTROL_TAB,
+        IP_RO,
+        0,
+        IPS_IDLE
+    );
+
+    ShutterProgressNP[SHUTTER_POSITION].fill("SHUTTER_POSITION", "Position [% open]", "%.0f", 0, 100, 0, 50);
+    ShutterProgressNP[SHUTTER_REMAINING].fill("SHUTTER_REMAINING", "Remaining [s]", "%.0f", 0, 600, 0, 0);
+    ShutterProgressNP.fill(
+        getDeviceName(),
+        "SHUTTER_PROGRESS",
+        "Shutter estimate",
+        MAIN_CONTROL_TAB,
+        IP_RO,
+        0,
+        IPS_IDLE
+    );
+
+    // learned from every full travel, 0 until then
+    ShutterTravelNP[DomeController::TRAVEL_OPEN].fill("TRAVEL_OPEN", "Opening [s]", "%.1f", 0, 600, 1, 0);
+    ShutterTravelNP[DomeController::TRAVEL_CLOSE].fill("TRAVEL_CLOSE", "Closing [s]", "%.1f", 0, 600, 1, 0);
+    ShutterTravelNP.fill(
+        getDeviceName(),
+        "SHUTTER_TRAVEL",
+        "Shutter travel",
+        OPTIONS_TAB,
+        IP_RW,
+        0,
+        IPS_IDLE
+    );
+
+    PublishNP[PUBLISH_MOVING_RATE].fill("MOVING_RATE", "While moving [Hz]", "%.1f", 0, 100, 1, 5);
+    PublishNP[PUBLISH_IDLE_RATE].fill("IDLE_RATE", "While idle [Hz], 0: on change", "%.1f", 0, 100, 1, 0);
+    PublishNP[PUBLISH_AZ_DEADBAND].fill("AZ_DEADBAND", "Azimuth deadband [°]", "%.3f", 0, 10, 0.01, 0.01);
+    PublishNP.fill(
+        getDeviceName(),
+        "PUBLISH_RATE",
+        "Position updates",
+        OPTIONS_TAB,
+        IP_RW,
+        0,
+        IPS_IDLE
+    );
+    applyPublishSettings();
+
+    FollowScheduler::Config follow;
+    FollowNP[FOLLOW_TOLERANCE].fill("TOLERANCE", "Slit tolerance [°]", "%.1f", 0, 45, 0.5, follow.tolerance);
+    FollowNP[FOLLOW_LOOKAHEAD].fill("LOOKAHEAD", "Lookahead [s]", "%.0f", 0, 600, 5, follow.lookahead);
+    FollowNP[FOLLOW_LEAD].fill("LEAD", "Lead [% of tolerance]", "%.0f", 0, 100, 10, follow.lead * 100);
+    FollowNP.fill(
+        getDeviceName(),
+        "DOME_FOLLOW",
+        "Follow mount",
+        OPTIONS_TAB,
+        IP_RW,
+        0,
+        IPS_IDLE
+    );
+
+    RealtimeNP[REALTIME_PRIORITY].fill("PRIORITY", "Priority, 0: normal", "%.0f", 0, 99, 1, 0);
+    RealtimeNP[REALTIME_CPU].fill("CPU", "CPU, -1: any", "%.0f", -1, 63, 1, -1);
+    RealtimeNP.fill(
+        getDeviceName(),
+        "CONTROL_THREAD",
+        "Control thread",
+        OPTIONS_TAB,
+        IP_RW,
+        0,
+        IPS_IDLE
+    );
+
+    RecalibrationSP[RECALIBRATION_ON].fill("RECALIBRATION_ON", "On", ISS_ON);
+    RecalibrationSP[RECALIBRATION_OFF].fill("RECALIBRATION_OFF", "Off", ISS_OFF);
+    RecalibrationSP.fill(
+        getDeviceName(),
+        "ONLINE_CALIBRATION",
+        "Calibrate at north",
+        OPTIONS_TAB,
+        IP_RW,
+        ISR_1OFMANY,
+        60,
+        IPS_IDLE
+    );
+    RecalibrationSP.onUpdate([this]
+    {
+        // taken by Connect() while disconnected
+        bool sent = !control || queued(control->setRecalibration(RecalibrationSP.findOnSwitchIndex() == RECALIBRATION_ON));
+        RecalibrationSP.setState(sent ? IPS_OK : IPS_ALERT);
+        RecalibrationSP.apply();
+        saveConfig(true, RecalibrationSP.getName());
+    });
+
+    EdgeStopSP[EDGE_STOP_ON].fill("EDGE_STOP_ON", "On", ISS_ON);
+    EdgeStopSP[EDGE_STOP_OFF].fill("EDGE_STOP_OFF", "Off", ISS_OFF);
+    EdgeStopSP.fill(
+        getDeviceName(),
+        "EDGE_STOP",
+        "Stop at edge",
+        OPTIONS_TAB,
+        IP_RW,
+        ISR_1OFMANY,
+        60,
+        IPS_IDLE
+    );
+    EdgeStopSP.onUpdate([this]
+    {
+        bool sent = !control || queued(control->setEdgeStop(EdgeStopSP.findOnSwitchIndex() == EDGE_STOP_ON));
+        EdgeStopSP.setState(sent ? IPS_OK : IPS_ALERT);
+        EdgeStopSP.apply();
+        saveConfig(true, EdgeStopSP.getName());
+    });
+
+    MemoryLockSP[MEMORY_LOCK_ON].fill("MEMORY_LOCK_ON", "On", ISS_OFF);
+    MemoryLockSP[MEMORY_LOCK_OFF].fill("MEMORY_LOCK_OFF", "Off", ISS_ON);
+    MemoryLockSP.fill(
+        getDeviceName(),
+        "MEMORY_LOCK",
+        "Lock memory",
+        OPTIONS_TAB,
+        IP_RW,
+        ISR_1OFMANY,
+        60,
+        IPS_IDLE
+    );
+    MemoryLockSP.onUpdate([this]
+    {
+        std::string error;
+        if (ControlThread::lockMemory(MemoryLockSP.findOnSwitchIndex() == MEMORY_LOCK_ON, error)) {
+            MemoryLockSP.setState(IPS_OK);
+        } else {
+            LOG_WARN(error.c_str());
+            MemoryLockSP.setState(IPS_ALERT);
+        }
+        MemoryLockSP.apply();
+        saveConfig(true, MemoryLockSP.getName());
+    });
+
+    DomePinMap pins;
+    for (int i = 0; i < SIGNAL_COUNT; i++) {
+        PinsNP[i].fill(SIGNAL_NAMES[i], SIGNAL_LABELS[i], "%.0f", 0, 31, 1, pins.gpio[i]);
+        ActiveHighSP[i].fill(SIGNAL_NAMES[i], SIGNAL_LABELS[i], pins.isActiveHigh(i) ? ISS_ON : ISS_OFF);
+    }
+    for (int i = FIRST_SENSOR; i <= LAST_SENSOR; i++) {
+        SensorPullNP[i - FIRST_SENSOR].fill(SIGNAL_NAMES[i], SIGNAL_LABELS[i], "%.0f", PULL_OFF, PULL_UP, 1, pins.pull[i]);
+    }
+    PinsNP.fill(getDeviceName(), "GPIO_PINS", "GPIOs", WIRING_TAB, IP_RW, 0, IPS_IDLE);
+    ActiveHighSP.fill(getDeviceName(), "ACTIVE_HIGH", "Active high", WIRING_TAB, IP_RW, ISR_NOFMANY, 60, IPS_IDLE);
+    ActiveHighSP.onUpdate([this]
+    {
+        ActiveHighSP.setState(IPS_OK);
+        ActiveHighSP.apply();
+        saveConfig(true, ActiveHighSP.getName());
+        if (isConnected()) {
+            LOG_INFO("The wiring takes effect with the next connection");
+        }
+    });
+    SensorPullNP.fill(getDeviceName(), "SENSOR_PULL", "Sensor pull, 0: off, 1: down, 2: up", WIRING_TAB, IP_RW, 0, IPS_IDLE);
+
+    fillLatency(TimerJitterNP, "LATENCY_TIMER_JITTER", "Timer jitter");
+    fillLatency(LoopDurationNP, "LATENCY_LOOP_DURATION", "Loop duration");
+    fillLatency(EdgeLatencyNP, "LATENCY_EDGE", "Edge to handling");
+    fillLatency(RelayLatencyNP, "LATENCY_RELAY", "Relay command");
+    fillLatency(PigpiodLatencyNP, "LATENCY_PIGPIOD", "pigpiod round trip");
+    ActivityNP[ACTIVITY_LOOP_WAKEUPS].fill("LOOP_WAKEUPS", "Control loop wakeups [1/s]", "%.1f", 0, 1e6, 0, 0);
+    ActivityNP[ACTIVITY_LOOP_CPU].fill("LOOP_CPU", "Control thread CPU [%]", "%.2f", 0, 100, 0, 0);
+    ActivityNP[ACTIVITY_TIMER_WAKEUPS].fill("TIMER_WAKEUPS", "Driver timer wakeups [1/s]", "%.1f", 0, 1e6, 0, 0);
+    ActivityNP[ACTIVITY_PROCESS_CPU].fill("PROCESS_CPU", "Driver CPU [%]", "%.2f", 0, 1e4, 0, 0);
+    ActivityNP.fill(getDeviceName(), "LOOP_ACTIVITY", "Activity", "Latency", IP_RO, 0, IPS_IDLE);
+    StartupNP[STARTUP_PROPERTIES].fill("PROPERTIES", "Properties [ms]", "%.1f", 0, 1e6, 0, 0);
+    StartupNP[STARTUP_GPIO].fill("GPIO", "GPIO initialisation [ms]", "%.1f", 0, 1e6, 0, 0);
+    StartupNP[STARTUP_CONNECT].fill("CONNECT", "Connect [ms]", "%.1f", 0, 1e6, 0, 0);
+    StartupNP.fill(getDeviceName(), "STARTUP", "Startup", "Latency", IP_RO, 0, IPS_IDLE);
+    LatencySP[LATENCY_DUMP].fill("LATENCY_DUMP", "Dump to file", ISS_OFF);
+    LatencySP[LATENCY_RESET].fill("LATENCY_RESET", "Reset", ISS_OFF);
+    LatencySP.fill(
+        getDeviceName(),
+        "LATENCY_CONTROL",
+        "Histograms",
+        "Latency",
+        IP_RW,
+        ISR_ATMOST1,
+        60,
+        IPS_IDLE
+    );
+    LatencySP.onUpdate([this]
+    {
+        int action = LatencySP.findOnSwitchIndex();
+        LatencySP.reset();
+        LatencySP.setState(IPS_OK);
+        if (action == LATENCY_DUMP) {
+            dumpLatency();
+        } else if (action == LATENCY_RESET) {
+            control->getTimerJitter().reset();
+            control->getLoopDuration().reset();
+            controller->getEdgeLatency().reset();
+            controller->getRelayLatency().reset();
+            if (pigpiod) {
+                pigpiod->getRoundTrips().reset();
+            }
+            LOG_INFO("Latency histograms reset");
+        }
+        LatencySP.apply();
+    });
+
+    // the hardware is only brought up by Connect(), listing the properties is instant
+    StartupNP[STARTUP_PROPERTIES].setValue(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count());
 
     return true;
 }
@@ -314,165 +670,485 @@ bool NepoDomeDriver::updateProperties()
     if (isConnected())
     {
         defineProperty(CalibrateSP);
+        defineProperty(CalibrationProgressNP);
+        defineProperty(AzEstimateNP);
+        defineProperty(SlewEtaNP);
+        defineProperty(CoastNP);
+        defineProperty(RotationFaultsNP);
+        defineProperty(ShutterProgressNP);
+        defineProperty(ShutterTravelNP);
+        defineProperty(PublishNP);
+        defineProperty(FollowNP);
+        defineProperty(RecalibrationSP);
+        defineProperty(EdgeStopSP);
+        defineProperty(RealtimeNP);
+        defineProperty(MemoryLockSP);
+        defineProperty(TimerJitterNP);
+        defineProperty(LoopDurationNP);
+        defineProperty(EdgeLatencyNP);
+        defineProperty(RelayLatencyNP);
+        if (pigpiod) {
+            defineProperty(PigpiodLatencyNP);
+        }
+        defineProperty(ActivityNP);
+        defineProperty(StartupNP);
+        defineProperty(LatencySP);
     }
     else
     {
         deleteProperty(CalibrateSP);
+        deleteProperty(CalibrationProgressNP);
+        deleteProperty(AzEstimateNP);
+        deleteProperty(SlewEtaNP);
+        deleteProperty(CoastNP);
+        deleteProperty(RotationFaultsNP);
+        deleteProperty(ShutterProgressNP);
+        deleteProperty(ShutterTravelNP);
+        deleteProperty(PublishNP);
+        deleteProperty(FollowNP);
+        deleteProperty(RecalibrationSP);
+        deleteProperty(EdgeStopSP);
+        deleteProperty(RealtimeNP);
+        deleteProperty(MemoryLockSP);
+        deleteProperty(TimerJitterNP);
+        deleteProperty(LoopDurationNP);
+        deleteProperty(EdgeLatencyNP);
+        deleteProperty(RelayLatencyNP);
+        deleteProperty(PigpiodLatencyNP);
+        deleteProperty(ActivityNP);
+        deleteProperty(StartupNP);
+        deleteProperty(LatencySP);
     }
 
     return true;
 }
 
-void NepoDomeDriver::TimerHit() {
-    // handle shutter movement
-    if (currentShutterAction == ShutterAction::OPENING) {
-        if (isOpen()) {
-            stopShutter();
-            currentShutterAction = ShutterAction::OPEN;
-            DomeShutterSP.setState(IPS_OK);
-            DomeShutterSP.apply();
+bool NepoDomeDriver::ISNewNumber(const char *dev, const char *name, double values[], char *names[], int n)
+{
+    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0 && PublishNP.isNameMatch(name)) {
+        PublishNP.update(values, names, n);
+        PublishNP.setState(IPS_OK);
+        PublishNP.apply();
+        applyPublishSettings();
+        saveConfig(true, PublishNP.getName());
+        return true;
+    }
+    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0 && FollowNP.isNameMatch(name)) {
+        FollowNP.update(values, names, n);
+        FollowNP.setState(IPS_OK);
+        FollowNP.apply();
+        FollowScheduler::Config follow = follower.getConfig();
+        follow.tolerance = FollowNP[FOLLOW_TOLERANCE].getValue();
+        follow.lookahead = FollowNP[FOLLOW_LOOKAHEAD].getValue();
+        follow.lead = FollowNP[FOLLOW_LEAD].getValue() / 100;
+        follower.setConfig(follow);
+        saveConfig(true, FollowNP.getName());
+        return true;
+    }
+    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0 && ShutterTravelNP.isNameMatch(name)) {
+        ShutterTravelNP.update(values, names, n);
+        double travel[2] = {ShutterTravelNP[DomeController::TRAVEL_OPEN].getValue(), ShutterTravelNP[DomeController::TRAVEL_CLOSE].getValue()};
+        // without a control thread Connect() takes them from the property
+        bool sent = !control || queued(control->setShutterTravel(travel));
+        ShutterTravelNP.setState(sent ? IPS_OK : IPS_ALERT);
+        ShutterTravelNP.apply();
+        saveConfig(true, ShutterTravelNP.getName());
+        return true;
+    }
+    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0 && (PinsNP.isNameMatch(name) || SensorPullNP.isNameMatch(name))) {
+        INDI::PropertyNumber &property = PinsNP.isNameMatch(name) ? PinsNP : SensorPullNP;
+        property.update(values, names, n);
+        std::string error;
+        if (pinMap().validate(error)) {
+            property.setState(IPS_OK);
+            saveConfig(true, property.getName());
+            if (isConnected()) {
+                LOG_INFO("The wiring takes effect with the next connection");
+            }
         } else {
-            open();
+            LOG_WARN(error.c_str());
+            property.setState(IPS_ALERT);
         }
-    } else if (currentShutterAction == ShutterAction::CLOSING) {
-        if (isClosed()) {
-            stopShutter();
-            currentShutterAction = ShutterAction::CLOSED;
-            DomeShutterSP.setState(IPS_OK);
-            DomeShutterSP.apply();
+        property.apply();
+        return true;
+    }
+    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0 && RealtimeNP.isNameMatch(name)) {
+        RealtimeNP.update(values, names, n);
+        std::string error;
+        if (!control) {
+            // applied by Connect() once the control thread runs
+            RealtimeNP.setState(IPS_IDLE);
+        } else if (control->setRealtime(RealtimeNP[REALTIME_PRIORITY].getValue(), RealtimeNP[REALTIME_CPU].getValue(), error)) {
+            RealtimeNP.setState(IPS_OK);
         } else {
-            close();
+            // SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit
+            LOG_WARN(error.c_str());
+            RealtimeNP.setState(IPS_ALERT);
         }
-    } else {
-        stopShutter();
+        RealtimeNP.apply();
+        saveConfig(true, RealtimeNP.getName());
+        return true;
     }
+    return INDI::Dome::ISNewNumber(dev, name, values, names, n);
+}
 
-    // handle dome rotation
-    // meassurements
-    double nextPos = DomeAbsPosNP[0].getValue();
-    long now = getMillis();
-    bool currImpState = isRotImp();
-
-    // calculate next postition by speed and time or impulse
-    if (curRot == RotDirection::RIGHT) {
-        nextPos += speed[SPEED_R].getValue()*(now - lastMeassurements);
-        if (currImpState && !prevImpState) {
-            nextPos = nextRightImpAz;
-            nextRightImpAz += 360.0 / impCount[0].getValue();
-            nextLeftImpAz = nextRightImpAz - 720.0 / impCount[0].getValue();
-        }
-    } else if (curRot == RotDirection::LEFT) {
-        nextPos -= speed[SPEED_L].getValue()*(now - lastMeassurements);
-        if (currImpState && !prevImpState) {
-            nextPos = nextLeftImpAz;
-            nextLeftImpAz -= 360.0 / impCount[0].getValue();
-            nextRightImpAz = nextLeftImpAz + 720.0 / impCount[0].getValue();
+bool NepoDomeDriver::saveConfigItems(FILE *fp)
+{
+    INDI::Dome::saveConfigItems(fp);
+    PublishNP.save(fp);
+    FollowNP.save(fp);
+    ShutterTravelNP.save(fp);
+    RecalibrationSP.save(fp);
+    EdgeStopSP.save(fp);
+    RealtimeNP.save(fp);
+    MemoryLockSP.save(fp);
+    PinsNP.save(fp);
+    ActiveHighSP.save(fp);
+    SensorPullNP.save(fp);
+    return true;
+}
+
+DomePinMap NepoDomeDriver::pinMap() {
+    DomePinMap pins;
+    for (int i = 0; i < SIGNAL_COUNT; i++) {
+        pins.gpio[i] = static_cast<unsigned>(PinsNP[i].getValue());
+    }
+    // the polarity is looked up by the GPIOs, so after they are known
+    for (int i = 0; i < SIGNAL_COUNT; i++) {
+        if (ActiveHighSP[i].getState() == ISS_ON && pins.gpio[i] < 32) {
+            pins.activeHigh |= pins.mask(i);
         }
     }
+    for (int i = FIRST_SENSOR; i <= LAST_SENSOR; i++) {
+        pins.pull[i] = static_cast<DomePull>(SensorPullNP[i - FIRST_SENSOR].getValue());
+    }
+    return pins;
+}
 
-    // check if impulse is passed 
-    if (prevImpState && !currImpState) {
-        if (curRot == RotDirection::RIGHT) {
-            nextLeftImpAz += 360.0 / impCount[0].getValue();
-        } else if (curRot == RotDirection::LEFT) {
-            nextRightImpAz -= 360.0 / impCount[0].getValue();
-        }
+void NepoDomeDriver::applyPublishSettings() {
+    // rebuilt so a changed deadband takes effect
+    publisher = PropertyPublisher();
+    publisher.setRates(PublishNP[PUBLISH_MOVING_RATE].getValue(), PublishNP[PUBLISH_IDLE_RATE].getValue());
+    publisher.add(DomeAbsPosNP, PublishNP[PUBLISH_AZ_DEADBAND].getValue());
+    publisher.add(AzEstimateNP, PublishNP[PUBLISH_AZ_DEADBAND].getValue());
+    publisher.add(SlewEtaNP, 0.5);
+    publisher.add(CoastNP, 0.001);
+    publisher.add(ShutterProgressNP, 0.5);
+}
+
+void NepoDomeDriver::fillLatency(INDI::PropertyNumber &property, const char *name, const char *label) {
+    property[LATENCY_COUNT].fill("COUNT", "Samples", "%.0f", 0, 1e12, 0, 0);
+    property[LATENCY_MEAN].fill("MEAN", "Mean [µs]", "%.1f", 0, 1e9, 0, 0);
+    property[LATENCY_P50].fill("P50", "50 % [µs]", "%.1f", 0, 1e9, 0, 0);
+    property[LATENCY_P99].fill("P99", "99 % [µs]", "%.1f", 0, 1e9, 0, 0);
+    property[LATENCY_P999].fill("P999", "99.9 % [µs]", "%.1f", 0, 1e9, 0, 0);
+    property[LATENCY_MAX].fill("MAX", "Max [µs]", "%.1f", 0, 1e9, 0, 0);
+    property.fill(getDeviceName(), name, label, "Latency", IP_RO, 0, IPS_IDLE);
+}
+
+void NepoDomeDriver::publishLatency(INDI::PropertyNumber &property, const LatencyHistogram &histogram) {
+    property[LATENCY_COUNT].setValue(histogram.getCount());
+    property[LATENCY_MEAN].setValue(histogram.getMean() / 1000);
+    property[LATENCY_P50].setValue(histogram.getQuantile(0.5) / 1000.0);
+    property[LATENCY_P99].setValue(histogram.getQuantile(0.99) / 1000.0);
+    property[LATENCY_P999].setValue(histogram.getQuantile(0.999) / 1000.0);
+    property[LATENCY_MAX].setValue(histogram.getMax() / 1000.0);
+    property.setState(IPS_OK);
+    property.apply();
+}
+
+void NepoDomeDriver::publishActivity(double seconds) {
+    timespec cpu;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    Activity now;
+    now.loopWakeups = control->getWakeups();
+    now.loopCpu = control->getCpuTime();
+    now.timerWakeups = timerWakeups;
+    now.processCpu = cpu.tv_sec * 1000000000ull + cpu.tv_nsec;
+    ActivityNP[ACTIVITY_LOOP_WAKEUPS].setValue((now.loopWakeups - activity.loopWakeups) / seconds);
+    ActivityNP[ACTIVITY_LOOP_CPU].setValue((now.loopCpu - activity.loopCpu) / seconds / 1e7);
+    ActivityNP[ACTIVITY_TIMER_WAKEUPS].setValue((now.timerWakeups - activity.timerWakeups) / seconds);
+    ActivityNP[ACTIVITY_PROCESS_CPU].setValue((now.processCpu - activity.processCpu) / seconds / 1e7);
+    ActivityNP.setState(state.idle ? IPS_IDLE : IPS_BUSY);
+    ActivityNP.apply();
+    activity = now;
+}
+
+void NepoDomeDriver::pollSoon() {
+    if (pollIdle) {
+        RemoveTimer(pollTimer);
+        pollTimer = SetTimer(POLL_ACTIVE_MS);
+        pollIdle = false;
     }
+}
 
-    // resetting at north
-    if (isNorthed()) {
-        nextPos = 0;
-        if (impToNorthOffset[0].getValue()==0) {
-            nextRightImpAz = 360.0 / impCount[0].getValue();
-            nextLeftImpAz = -360.0 / impCount[0].getValue();
-        } else {
-            nextRightImpAz = impToNorthOffset[0].getValue();
-            nextLeftImpAz = nextRightImpAz - 360.0 / impCount[0].getValue();
-        }
+void NepoDomeDriver::dumpLatency() {
+    FILE *fp = fopen(latencyDumpPath.c_str(), "w");
+    if (!fp) {
+        LOGF_ERROR("Opening %s failed: %s", latencyDumpPath.c_str(), strerror(errno));
+        return;
+    }
+    control->getTimerJitter().dump(fp, "timer jitter");
+    control->getLoopDuration().dump(fp, "loop duration");
+    controller->getEdgeLatency().dump(fp, "edge to handling latency");
+    controller->getRelayLatency().dump(fp, "relay command latency");
+    if (pigpiod) {
+        pigpiod->getRoundTrips().dump(fp, "pigpiod round trip");
     }
+    fclose(fp);
+    LOGF_INFO("Latency histograms written to %s", latencyDumpPath.c_str());
+}
 
+void NepoDomeDriver::TimerHit() {
+    // the control thread has done the work, here it is only reported
+    timerWakeups++;
+    unsigned events = control->takeEvents();
+    state = control->getState();
+
+    uint32_t dropped = controller->takeDroppedEdges();
+    if (dropped) {
+        LOGF_WARN("%u sensor edges were dropped", dropped);
+    }
+    uint32_t resynced = controller->takeResyncedEdges();
+    if (resynced) {
+        LOGF_WARN("%u sensor edges were missed and taken from the GPIO snapshot", resynced);
+    }
+    uint32_t failed = pigpiod ? pigpiod->takeFailedCommands() : 0;
+    if (failed) {
+        LOGF_WARN("%u commands to pigpiod failed", failed);
+    }
+    if (events & DomeController::Event::GPIO_LOST) {
+        // pigpiod leaves its GPIOs as they are, nothing here can release the relays anymore
+        LOG_ERROR("The connection to pigpiod is lost, the relays keep their last state on the Pi: check the dome");
+        DomeAbsPosNP.setState(IPS_ALERT);
+        DomeAbsPosNP.apply();
+        DomeMotionSP.setState(IPS_ALERT);
+        DomeMotionSP.apply();
+        DomeShutterSP.setState(IPS_ALERT);
+        DomeShutterSP.apply();
+        Disconnect();
+        setConnected(false, IPS_ALERT);
+        updateProperties();
+        return;
+    }
+
+    // calibration
+    if (events & DomeController::Event::CALIBRATION_PROGRESS) {
+        CalibrationProgressNP[0].setValue(state.calibrationProgress);
+        CalibrationProgressNP.setState(state.calibrating ? IPS_BUSY : IPS_IDLE);
+        CalibrationProgressNP.apply();
+    }
+    if (events & DomeController::Event::CALIBRATION_RETRY) {
+        LOG_WARN("Calibration failed: retrying");
+    }
+    if (events & DomeController::Event::CALIBRATION_FAILED) {
+        LOG_ERROR("Calibration failed");
+        DomeAbsPosNP.setState(IPS_ALERT);
+        CalibrateSP.reset();
+        CalibrateSP.setState(IPS_ALERT);
+        CalibrateSP.apply();
+    }
+    if (events & DomeController::Event::CALIBRATION_FINISHED) {
+        publishCalibration();
+        DomeAbsPosNP.setState(IPS_OK);
+        CalibrateSP.reset();
+        CalibrateSP.setState(IPS_OK);
+        CalibrateSP.apply();
+
+        LOGF_INFO("Offset between north and its right impuls: %f°", impToNorthOffset[0].getValue());
+        LOGF_INFO("Counterclockwise speed: %f°/ms", speed[SPEED_L].getValue());
+        LOGF_INFO("Clockwise speed: %f°/ms", speed[SPEED_R].getValue());
+        LOGF_INFO("Rotation impulses per complete rotation: %f", impCount[0].getValue());
+        LOG_INFO("Finished calibration");
+        storeCalibrationCache();
+    }
+    if (events & DomeController::Event::CALIBRATION_VERIFIED) {
+        publishCalibration();
+        DomeAbsPosNP.setState(IPS_OK);
+        CalibrateSP.reset();
+        CalibrateSP.setState(IPS_OK);
+        CalibrateSP.apply();
+        CalibrationProgressNP.setState(IPS_IDLE);
+        CalibrationProgressNP.apply();
+        LOGF_INFO("Cached calibration verified, drift at north: %.2f°", state.calibrationDrift);
+        storeCalibrationCache();
+    }
+    if (events & DomeController::Event::CALIBRATION_DRIFTED) {
+        LOGF_WARN("Calibration drifted by %.2f° at north, calibrating again", state.calibrationDrift);
+        startCalibration();
+    }
+    if (events & DomeController::Event::CALIBRATION_UPDATED) {
+        // cached with the position at the next halt
+        publishCalibration();
+        LOGF_DEBUG("Passed north %.3f° off, calibration refined", state.northResidual);
+    }
+
+    // handle shutter movement
+    if (events & (DomeController::Event::SHUTTER_OPENED | DomeController::Event::SHUTTER_CLOSED)) {
+        DomeShutterSP.setState(IPS_OK);
+        DomeShutterSP.apply();
+        // a full travel refines the learned time
+        if (state.shutterTravel[DomeController::TRAVEL_OPEN] != ShutterTravelNP[DomeController::TRAVEL_OPEN].getValue()
+            || state.shutterTravel[DomeController::TRAVEL_CLOSE] != ShutterTravelNP[DomeController::TRAVEL_CLOSE].getValue()) {
+            ShutterTravelNP[DomeController::TRAVEL_OPEN].setValue(state.shutterTravel[DomeController::TRAVEL_OPEN]);
+            ShutterTravelNP[DomeController::TRAVEL_CLOSE].setValue(state.shutterTravel[DomeController::TRAVEL_CLOSE]);
+            ShutterTravelNP.setState(IPS_OK);
+            ShutterTravelNP.apply();
+            saveConfig(true, ShutterTravelNP.getName());
+        }
+    }
+    if (events & DomeController::Event::SHUTTER_STALLED) {
+        LOGF_ERROR("The shutter didn't reach its limit switch in time and was stopped at about %.0f %% open", state.shutterPosition * 100);
+        DomeShutterSP.setState(IPS_ALERT);
+        DomeShutterSP.apply();
+    }
+    ShutterProgressNP[SHUTTER_POSITION].setValue(state.shutterPosition * 100);
+    ShutterProgressNP[SHUTTER_REMAINING].setValue(state.shutterRemaining);
+    bool shutterMoving = state.shutterAction == DomeController::ShutterAction::OPENING || state.shutterAction == DomeController::ShutterAction::CLOSING;
+    ShutterProgressNP.setState(state.shutterStalled ? IPS_ALERT : (shutterMoving ? IPS_BUSY : IPS_OK));
 
-    // check if targetedAz lies between current and next position
-    if (moveToTarget && ((range360(DomeAbsPosNP[0].getValue() - targetedAz)<180) != (range360(nextPos - targetedAz)<180))) {
-        moveToTarget = false;
-        stopRot();
+    // handle dome rotation
+    if (events & DomeController::Event::TARGET_REACHED) {
         DomeAbsPosNP.setState(IPS_OK);
         DomeRelPosNP.setState(IPS_OK);
         DomeRelPosNP.apply();
         DomeMotionSP.setState(IPS_OK);
         DomeMotionSP.apply();
     }
-
-    // update variables
-    lastMeassurements = now;
-    prevImpState = currImpState;
-    DomeAbsPosNP[0].setValue(range360(nextPos));
-    DomeAbsPosNP.apply();
-
-    // starting motion if necessary
-    if (moveToTarget) {
-        if (range360(DomeAbsPosNP[0].getValue() - targetedAz)<180) {
-            left();
-        } else {
-            right();
-        }
+    if (events & DomeController::Event::ROTATION_STALLED) {
+        LOGF_ERROR("No rotation impulse came in time, the dome was stopped at about %.1f°", state.azimuth);
+        DomeAbsPosNP.setState(IPS_ALERT);
+        DomeMotionSP.setState(IPS_ALERT);
+        DomeMotionSP.apply();
+    }
+    if (events & DomeController::Event::NORTH_MISSED) {
+        LOGF_WARN("The dome passed north without its sensor at about %.1f°", state.azimuth);
+    }
+    if (events & (DomeController::Event::ROTATION_STALLED | DomeController::Event::NORTH_MISSED)) {
+        RotationFaultsNP[FAULT_STALLS].setValue(state.rotationStalls);
+        RotationFaultsNP[FAULT_MISSED_NORTH].setValue(state.missedNorth);
+        RotationFaultsNP.setState(state.rotationStalled ? IPS_ALERT : IPS_OK);
+        RotationFaultsNP.apply();
+    }
+    DomeAbsPosNP[0].setValue(state.azimuth);
+    AzEstimateNP[AZ_ESTIMATE].setValue(state.azimuth);
+    AzEstimateNP[AZ_UNCERTAINTY].setValue(state.azimuthUncertainty);
+    AzEstimateNP[AZ_VELOCITY].setValue(state.velocity);
+    AzEstimateNP.setState(state.rotation == DomeController::RotDirection::NONE ? IPS_OK : IPS_BUSY);
+    // planned by the arrival time, see SlewPlanner
+    SlewEtaNP[0].setValue(state.targetEta);
+    SlewEtaNP.setState(state.movingToTarget ? IPS_BUSY : IPS_IDLE);
+
+    // the coast is learned from the impulses passing after each stop
+    CoastNP[SPEED_R].setValue(state.coast[SPEED_R]);
+    CoastNP[SPEED_L].setValue(state.coast[SPEED_L]);
+    CoastNP.setState(IPS_OK);
+
+    // the dome is still moving while it coasts after the motor stopped
+    publisher.flush(state.rotation != DomeController::RotDirection::NONE || !state.still || shutterMoving);
+
+    followMount();
+
+    // the position is cached whenever the dome came to a halt
+    if (state.rotation != DomeController::RotDirection::NONE) {
+        positionCacheDirty = true;
+    } else if (positionCacheDirty && state.still && !state.calibrating) {
+        positionCacheDirty = false;
+        storeCalibrationCache();
     }
 
     // setting parked if parkingPostion reached
-    if (shallPark && (!isParked()) && (!moveToTarget) && currentShutterAction == ShutterAction::CLOSED){
+    // commands still in the queue aren't part of the state yet
+    if (shallPark && (!isParked()) && control->isCurrent(state) && (!state.movingToTarget) && state.shutterAction == DomeController::ShutterAction::CLOSED){
         SetParked(true);
         ParkSP.setState(IPS_OK);
         ParkSP.apply();
     }
 
 
-    // call setTimer to continue the loop
-    SetTimer(10);
+    auto now = std::chrono::steady_clock::now();
+    if (isConnected() && now - latencyPublished >= std::chrono::seconds(1)) {
+        publishActivity(std::chrono::duration<double>(now - latencyPublished).count());
+        latencyPublished = now;
+        publishLatency(TimerJitterNP, control->getTimerJitter());
+        publishLatency(LoopDurationNP, control->getLoopDuration());
+        publishLatency(EdgeLatencyNP, controller->getEdgeLatency());
+        publishLatency(RelayLatencyNP, controller->getRelayLatency());
+        if (pigpiod) {
+            publishLatency(PigpiodLatencyNP, pigpiod->getRoundTrips());
+        }
+    }
+
+    // call setTimer to continue the loop, slowly while nothing moves and no command is on its way
+    pollIdle = state.idle && control->isCurrent(state);
+    pollTimer = SetTimer(pollIdle ? POLL_IDLE_MS : POLL_ACTIVE_MS);
 }
 
 IPState NepoDomeDriver::ControlShutter(ShutterOperation operation) {
     if (operation == ShutterOperation::SHUTTER_OPEN) {
-        if (currentShutterAction == ShutterAction::OPEN)
+        if (state.shutterAction == DomeController::ShutterAction::OPEN)
             return IPS_OK;
-        currentShutterAction = ShutterAction::OPENING;
+        if (!queued(control->openShutter()))
+            return IPS_ALERT;
+        pollSoon();
         return IPS_BUSY;
     } else {
-        if (currentShutterAction == ShutterAction::CLOSED)
+        if (state.shutterAction == DomeController::ShutterAction::CLOSED)
             return IPS_OK;
-        currentShutterAction = ShutterAction::CLOSING;
+        if (!queued(control->closeShutter()))
+            return IPS_ALERT;
+        pollSoon();
         return IPS_BUSY;
     }
 }
 
 IPState NepoDomeDriver::Move(DomeDirection dir, DomeMotionCommand operation) {
-    moveToTarget = false;
     if (operation == DomeMotionCommand::MOTION_STOP) {
-        stopRot();
+        if (state.calibrating) {
+            abortCalibration();
+        }
+        control->stopRotation();
+        pollSoon();
         DomeAbsPosNP.setState(IPS_OK);
-        DomeAbsPosNP.apply();
+        publisher.touch(DomeAbsPosNP);
         DomeRelPosNP.setState(IPS_OK);
         DomeRelPosNP.apply();
         return IPS_OK;
     }
+    if (state.calibrating) {
+        LOG_WARN("The dome can't be moved while calibrating");
+        return IPS_ALERT;
+    }
 
-    if (dir == DomeDirection::DOME_CW) {
-        right();
-    } else {
-        left();
+    if (!queued(control->move(dir == DomeDirection::DOME_CW ? DomeController::RotDirection::RIGHT : DomeController::RotDirection::LEFT))) {
+        return IPS_ALERT;
     }
+    pollSoon();
     DomeAbsPosNP.setState(IPS_BUSY);
-    DomeAbsPosNP.apply();
+    publisher.touch(DomeAbsPosNP);
     DomeRelPosNP.setState(IPS_BUSY);
     DomeRelPosNP.apply();
     return IPS_BUSY;
 }
 
 IPState NepoDomeDriver::MoveRel(double azDiff) {
-    targetedAz = range360(DomeAbsPosNP[0].getValue() + azDiff);
-    moveToTarget = true;
+    if (state.calibrating) {
+        LOG_WARN("The dome can't be moved while calibrating");
+        return IPS_ALERT;
+    }
+    if (isFollowing()) {
+        // while following a relative move shifts the slit against the mount
+        followOffset = std::remainder(followOffset + azDiff, 360.0);
+        LOGF_INFO("Following the mount with an offset of %.1f°", followOffset);
+        return IPS_OK;
+    }
+    if (!queued(control->moveTo(range360(DomeAbsPosNP[0].getValue() + azDiff)))) {
+        return IPS_ALERT;
+    }
+    pollSoon();
 
     DomeAbsPosNP.setState(IPS_BUSY);
-    DomeAbsPosNP.apply();
+    publisher.touch(DomeAbsPosNP);
     DomeMotionSP.setState(IPS_BUSY);
     DomeMotionSP.apply();
 
@@ -480,8 +1156,24 @@ IPState NepoDomeDriver::MoveRel(double azDiff) {
 }
 
 IPState NepoDomeDriver::MoveAbs(double az) {
-    targetedAz = range360(az);
-    moveToTarget = true;
+    if (isFollowing()) {
+        // the dome is moved by followMount() once the aperture would clip
+        double now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        follower.request(range360(az), now);
+        return IPS_OK;
+    }
+    return moveToAzimuth(az);
+}
+
+IPState NepoDomeDriver::moveToAzimuth(double az) {
+    if (state.calibrating) {
+        LOG_WARN("The dome can't be moved while calibrating");
+        return IPS_ALERT;
+    }
+    if (!queued(control->moveTo(range360(az)))) {
+        return IPS_ALERT;
+    }
+    pollSoon();
 
     DomeRelPosNP.setState(IPS_BUSY);
     DomeRelPosNP.apply();
@@ -491,6 +1183,32 @@ IPState NepoDomeDriver::MoveAbs(double az) {
     return IPS_BUSY;
 }
 
+bool NepoDomeDriver::isFollowing() {
+    return DomeAutoSyncSP.findOnSwitchIndex() == DOME_AUTOSYNC_ENABLE && !shallPark;
+}
+
+void NepoDomeDriver::followMount() {
+    if (!isFollowing()) {
+        if (follower.hasRequest()) {
+            follower.reset();
+            followOffset = 0;
+        }
+        return;
+    }
+    // only decided with the dome standing still, while it moves or coasts the position is changing anyway
+    if (!follower.hasRequest() || !control->isCurrent(state) || state.calibrating || state.movingToTarget || !state.still) {
+        return;
+    }
+    double now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    double speed = std::min(state.speed[DomeController::SPEED_R], state.speed[DomeController::SPEED_L]) * 1000;
+    double target;
+    if (follower.due(range360(state.azimuth - followOffset), now, speed, target)) {
+        LOGF_DEBUG("Following the mount: moving to %.1f°, mount rate %.4f°/s", range360(target + followOffset), follower.getRate());
+        moveToAzimuth(target + followOffset);
+        DomeAbsPosNP.setState(IPS_BUSY);
+    }
+}
+
 IPState NepoDomeDriver::Park() {
     DomeShutterSP[0].setState(ISS_OFF);
     DomeShutterSP[1].setState(ISS_ON);
@@ -498,7 +1216,7 @@ IPState NepoDomeDriver::Park() {
     DomeShutterSP.setState(s);
     DomeShutterSP.apply();
 
-    IPState d = NepoDomeDriver::MoveAbs(GetAxis1Park());
+    IPState d = moveToAzimuth(GetAxis1Park());
 
     shallPark = true;
 
@@ -525,7 +1243,8 @@ bool NepoDomeDriver::Abort() {
     shallPark = false;
 
     if (DomeShutterSP.getState() == IPS_BUSY) {
-        currentShutterAction = ShutterAction::STOPPED;
+        control->stopShutter();
+        pollSoon();
         DomeShutterSP.setState(IPS_ALERT);
         DomeShutterSP[0].setState(ISS_OFF);
         DomeShutterSP[1].setState(ISS_OFF);
@@ -2,21 +2,39 @@
 
 #include "libindi/indidome.h"
 
+#include "dome_controller.h"
+#include "dome_pins.h"
+#include "calibration_cache.h"
+#include "control_thread.h"
+#include "follow_scheduler.h"
+#include "gpio_backend.h"
+#include "latency_histogram.h"
+#include "pigpiod_backend.h"
+#include "property_publisher.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
 class NepoDomeDriver : public INDI::Dome
 {
 public:
-    NepoDomeDriver();
+    // without a name the device is named by INDIDEV or getDefaultName()
+    explicit NepoDomeDriver(const std::string &name = "");
     virtual ~NepoDomeDriver() = default;
 
+    virtual void ISGetProperties(const char *dev) override;
     virtual bool initProperties() override;
     virtual bool updateProperties() override;
     virtual const char *getDefaultName() override;
+    virtual bool ISNewNumber(const char *dev, const char *name, double values[], char *names[], int n) override;
 
 protected:
     bool Connect() override;
     bool Disconnect() override;
 
     void TimerHit() override;
+    virtual bool saveConfigItems(FILE *fp) override;
 
     virtual IPState Move(DomeDirection dir, DomeMotionCommand operation) override;
     virtual IPState MoveRel(double azDiff) override;
@@ -27,17 +45,164 @@ protected:
     virtual bool Abort() override;
 
 private:
+    // brought up by Connect() and released by Disconnect(), a failed bring up is released as well
     bool initPiGPIO();
-    enum ShutterAction {
-        OPEN,
-        OPENING,
-        STOPPED,
-        CLOSING,
-        CLOSED
-    };
-    ShutterAction currentShutterAction;
-    void calibrate();
+    void releasePiGPIO();
+    // destroyed in reverse: the control thread is stopped first, then the backend so no alert can reach a
+    // destroyed controller
+    std::unique_ptr<DomeController> controller;
+    std::unique_ptr<GpioBackend> gpio;
+    // the same as gpio when it's a remote pigpiod, else null
+    PigpiodBackend *pigpiod = nullptr;
+    std::unique_ptr<ControlThread> control;
+    // false and an error logged if the control thread's queue was full and dropped the command with sequence number seq
+    bool queued(uint64_t seq);
+    // the control thread's snapshot taken at the start of each TimerHit
+    DomeState state;
+    // the wiring, defined before connecting and used from the next Connect() on
+    DomePinMap pinMap();
+    INDI::PropertyNumber PinsNP {SIGNAL_COUNT};
+    INDI::PropertySwitch ActiveHighSP {SIGNAL_COUNT};
+    // indexed by the DomeSignal minus FIRST_SENSOR, the values are DomePull
+    INDI::PropertyNumber SensorPullNP {LAST_SENSOR - FIRST_SENSOR + 1};
+
+    void startCalibration();
+    void abortCalibration();
+    void publishCalibration();
+    // the calibration and the position survive a restart, then the calibration is only verified
+    std::string calibrationCachePath;
+    // the controller's flight recorder, see FlightRecorder
+    std::string flightRecorderPath;
+    // the POSIX shared memory segment of the live state for local readers, see live_state.h
+    std::string liveStateSegment;
+    void startVerification(const CalibrationCache &cache);
+    void storeCalibrationCache();
+    bool positionCacheDirty = false;
     INDI::PropertySwitch CalibrateSP {1};
+    INDI::PropertyNumber CalibrationProgressNP {1};
+    // every crossing of north at full speed refines the calibration
+    INDI::PropertySwitch RecalibrationSP {2};
+    enum {
+        RECALIBRATION_ON,
+        RECALIBRATION_OFF
+    };
+    // the alert thread stops slews at the encoder edge before the stop point
+    INDI::PropertySwitch EdgeStopSP {2};
+    enum {
+        EDGE_STOP_ON,
+        EDGE_STOP_OFF
+    };
+    INDI::PropertyNumber AzEstimateNP {3};
+    enum {
+        AZ_ESTIMATE,
+        AZ_UNCERTAINTY,
+        AZ_VELOCITY
+    };
+    INDI::PropertyNumber SlewEtaNP {1};
+    INDI::PropertyNumber CoastNP {2};
+    INDI::PropertyNumber ShutterProgressNP {2};
+    enum {
+        SHUTTER_POSITION,
+        SHUTTER_REMAINING
+    };
+    INDI::PropertyNumber ShutterTravelNP {2};
+    // the encoder watchdog and the check for north count their faults since the start
+    INDI::PropertyNumber RotationFaultsNP {2};
+    enum {
+        FAULT_STALLS,
+        FAULT_MISSED_NORTH
+    };
+
+    // latencies of the control loop, published once a second on their own tab and dumped to a file on demand
+    std::chrono::steady_clock::time_point latencyPublished;
+    std::string latencyDumpPath;
+    void fillLatency(INDI::PropertyNumber &property, const char *name, const char *label);
+    void publishLatency(INDI::PropertyNumber &property, const LatencyHistogram &histogram);
+    void dumpLatency();
+    INDI::PropertyNumber TimerJitterNP {6};
+    INDI::PropertyNumber LoopDurationNP {6};
+    INDI::PropertyNumber EdgeLatencyNP {6};
+    INDI::PropertyNumber RelayLatencyNP {6};
+    // only defined with a remote pigpiod
+    INDI::PropertyNumber PigpiodLatencyNP {6};
+    enum {
+        LATENCY_COUNT,
+        LATENCY_MEAN,
+        LATENCY_P50,
+        LATENCY_P99,
+        LATENCY_P999,
+        LATENCY_MAX
+    };
+    INDI::PropertySwitch LatencySP {2};
+    enum {
+        LATENCY_DUMP,
+        LATENCY_RESET
+    };
+
+    // TimerHit runs every POLL_ACTIVE_MS while something moves or a command is on its way, else every POLL_IDLE_MS
+    // and a new command brings the fast one back right away
+    int pollTimer = -1;
+    bool pollIdle = false;
+    void pollSoon();
+    uint64_t timerWakeups = 0;
+    // wakeups and CPU use of the control thread and the driver, as rates since the last publication
+    struct Activity {
+        uint64_t loopWakeups = 0;
+        uint64_t loopCpu = 0;       // ns
+        uint64_t timerWakeups = 0;
+        uint64_t processCpu = 0;    // ns
+    } activity;
+    void publishActivity(double seconds);
+    INDI::PropertyNumber ActivityNP {4};
+    enum {
+        ACTIVITY_LOOP_WAKEUPS,
+        ACTIVITY_LOOP_CPU,
+        ACTIVITY_TIMER_WAKEUPS,
+        ACTIVITY_PROCESS_CPU
+    };
+    // how long initProperties() and the last Connect() took, and the GPIO initialisation within it
+    INDI::PropertyNumber StartupNP {3};
+    enum {
+        STARTUP_PROPERTIES,
+        STARTUP_GPIO,
+        STARTUP_CONNECT
+    };
+
+    // while slaved to the mount MoveAbs only feeds the scheduler, the loop starts the moves
+    IPState moveToAzimuth(double az);
+    bool isFollowing();
+    void followMount();
+    FollowScheduler follower;
+    double followOffset = 0;
+    INDI::PropertyNumber FollowNP {3};
+    enum {
+        FOLLOW_TOLERANCE,
+        FOLLOW_LOOKAHEAD,
+        FOLLOW_LEAD
+    };
+
+    // scheduling of the control thread, both need privileges (CAP_SYS_NICE, CAP_IPC_LOCK or matching limits)
+    INDI::PropertyNumber RealtimeNP {2};
+    enum {
+        REALTIME_PRIORITY,
+        REALTIME_CPU
+    };
+    INDI::PropertySwitch MemoryLockSP {2};
+    enum {
+        MEMORY_LOCK_ON,
+        MEMORY_LOCK_OFF
+    };
+
+    // values changing every loop are only sent through the publisher
+    PropertyPublisher publisher;
+    void applyPublishSettings();
+    INDI::PropertyNumber PublishNP {3};
+    enum {
+        PUBLISH_MOVING_RATE,
+        PUBLISH_IDLE_RATE,
+        PUBLISH_AZ_DEADBAND
+    };
+
     INDI::PropertyNumber impCount {1};
     INDI::PropertyNumber speed {2};
     INDI::PropertyNumber impToNorthOffset {1};
@@ -45,11 +210,5 @@ private:
         SPEED_R,
         SPEED_L
     };
-    double nextRightImpAz;
-    double nextLeftImpAz;
-    long lastMeassurements;
-    bool prevImpState;
-    double targetedAz;
-    bool moveToTarget;
     bool shallPark;
 };
@@ -0,0 +1,185 @@
+// converts a flight recording of the driver to CSV or to VCD for a waveform viewer like GTKWave
+// the times are µs since the first record, the ticks are unwrapped and the records sorted by them since the edges
+// are recorded when the control loop handles them, a little after they happened; the driver's runs in one recording
+// follow each other by the wall clock of their markers
+// in the VCD the GPIOs show their levels like pig2vcd does, by the wiring in the recording, which a comment passes on
+// to nepo_dome_replay
+
+#include "dome_pins.h"
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct TimedRecord {
+    uint64_t time;
+    FlightRecord record;
+};
+
+static const char *TYPE_NAMES[] = {"edge", "relays", "estimate", "command", "events", "marker"};
+static const char *COMMAND_NAMES[] = {"move_to", "move", "open_shutter", "close_shutter", "stop_shutter", "start_calibration",
+                                      "verify_calibration", "abort_calibration"};
+static const char *DIRECTION_NAMES[] = {"right", "left", "none"};
+
+static std::vector<TimedRecord> unwrap(const std::vector<FlightRecord> &records) {
+    std::vector<uint64_t> times = unwrapFlightTicks(records);
+    std::vector<TimedRecord> timed;
+    timed.reserve(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        timed.push_back({times[i], records[i]});
+    }
+    std::stable_sort(timed.begin(), timed.end(), [](const TimedRecord &a, const TimedRecord &b) { return a.time < b.time; });
+    return timed;
+}
+
+static const char *pinName(const DomePinMap &pins, unsigned gpio) {
+    int signal = pins.signal(gpio);
+    return signal >= 0 ? DOME_SIGNAL_NAMES[signal] : "?";
+}
+
+static const char *name(const char *const *names, size_t count, unsigned index) {
+    return index < count ? names[index] : "?";
+}
+
+static void dumpCsv(const std::vector<TimedRecord> &records, const DomePinMap &pins, FILE *fp) {
+    fprintf(fp, "time_us,tick,type,arg,a,b\n");
+    for (const TimedRecord &t : records) {
+        const FlightRecord &r = t.record;
+        fprintf(fp, "%llu,%u,%s,", static_cast<unsigned long long>(t.time), r.tick, name(TYPE_NAMES, 6, r.type));
+        switch (r.type) {
+        case FlightRecord::EDGE:
+            fprintf(fp, "%s,%u,\n", pinName(pins, r.arg), r.a.bits);
+            break;
+        case FlightRecord::RELAYS:
+            fprintf(fp, "%s,0x%08x,\n", r.arg == FlightRecord::RELAYS_BY_ALERT ? "alert" : "loop", r.a.bits);
+            break;
+        case FlightRecord::ESTIMATE:
+            fprintf(fp, "%s,%.4f,%.4f\n", name(DIRECTION_NAMES, 3, r.arg), r.a.value, r.b.value);
+            break;
+        case FlightRecord::COMMAND:
+            if (r.arg == FlightRecord::MOVE) {
+                fprintf(fp, "%s,%s,\n", COMMAND_NAMES[r.arg], name(DIRECTION_NAMES, 3, r.a.bits));
+            } else if (r.arg == FlightRecord::MOVE_TO || r.arg == FlightRecord::VERIFY_CALIBRATION) {
+                fprintf(fp, "%s,%.4f,\n", COMMAND_NAMES[r.arg], r.a.value);
+            } else {
+                fprintf(fp, "%s,,\n", name(COMMAND_NAMES, 8, r.arg));
+            }
+            break;
+        case FlightRecord::EVENTS:
+            fprintf(fp, ",0x%04x,\n", r.a.bits);
+            break;
+        case FlightRecord::MARKER:
+            // b: CLOCK_REALTIME in µs
+            fprintf(fp, "%s,,%llu\n", r.arg == FlightRecord::MARKER_OPENED ? "opened" : "periodic",
+                    static_cast<unsigned long long>((static_cast<uint64_t>(r.b.bits) << 32) | r.a.bits));
+            break;
+        default:
+            fprintf(fp, "%u,0x%08x,0x%08x\n", r.arg, r.a.bits, r.b.bits);
+        }
+    }
+}
+
+static void dumpVcd(const std::vector<TimedRecord> &records, const DomePinMap &pins, FILE *fp) {
+    // one wire per signal, identified by '!' + its DomeSignal, and the estimate as reals
+    fprintf(fp, "$comment nepo_dome wiring %s $end\n", pins.toText().c_str());
+    fprintf(fp, "$timescale 1 us $end\n$scope module nepo_dome $end\n");
+    for (int i = 0; i < SIGNAL_COUNT; i++) {
+        std::string wire = DOME_SIGNAL_NAMES[i];
+        std::replace(wire.begin(), wire.end(), ' ', '_');
+        fprintf(fp, "$var wire 1 %c %s $end\n", '!' + i, wire.c_str());
+    }
+    fprintf(fp, "$var real 64 A azimuth $end\n$var real 64 B uncertainty $end\n$var real 64 C target $end\n");
+    fprintf(fp, "$upscope $end\n$enddefinitions $end\n");
+
+    uint64_t written = UINT64_MAX;
+    auto at = [&](uint64_t time) {
+        if (time != written) {
+            fprintf(fp, "#%llu\n", static_cast<unsigned long long>(time));
+            written = time;
+        }
+    };
+    fprintf(fp, "#0\n$dumpvars\n");
+    written = 0;
+    for (int i = 0; i < SIGNAL_COUNT; i++) {
+        fprintf(fp, "x%c\n", '!' + i);
+    }
+    fprintf(fp, "$end\n");
+    for (const TimedRecord &t : records) {
+        const FlightRecord &r = t.record;
+        switch (r.type) {
+        case FlightRecord::EDGE:
+            for (int i = FIRST_SENSOR; i <= LAST_SENSOR; i++) {
+                if (pins.gpio[i] == r.arg && r.a.bits <= 1) {
+                    at(t.time);
+                    fprintf(fp, "%u%c\n", r.a.bits, '!' + i);
+                }
+            }
+            break;
+        case FlightRecord::RELAYS:
+            at(t.time);
+            for (int i = FIRST_RELAY; i <= LAST_RELAY; i++) {
+                fprintf(fp, "%u%c\n", pins.level(i, r.a.bits & pins.mask(i)), '!' + i);
+            }
+            break;
+        case FlightRecord::ESTIMATE:
+            at(t.time);
+            fprintf(fp, "r%.4f A\nr%.4f B\n", r.a.value, r.b.value);
+            break;
+        case FlightRecord::COMMAND:
+            if (r.arg == FlightRecord::MOVE_TO) {
+                at(t.time);
+                fprintf(fp, "r%.4f C\n", r.a.value);
+            }
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bool vcd = false;
+    const char *path = nullptr;
+    const char *output = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--vcd")) {
+            vcd = true;
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [--vcd] [-o file] recording\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<FlightRecord> records;
+    DomePinMap pins;
+    std::string error;
+    if (!readFlightRecording(path, records, pins, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    FILE *fp = output ? fopen(output, "w") : stdout;
+    if (!fp) {
+        perror(output);
+        return 1;
+    }
+    std::vector<TimedRecord> timed = unwrap(records);
+    if (vcd) {
+        dumpVcd(timed, pins, fp);
+    } else {
+        dumpCsv(timed, pins, fp);
+    }
+    if (output) {
+        fclose(fp);
+    }
+    fprintf(stderr, "%zu records\n", records.size());
+    return 0;
+}
@@ -0,0 +1,336 @@
+// a stand-in for pigpiod on the dome's Raspberry Pi, backed by the simulated dome, to run the driver's remote mode
+// without a Pi:
+//   nepo_dome_fake_pigpiod --rtt 5 &
+//   NEPO_DOME_PIGPIOD=localhost:8888 indiserver nepo_dome
+// it speaks the pigpiod socket protocol for the commands pigpiod_if2 and PigpiodBackend use, others are answered with
+// PI_UNKNOWN_COMMAND; the dome uses the default wiring and runs in real time
+// --rtt emulates the network: a command takes effect half of it after it was sent, its answer and the notifications
+// arrive half of it after they were sent
+// at the end it prints how fast the relays reacted to the sensors: from a sensor edge or watchdog timeout to the next
+// relay released, the control latency as seen from the dome
+
+#include "bench_stats.h"
+#include "dome_pins.h"
+#include "simulated_dome.h"
+
+#include <pigpio/pigpio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// a command and its answer on the socket, the answer has the result in res
+struct PigpiodCommand {
+    uint32_t cmd;
+    uint32_t p1;
+    uint32_t p2;
+    uint32_t res;
+};
+
+// what pigpiod sends on a notification socket, see gpioReport_t
+struct Report {
+    uint16_t seqno;
+    uint16_t flags;
+    uint32_t tick;
+    uint32_t level;
+};
+
+#define FAKE_PIGPIOD_REACTION_MS 100    // longest time from a sensor to a relay release counted as its reaction
+
+// items that take effect at their time, in the order they were pushed
+template <typename T>
+class DelayLine
+{
+public:
+    void push(const T &item, Clock::time_point due) {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back({due, item});
+        changed.notify_one();
+    }
+
+    // waits until the first item is due, false once closed
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            if (closed) {
+                return false;
+            }
+            if (items.empty()) {
+                changed.wait(lock);
+            } else if (Clock::now() < items.front().due) {
+                changed.wait_until(lock, items.front().due);
+            } else {
+                item = items.front().item;
+                items.pop_front();
+                return true;
+            }
+        }
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        changed.notify_all();
+    }
+
+private:
+    struct Entry {
+        Clock::time_point due;
+        T item;
+    };
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Entry> items;
+    bool closed = false;
+};
+
+// one client socket: a reader takes the commands in, a worker executes them when they are due, a writer sends the
+// answers and reports when they are due
+struct Connection {
+    int fd;
+    DelayLine<PigpiodCommand> commands;
+    DelayLine<std::string> out;
+    // the notification handle once the socket sent NOIB, and the GPIOs it reports
+    int handle = -1;
+    uint32_t bits = 0;
+    uint16_t seqno = 0;
+};
+
+static SimulatedDome *dome;
+static DomePinMap pins;
+static Clock::duration halfRtt;
+
+static std::mutex connectionsMutex;
+static std::vector<std::shared_ptr<Connection>> connections;
+static int nextHandle = 0;
+
+// the last sensor edge or watchdog timeout and whether a relay release followed it already
+static std::mutex reactionMutex;
+static Clock::time_point lastSensor;
+static bool reacted = true;
+static Stats reactions;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void onSignal(int) {
+    stopping = 1;
+}
+
+static void send(Connection &connection, const void *data, size_t size) {
+    connection.out.push(std::string(static_cast<const char *>(data), size), Clock::now() + halfRtt);
+}
+
+// called by the simulated dome, with its lock held, for the sensor edges and the watchdog timeouts
+static void onAlert(int gpio, int level, uint32_t tick, void *) {
+    {
+        std::lock_guard<std::mutex> lock(reactionMutex);
+        lastSensor = Clock::now();
+        reacted = false;
+    }
+    Report report = {0, static_cast<uint16_t>(level == PI_TIMEOUT ? PI_NTFY_FLAGS_WDOG | gpio : 0), tick, dome->readBits()};
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    for (const std::shared_ptr<Connection> &connection : connections) {
+        if (connection->handle >= 0 && (connection->bits & (1u << gpio))) {
+            report.seqno = connection->seqno++;
+            send(*connection, &report, sizeof(report));
+        }
+    }
+}
+
+static void noteRelays(uint32_t before) {
+    uint32_t released = pins.active(before) & ~pins.active(dome->readBits()) & pins.relays();
+    if (!released) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(reactionMutex);
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - lastSensor).count();
+    if (!reacted && ms < FAKE_PIGPIOD_REACTION_MS) {
+        reactions.add(ms);
+    }
+    reacted = true;
+}
+
+static std::shared_ptr<Connection> findHandle(uint32_t handle) {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    for (const std::shared_ptr<Connection> &connection : connections) {
+        if (connection->handle >= 0 && static_cast<uint32_t>(connection->handle) == handle) {
+            return connection;
+        }
+    }
+    return nullptr;
+}
+
+static int execute(Connection &connection, const PigpiodCommand &cmd) {
+    uint32_t before = dome->readBits();
+    int res;
+    switch (cmd.cmd) {
+    case PI_CMD_MODES:
+        return dome->setMode(cmd.p1, cmd.p2);
+    case PI_CMD_PUD:
+        return dome->setPullUpDown(cmd.p1, cmd.p2);
+    case PI_CMD_READ:
+        return dome->read(cmd.p1);
+    case PI_CMD_WRITE:
+        res = dome->write(cmd.p1, cmd.p2);
+        noteRelays(before);
+        return res;
+    case PI_CMD_WDOG:
+        return dome->setWatchdog(cmd.p1, cmd.p2);
+    case PI_CMD_BR1:
+        return static_cast<int>(dome->readBits());
+    case PI_CMD_BC1:
+        res = dome->writeBitsClear(cmd.p1);
+        noteRelays(before);
+        return res;
+    case PI_CMD_BS1:
+        res = dome->writeBitsSet(cmd.p1);
+        noteRelays(before);
+        return res;
+    case PI_CMD_TICK:
+        return static_cast<int>(dome->tick());
+    case PI_CMD_NOIB: {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connection.handle = nextHandle++;
+        return connection.handle;
+    }
+    case PI_CMD_NB:
+    case PI_CMD_NC: {
+        std::shared_ptr<Connection> notified = findHandle(cmd.p1);
+        if (!notified) {
+            return PI_BAD_HANDLE;
+        }
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        notified->bits = cmd.cmd == PI_CMD_NB ? cmd.p2 : 0;
+        return 0;
+    }
+    default:
+        return PI_UNKNOWN_COMMAND;
+    }
+}
+
+static void serve(std::shared_ptr<Connection> connection) {
+    std::thread worker([connection] {
+        PigpiodCommand cmd;
+        while (connection->commands.pop(cmd)) {
+            cmd.res = static_cast<uint32_t>(execute(*connection, cmd));
+            send(*connection, &cmd, sizeof(cmd));
+        }
+    });
+    std::thread writer([connection] {
+        std::string data;
+        while (connection->out.pop(data)) {
+            if (::send(connection->fd, data.data(), data.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(data.size())) {
+                break;
+            }
+        }
+    });
+
+    PigpiodCommand cmd;
+    while (recv(connection->fd, &cmd, sizeof(cmd), MSG_WAITALL) == sizeof(cmd)) {
+        connection->commands.push(cmd, Clock::now() + halfRtt);
+    }
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connections.erase(std::find(connections.begin(), connections.end(), connection));
+    }
+    connection->commands.close();
+    connection->out.close();
+    worker.join();
+    writer.join();
+    close(connection->fd);
+}
+
+int main(int argc, char *argv[]) {
+    int port = 8888;
+    double rttMs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--rtt") && i + 1 < argc) {
+            rttMs = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--port n] [--rtt ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    halfRtt = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(rttMs / 2));
+
+    int listener = socket(AF_INET6, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in6 address = {};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(port);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 8) != 0) {
+        perror("Listening failed");
+        return 1;
+    }
+
+    dome = new SimulatedDome(SimulatedDome::defaultConfig(pins));
+    for (int i = FIRST_SENSOR; i <= LAST_SENSOR; i++) {
+        dome->setAlertFunc(pins.gpio[i], onAlert, nullptr);
+    }
+    dome->start(1);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    printf("Serving the simulated dome on port %d with a round trip of %g ms\n", port, rttMs);
+    fflush(stdout);
+
+    while (!stopping) {
+        pollfd waiting = {listener, POLLIN, 0};
+        if (poll(&waiting, 1, 200) <= 0) {
+            continue;
+        }
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+        connection->fd = fd;
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            connections.push_back(connection);
+        }
+        std::thread(serve, connection).detach();
+    }
+
+    close(listener);
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        for (const std::shared_ptr<Connection> &connection : connections) {
+            shutdown(connection->fd, SHUT_RDWR);
+        }
+    }
+    // the clients are gone once their connections are
+    for (int i = 0; i < 50; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        if (connections.empty()) {
+            break;
+        }
+    }
+    std::lock_guard<std::mutex> lock(reactionMutex);
+    reactions.print("sensor to relay release", "ms");
+    printf("azimuth %.2f°, shutter %.0f %%, relay conflicts: %u\n", dome->getAzimuth(), dome->getShutter() * 100,
+           dome->getRelayConflicts());
+    return 0;
+}
@@ -0,0 +1,69 @@
+// prints the live state the driver shares with the local processes, once or with --follow on every update
+// an example of the reader in live_state.h
+
+#include "live_state.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <time.h>
+
+static const char *ROTATION_NAMES[] = {"right", "left", "none"};
+static const char *SHUTTER_NAMES[] = {"open", "opening", "stopped", "closing", "closed"};
+
+static void print(const LiveDomeState &state) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double age = (now.tv_sec * 1000000000LL + now.tv_nsec - state.monotonicNs) / 1e6;
+    printf("#%llu %8.1f ms ago: azimuth %7.3f° ±%.3f° %+7.3f°/s %-5s target %7.3f° shutter %-7s %3.0f %%%s%s%s%s\n",
+           static_cast<unsigned long long>(state.updates), age, state.azimuth, state.uncertainty, state.velocity,
+           state.rotation < 3 ? ROTATION_NAMES[state.rotation] : "?", state.target,
+           state.shutter < 5 ? SHUTTER_NAMES[state.shutter] : "?", state.shutterPosition * 100,
+           state.flags & LiveDomeState::MOVING_TO_TARGET ? " moving" : "", state.flags & LiveDomeState::CALIBRATING ? " calibrating" : "",
+           state.flags & LiveDomeState::ROTATION_STALLED ? " rotation stalled" : "",
+           state.flags & LiveDomeState::SHUTTER_STALLED ? " shutter stalled" : "");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    bool follow = false;
+    std::string name = liveStateName("Nepo Dome Driver");
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--follow")) {
+            follow = true;
+        } else if (!strcmp(argv[i], "--segment") && i + 1 < argc) {
+            name = argv[++i];
+        } else if (argv[i][0] != '-') {
+            name = liveStateName(argv[i]);
+        } else {
+            fprintf(stderr, "usage: %s [--follow] [device | --segment name]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    LiveStateReader reader;
+    std::string error;
+    if (!reader.open(name, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    LiveDomeState state;
+    uint64_t printed = 0;
+    do {
+        if (!reader.read(state)) {
+            fprintf(stderr, "%s stays in the middle of a write\n", name.c_str());
+            return 1;
+        }
+        if (state.updates != printed) {
+            print(state);
+            printed = state.updates;
+        }
+        if (follow) {
+            // reading costs no syscall, polling faster than the control loop's 10 ms only finds the same state
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    } while (follow);
+    return 0;
+}
@@ -0,0 +1,329 @@
+// replays a recorded session through the controller's position and target logic in virtual time
+// the trace is a flight recording of the driver or a VCD of pig2vcd or nepo_dome_dump --vcd, it is replayed open loop:
+// the sensor edges are the recorded ones whatever the replayed controller switches, so it tells how its estimator and
+// stops would have done on the recorded motion
+// the track of the dome is its position at the encoder edges, interpolated in time, and measured against it are
+// - azimuth error: the dead reckoning of every cycle while the motor runs
+// - overshoot: where the dome would have halted beyond the target, the track at the release of the motor plus the coast
+//   from its speed there
+// - stop latency: how late the motor was released after the track passed the stop point, the target less the coast
+// a stop after the recorded motor was already off or during a reversal can't be measured on the track, it is only counted
+
+#include "bench_stats.h"
+#include "calibration_cache.h"
+#include "dome_controller.h"
+#include "dome_pins.h"
+#include "flight_recorder.h"
+#include "trace_replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// longest time between two edges of the same motion in µs, a longer one is a halt
+#define TRACK_GAP_US 2000000
+// an edge gives the position only after the tooth table placed it this well in °
+#define TRACK_SIGMA 0.5
+// time the replay runs on after the end of the trace in µs, for the last stop
+#define REPLAY_SETTLE_US 5000000
+
+struct TrackPoint {
+    uint64_t time;
+    double azimuth;
+};
+
+// the position at time from the edges around it
+static bool trackAt(const std::vector<TrackPoint> &track, uint64_t time, double &azimuth) {
+    auto after = std::upper_bound(track.begin(), track.end(), time, [](uint64_t t, const TrackPoint &p) { return t < p.time; });
+    if (after == track.begin() || after == track.end() || after->time - (after - 1)->time > TRACK_GAP_US) {
+        return false;
+    }
+    auto before = after - 1;
+    azimuth = before->azimuth + std::remainder(after->azimuth - before->azimuth, 360.0) * (time - before->time) / (after->time - before->time);
+    return true;
+}
+
+// the position at time going on at the speed between the last two edges before it, while the motor still runs the
+// edges after time are already coasting
+// the next edge mustn't have been due yet, else the dome had slowed down
+static bool trackAhead(const std::vector<TrackPoint> &track, uint64_t time, double &azimuth, double &velocity) {
+    auto after = std::upper_bound(track.begin(), track.end(), time, [](uint64_t t, const TrackPoint &p) { return t < p.time; });
+    if (after - track.begin() < 2) {
+        return false;
+    }
+    auto before = after - 1;
+    auto earlier = before - 1;
+    uint64_t dt = before->time - earlier->time;
+    if (dt > TRACK_GAP_US || time - before->time > dt + dt / 2) {
+        return false;
+    }
+    velocity = std::remainder(before->azimuth - earlier->azimuth, 360.0) / dt;
+    azimuth = before->azimuth + velocity * (time - before->time);
+    return true;
+}
+
+// whether the recorded motor was on at time
+static bool recordedMotorOn(const Trace &trace, uint64_t time) {
+    auto after = std::upper_bound(trace.relays.begin(), trace.relays.end(), time, [](uint64_t t, const Trace::Relays &r) { return t < r.time; });
+    return after != trace.relays.begin() && ((after - 1)->on & trace.pins.rotationRelays()) != 0;
+}
+
+static bool endsWith(const std::string &s, const char *suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *calibrationPath = nullptr;
+    double azimuth = NAN;
+    uint32_t periodMs = 10;
+    const char *recording = nullptr;
+    const char *wiring = nullptr;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--calibration") && i + 1 < argc) {
+            calibrationPath = argv[++i];
+        } else if (!strcmp(argv[i], "--azimuth") && i + 1 < argc) {
+            azimuth = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--period-ms") && i + 1 < argc) {
+            periodMs = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            recording = argv[++i];
+        } else if (!strcmp(argv[i], "--wiring") && i + 1 < argc) {
+            wiring = argv[++i];
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [--calibration cache] [--azimuth °] [--period-ms ms] [--record file] [--wiring recording] trace\n",
+                argv[0]);
+        return 1;
+    }
+
+    // a pig2vcd trace has no wiring, it is the default one or the one of a flight recording of the same dome
+    DomePinMap pins;
+    std::string error;
+    if (wiring) {
+        std::vector<FlightRecord> records;
+        if (!readFlightRecording(wiring, records, pins, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+    }
+    Trace trace;
+    bool vcd = endsWith(path, ".vcd");
+    if (!(vcd ? loadVcdTrace(path, pins, trace, error) : loadFlightTrace(path, trace, error))) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    CalibrationCache cache;
+    if (calibrationPath && !loadCalibrationCache(calibrationPath, cache, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    bool verifies = std::any_of(trace.commands.begin(), trace.commands.end(),
+                                [](const Trace::Command &c) { return c.command == FlightRecord::VERIFY_CALIBRATION; });
+    if ((vcd || verifies) && !calibrationPath) {
+        fprintf(stderr, "%s uses a cached calibration, it needs --calibration\n", path);
+        return 1;
+    }
+    // without a calibration in the trace the dome starts where the cache or --azimuth says
+    if (vcd && std::isnan(azimuth)) {
+        azimuth = cache.azimuth;
+    }
+
+    ReplayBackend backend(trace);
+    DomeController controller(backend, trace.pins);
+    if (!controller.init(error) || !controller.startEdgeAlerts(error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    // the replayed controller records into a file of its own, the measurements are taken from it
+    char temporary[] = "/tmp/nepo_dome_replay_XXXXXX";
+    if (!recording) {
+        int fd = mkstemp(temporary);
+        if (fd < 0) {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+    }
+    std::string recordPath = recording ? recording : temporary;
+    uint64_t moving = 0;
+    const Trace::Edge *lastRot = nullptr;
+    for (const Trace::Edge &edge : trace.edges) {
+        if (edge.gpio == trace.pins.gpio[SIGNAL_ROT]) {
+            if (lastRot && edge.time - lastRot->time <= TRACK_GAP_US) {
+                moving += edge.time - lastRot->time;
+            }
+            lastRot = &edge;
+        }
+    }
+    uint64_t capacity = 2 * (trace.edges.size() + trace.relays.size() + trace.commands.size() + moving / (periodMs * 1000)) + (1u << 16);
+    if (!controller.getRecorder().open(recordPath, static_cast<uint32_t>(std::min<uint64_t>(capacity, 1u << 31)), trace.pins, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    if (!std::isnan(azimuth)) {
+        controller.setCalibration(cache.calibration);
+        controller.setDeceleration(DomeController::RotDirection::RIGHT, cache.deceleration[DomeController::SPEED_R]);
+        controller.setDeceleration(DomeController::RotDirection::LEFT, cache.deceleration[DomeController::SPEED_L]);
+        controller.assumeAzimuth(azimuth);
+    }
+
+    // the commands are carried out at the first cycle after them, like the control thread does
+    auto started = std::chrono::steady_clock::now();
+    uint64_t periodUs = periodMs * 1000ull;
+    size_t next = 0;
+    for (uint64_t time = 0; time <= trace.duration + REPLAY_SETTLE_US; time += periodUs) {
+        backend.advance(time);
+        for (; next < trace.commands.size() && trace.commands[next].time <= time; next++) {
+            const Trace::Command &c = trace.commands[next];
+            switch (c.command) {
+            case FlightRecord::MOVE_TO:
+                controller.moveTo(c.a);
+                break;
+            case FlightRecord::MOVE:
+                controller.move(static_cast<DomeController::RotDirection>(static_cast<int>(c.a)));
+                break;
+            case FlightRecord::OPEN_SHUTTER:
+                controller.openShutter();
+                break;
+            case FlightRecord::CLOSE_SHUTTER:
+                controller.closeShutter();
+                break;
+            case FlightRecord::STOP_SHUTTER:
+                controller.stopShutter();
+                break;
+            case FlightRecord::START_CALIBRATION:
+                controller.startCalibration();
+                break;
+            case FlightRecord::VERIFY_CALIBRATION:
+                controller.verifyCalibration(cache.calibration, c.a);
+                controller.setDeceleration(DomeController::RotDirection::RIGHT, cache.deceleration[DomeController::SPEED_R]);
+                controller.setDeceleration(DomeController::RotDirection::LEFT, cache.deceleration[DomeController::SPEED_L]);
+                break;
+            case FlightRecord::ABORT_CALIBRATION:
+                controller.abortCalibration();
+                break;
+            }
+        }
+        controller.update();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double decelerations[2] = {controller.getDeceleration(DomeController::RotDirection::RIGHT),
+                               controller.getDeceleration(DomeController::RotDirection::LEFT)};
+    controller.getRecorder().close();
+
+    std::vector<FlightRecord> records;
+    bool read = readFlightRecording(recordPath, records, pins, error);
+    if (!recording) {
+        unlink(temporary);
+    }
+    if (!read) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    // the replay's ticks continue the trace's
+    std::vector<uint64_t> times = unwrapFlightTicks(records);
+    int64_t offset = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        if (times[i] == 0) {
+            offset = static_cast<int32_t>(records[i].tick - trace.startTick);
+        }
+    }
+
+    // the track from the edges the tooth table placed, outside of a calibration
+    std::vector<TrackPoint> track;
+    std::vector<TrackPoint> estimates;
+    bool calibrating = false;
+    for (size_t i = 0; i < records.size(); i++) {
+        const FlightRecord &r = records[i];
+        uint64_t time = times[i] + offset;
+        if (r.type == FlightRecord::COMMAND) {
+            calibrating |= r.arg == FlightRecord::START_CALIBRATION || r.arg == FlightRecord::VERIFY_CALIBRATION;
+            calibrating &= r.arg != FlightRecord::ABORT_CALIBRATION;
+        } else if (r.type == FlightRecord::EVENTS) {
+            calibrating &= !(r.a.bits & (DomeController::Event::CALIBRATION_FINISHED | DomeController::Event::CALIBRATION_FAILED
+                                         | DomeController::Event::CALIBRATION_VERIFIED | DomeController::Event::CALIBRATION_DRIFTED));
+        } else if (r.type == FlightRecord::ESTIMATE && !calibrating) {
+            const FlightRecord *edge = i > 0 ? &records[i - 1] : nullptr;
+            if (edge && edge->type == FlightRecord::EDGE && edge->tick == r.tick) {
+                if (edge->arg == trace.pins.gpio[SIGNAL_ROT] && r.b.value < TRACK_SIGMA) {
+                    track.push_back({time, r.a.value});
+                }
+            } else if (r.arg != DomeController::RotDirection::NONE) {
+                estimates.push_back({time, r.a.value});
+            }
+        }
+    }
+    std::stable_sort(track.begin(), track.end(), [](const TrackPoint &a, const TrackPoint &b) { return a.time < b.time; });
+
+    Stats azimuthError;
+    for (const TrackPoint &e : estimates) {
+        double az;
+        if (trackAt(track, e.time, az)) {
+            azimuthError.add(std::fabs(std::remainder(e.azimuth - az, 360.0)));
+        }
+    }
+
+    // the stops of slews: the motor released while moving to a target
+    Stats overshoot;
+    Stats stopLatency;
+    int stops = 0;
+    int unmeasured = 0;
+    bool toTarget = false;
+    double target = 0;
+    uint32_t rotation = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        const FlightRecord &r = records[i];
+        uint64_t time = times[i] + offset;
+        if (r.type == FlightRecord::COMMAND && r.arg == FlightRecord::MOVE_TO) {
+            toTarget = true;
+            target = r.a.value;
+        } else if (r.type == FlightRecord::COMMAND && r.arg != FlightRecord::MOVE_TO) {
+            toTarget &= r.arg == FlightRecord::OPEN_SHUTTER || r.arg == FlightRecord::CLOSE_SHUTTER || r.arg == FlightRecord::STOP_SHUTTER;
+        } else if (r.type == FlightRecord::RELAYS) {
+            uint32_t now = r.a.bits & trace.pins.rotationRelays();
+            if (toTarget && rotation && !now) {
+                toTarget = false;
+                stops++;
+                double az, velocity;
+                double sign = rotation & trace.pins.mask(SIGNAL_R) ? 1 : -1;
+                double deceleration = decelerations[rotation & trace.pins.mask(SIGNAL_R) ? 0 : 1];
+                // a track turning the other way or standing passes a reversal
+                if (time < periodUs || !recordedMotorOn(trace, time - periodUs) || !trackAhead(track, time, az, velocity)
+                    || sign * velocity <= 0 || deceleration <= 0) {
+                    unmeasured++;
+                } else {
+                    // the dome coasts from the speed it had, a short slew doesn't reach the full one
+                    double speed = std::fabs(velocity) * 1e6;
+                    double beyond = sign * std::remainder(az + sign * speed * speed / (2 * deceleration) - target, 360.0);
+                    overshoot.add(beyond);
+                    stopLatency.add(beyond / speed * 1000);
+                }
+            }
+            rotation = now;
+        }
+    }
+
+    double duration = trace.duration / 1e6;
+    printf("%s: %.1f s, %zu edges, %zu commands, replayed in %.2f s (%.0fx real time) with a %u ms loop\n", path, duration,
+           trace.edges.size(), trace.commands.size(), wall, duration / wall, periodMs);
+    printf("track: %zu edges, learned deceleration right %.2f°/s², left %.2f°/s²\n", track.size(), decelerations[0], decelerations[1]);
+    azimuthError.print("azimuth error while moving", "°");
+    overshoot.print("overshoot", "°");
+    stopLatency.print("stop latency", "ms");
+    printf("%d stops at a target, %d not measured on the track\n", stops, unmeasured);
+    return 0;
+}
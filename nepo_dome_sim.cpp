@@ -0,0 +1,586 @@
+// runs the dome controller against the simulated dome in virtual time
+// calibration, slews and a park cycle are run as fast as possible and positioning error and loop latency are reported
+// it is the CI test as well: the run fails with exit code 1 when a result leaves its bound below, the bounds leave a
+// margin to what the default run shows; the speed counts the virtual time of all the runs' domes
+
+#include "angles.h"
+#include "bench_stats.h"
+#include "calibration_cache.h"
+#include "dome_controller.h"
+#include "follow_scheduler.h"
+#include "simulated_dome.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#define SIM_CALIBRATION_SPEED_ERROR 0.01  // largest relative error of a calibrated speed
+#define SIM_CALIBRATION_OFFSET_ERROR 0.1  // ° largest error of the calibrated offset of north
+#define SIM_TARGET_ERROR_MEAN 0.25        // ° mean distance of a halted dome from its target, once it learned to stop
+#define SIM_POSITION_ERROR_MAX 3.0        // ° largest distance of a halted dome from its target or its estimate
+#define SIM_STALL_DETECTION_S 3.0         // s from a jam to the stopped motor
+#define SIM_LATENCY_P99_US 50.0           // µs p99 of the control loop and of a relay command, in real time
+#define SIM_MIN_SPEEDUP 100.0             // virtual time per real time
+
+static int failures = 0;
+
+// a bound of the CI run, reported when it isn't met
+static void expect(bool met, const char *format, ...) {
+    if (met) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    printf("FAILED: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    failures++;
+}
+
+// the virtual time of the runs that ended
+static uint64_t simulatedUs = 0;
+
+class Bench
+{
+public:
+    Bench(const SimulatedDome::Config &config, uint32_t periodUs) : dome(config), controller(dome), periodUs(periodUs) {
+    }
+    ~Bench() {
+        simulatedUs += dome.getTime();
+    }
+
+    bool init() {
+        std::string error;
+        if (!controller.init(error) || !controller.startEdgeAlerts(error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // one control loop period
+    unsigned cycle() {
+        dome.advance(periodUs);
+        auto started = std::chrono::steady_clock::now();
+        unsigned events = controller.update();
+        loopLatency.add(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count());
+        if (!controller.isCalibrating() && controller.getRotation() != DomeController::RotDirection::NONE) {
+            movingError.add(std::fabs(angleDiff(controller.getAzimuth(), dome.getAzimuth())));
+            movingUncertainty.add(controller.getAzimuthUncertainty());
+        }
+        return events;
+    }
+
+    // running the loop until one of the events happened, false on timeout
+    bool runUntil(unsigned events, double timeoutS) {
+        uint64_t until = dome.getTime() + static_cast<uint64_t>(timeoutS * 1e6);
+        while (dome.getTime() < until) {
+            if (cycle() & events) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // letting the dome coast to a halt
+    void settle() {
+        while (std::fabs(dome.getVelocity()) > 0) {
+            cycle();
+        }
+        cycle();
+    }
+
+    SimulatedDome dome;
+    DomeController controller;
+    uint32_t periodUs;
+    Stats loopLatency;
+    Stats movingError;
+    Stats movingUncertainty;
+};
+
+// restarting with a cached calibration while the dome really is at trueAz
+// true once verified
+static bool warmStart(SimulatedDome::Config config, const CalibrationCache &cache, double trueAz, uint32_t periodUs) {
+    config.azimuth = trueAz;
+    Bench bench(config, periodUs);
+    if (!bench.init()) {
+        return false;
+    }
+    bench.controller.verifyCalibration(cache.calibration, cache.azimuth);
+    bench.controller.setDeceleration(DomeController::RotDirection::RIGHT, cache.deceleration[DomeController::SPEED_R]);
+    bench.controller.setDeceleration(DomeController::RotDirection::LEFT, cache.deceleration[DomeController::SPEED_L]);
+    unsigned events = 0;
+    while (bench.controller.isCalibrating() && bench.dome.getTime() < 600000000) {
+        events |= bench.cycle();
+    }
+    printf("warm start from %7.3f° (cached %7.3f°): %s after %.1f s, drift %.3f°\n", trueAz, cache.azimuth,
+           events & DomeController::Event::CALIBRATION_VERIFIED ? "verified" : "drifted ", bench.dome.getTime() / 1e6,
+           bench.controller.getCalibrationDrift());
+    return events & DomeController::Event::CALIBRATION_VERIFIED;
+}
+
+// azimuth of a star at 50° latitude and 30° declination, hours from its meridian transit
+static double starAzimuth(double hours) {
+    const double deg = M_PI / 180;
+    double h = hours * 15 * deg;
+    double lat = 50 * deg;
+    double dec = 30 * deg;
+    double az = std::atan2(std::sin(h), std::cos(h) * std::sin(lat) - std::tan(dec) * std::cos(lat)) / deg + 180;
+    return std::fmod(az + 360, 360);
+}
+
+// following a tracking mount through its meridian transit, the mount reports its position every second
+// the naive way moves the dome whenever it is more than threshold off, like INDI's autosync does
+static void follow(SimulatedDome::Config config, const DomeController::Calibration &calibration, double minutes, bool scheduled,
+                   uint32_t periodUs) {
+    const double threshold = 1.0;
+    double startHours = -minutes / 120;
+    config.azimuth = starAzimuth(startHours);
+    Bench bench(config, periodUs);
+    if (!bench.init()) {
+        return;
+    }
+    bench.controller.verifyCalibration(calibration, config.azimuth);
+    while (bench.controller.isCalibrating()) {
+        bench.cycle();
+    }
+    // acquiring the star isn't part of following it
+    bench.controller.moveTo(config.azimuth);
+    bench.runUntil(DomeController::Event::TARGET_REACHED, 600);
+    bench.settle();
+
+    FollowScheduler scheduler;
+    double speed = std::min(calibration.speed[DomeController::SPEED_R], calibration.speed[DomeController::SPEED_L]) * 1000;
+    double tolerance = scheduler.getConfig().tolerance;
+    uint64_t start = bench.dome.getTime();
+    uint64_t nextReport = start;
+    int moves = 0;
+    int starts = 0;
+    uint64_t clipped = 0;
+    double maxOffset = 0;
+    DomeController::RotDirection lastRotation = DomeController::RotDirection::NONE;
+    while (bench.dome.getTime() - start < minutes * 60e6) {
+        double t = (bench.dome.getTime() - start) / 1e6;
+        double required = starAzimuth(startHours + t / 3600);
+        if (bench.dome.getTime() >= nextReport) {
+            nextReport += 1000000;
+            if (scheduled) {
+                scheduler.request(required, t);
+            } else if (!bench.controller.isMovingToTarget() && std::fabs(angleDiff(required, bench.controller.getAzimuth())) > threshold) {
+                bench.controller.moveTo(required);
+                moves++;
+            }
+        }
+        double target;
+        if (scheduled && !bench.controller.isMovingToTarget() && bench.controller.isStill()
+            && scheduler.due(bench.controller.getAzimuth(), t, speed, target)) {
+            bench.controller.moveTo(target);
+            moves++;
+        }
+        bench.cycle();
+        if (bench.controller.getRotation() != DomeController::RotDirection::NONE && lastRotation == DomeController::RotDirection::NONE) {
+            starts++;
+        }
+        lastRotation = bench.controller.getRotation();
+        double offset = std::fabs(angleDiff(required, bench.dome.getAzimuth()));
+        maxOffset = std::max(maxOffset, offset);
+        if (offset > tolerance) {
+            clipped += bench.periodUs;
+        }
+    }
+    printf("follow %-9s %3.0f min: %4d moves, %4d relay starts, max offset %5.2f°, clipped %6.1f s\n", scheduled ? "scheduled" : "naive",
+           minutes, moves, starts, maxOffset, clipped / 1e6);
+}
+
+// a target sequence like a session records it: most targets are sent once the dome arrived, some while it still slews
+struct SlewCommand {
+    double target;
+    double after;   // s after the previous command, negative once the dome halted at the previous target
+};
+
+static std::vector<SlewCommand> recordTargets(unsigned seed, int count) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> targets(0, 360);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<SlewCommand> commands;
+    for (int i = 0; i < count; i++) {
+        double after = uniform(rng) < 0.3 ? 1 + 4 * uniform(rng) : -1;
+        // targets near 180° away are where the shorter way and the faster one differ
+        double target = uniform(rng) < 0.3 ? 160 + 40 * uniform(rng) : targets(rng);
+        commands.push_back({target, after});
+    }
+    return commands;
+}
+
+// running the sequence with the cost based planner or the shorter way, commands are relative to the dome's position
+static void planSlews(SimulatedDome::Config config, const CalibrationCache &cache, const std::vector<SlewCommand> &commands, bool costBased,
+                      uint32_t periodUs) {
+    config.azimuth = 0;
+    Bench bench(config, periodUs);
+    if (!bench.init()) {
+        return;
+    }
+    bench.controller.verifyCalibration(cache.calibration, 0);
+    bench.controller.setDeceleration(DomeController::RotDirection::RIGHT, cache.deceleration[DomeController::SPEED_R]);
+    bench.controller.setDeceleration(DomeController::RotDirection::LEFT, cache.deceleration[DomeController::SPEED_L]);
+    while (bench.controller.isCalibrating()) {
+        bench.cycle();
+    }
+    bench.settle();
+    SlewPlanner::Config planner;
+    planner.costBased = costBased;
+    bench.controller.setSlewPlanner(planner);
+
+    Stats slewTime;
+    Stats etaError;
+    uint64_t start = bench.dome.getTime();
+    for (size_t i = 0; i < commands.size(); i++) {
+        uint64_t sent = bench.dome.getTime();
+        bench.controller.moveTo(range360(bench.controller.getAzimuth() + commands[i].target));
+        double eta = bench.controller.getTargetEta();
+        if (i + 1 < commands.size() && commands[i + 1].after >= 0) {
+            // interrupted by the next target
+            while (bench.dome.getTime() - sent < commands[i + 1].after * 1e6) {
+                bench.cycle();
+            }
+            continue;
+        }
+        bench.runUntil(DomeController::Event::TARGET_REACHED, 600);
+        bench.settle();
+        double took = (bench.dome.getTime() - sent) / 1e6;
+        slewTime.add(took);
+        etaError.add(std::fabs(took - eta));
+    }
+    printf("planner %-10s %zu targets in %6.1f s\n", costBased ? "cost" : "shorter", commands.size(), (bench.dome.getTime() - start) / 1e6);
+    slewTime.print(costBased ? "  slew time (cost)" : "  slew time (shorter)", "s");
+    etaError.print(costBased ? "  ETA error (cost)" : "  ETA error (shorter)", "s");
+}
+
+// the dome changed since it was calibrated: the motor got slower and the encoder ring turned against north
+// without recalibrating at north only the estimator follows the speed, the offset stays
+static void drift(SimulatedDome::Config config, const CalibrationCache &cache, int slews, bool recalibrate, unsigned seed,
+                  uint32_t periodUs) {
+    config.speedRight *= 0.95;
+    config.speedLeft *= 0.95;
+    config.toothOffset += 0.5;
+    config.azimuth = 0;
+    Bench bench(config, periodUs);
+    if (!bench.init()) {
+        return;
+    }
+    bench.controller.setRecalibration(recalibrate);
+    bench.controller.verifyCalibration(cache.calibration, 0);
+    bench.controller.setDeceleration(DomeController::RotDirection::RIGHT, cache.deceleration[DomeController::SPEED_R]);
+    bench.controller.setDeceleration(DomeController::RotDirection::LEFT, cache.deceleration[DomeController::SPEED_L]);
+    while (bench.controller.isCalibrating()) {
+        bench.cycle();
+    }
+    bench.settle();
+
+    Stats estimateError;
+    int updates = 0;
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> targets(0, 360);
+    for (int i = 0; i < slews; i++) {
+        bench.controller.moveTo(targets(rng));
+        unsigned events = 0;
+        while (!(events & DomeController::Event::TARGET_REACHED) && bench.dome.getTime() < 36000e6) {
+            events = bench.cycle();
+            updates += (events & DomeController::Event::CALIBRATION_UPDATED) != 0;
+        }
+        bench.settle();
+        // the second half shows where it converged
+        if (i >= slews / 2) {
+            estimateError.add(std::fabs(angleDiff(bench.controller.getAzimuth(), bench.dome.getAzimuth())));
+        }
+    }
+    const DomeController::Calibration &calibration = bench.controller.getCalibration();
+    printf("drift %-13s %d updates: right %.5f°/ms (%.5f), left %.5f°/ms (%.5f), offset %.3f° (%.3f)\n",
+           recalibrate ? "recalibrated" : "fixed", updates,
+           calibration.speed[DomeController::SPEED_R], config.speedRight / 1000, calibration.speed[DomeController::SPEED_L], config.speedLeft / 1000,
+           calibration.impToNorthOffset, config.toothOffset);
+    estimateError.print(recalibrate ? "  error after stop (recal.)" : "  error after stop (fixed)", "°");
+}
+
+// how close slews halt to their targets with the stop decided by the control loop or at an edge by the alert thread
+static void stopAccuracy(SimulatedDome::Config config, const CalibrationCache &cache, int slews, bool edgeStop, unsigned seed,
+                         uint32_t periodUs) {
+    config.azimuth = 0;
+    Bench bench(config, periodUs);
+    if (!bench.init()) {
+        return;
+    }
+    bench.controller.setEdgeStop(edgeStop);
+    bench.controller.verifyCalibration(cache.calibration, 0);
+    bench.controller.setDeceleration(DomeController::RotDirection::RIGHT, cache.deceleration[DomeController::SPEED_R]);
+    bench.controller.setDeceleration(DomeController::RotDirection::LEFT, cache.deceleration[DomeController::SPEED_L]);
+    while (bench.controller.isCalibrating()) {
+        bench.cycle();
+    }
+    bench.settle();
+
+    Stats targetError;
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> targets(0, 360);
+    for (int i = 0; i < slews; i++) {
+        bench.controller.moveTo(targets(rng));
+        if (!bench.runUntil(DomeController::Event::TARGET_REACHED, 600)) {
+            expect(false, "slew %d timed out", i);
+            return;
+        }
+        bench.settle();
+        targetError.add(std::fabs(angleDiff(bench.controller.getTarget(), bench.dome.getAzimuth())));
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "  target error (%s, %u ms)", edgeStop ? "edge" : "loop", periodUs / 1000);
+    targetError.print(label, "°");
+    expect(targetError.mean() <= SIM_TARGET_ERROR_MEAN, "%s mean %.3f° above %.3f°", label + 2, targetError.mean(), SIM_TARGET_ERROR_MEAN);
+    expect(targetError.max() <= SIM_POSITION_ERROR_MAX, "%s max %.3f° above %.3f°", label + 2, targetError.max(), SIM_POSITION_ERROR_MAX);
+}
+
+// the dome jamming during a slew and the north sensor failing while it turns twice each way
+static void faults(SimulatedDome::Config config, const CalibrationCache &cache, uint32_t periodUs) {
+    config.azimuth = 0;
+    Bench bench(config, periodUs);
+    if (!bench.init()) {
+        return;
+    }
+    bench.controller.verifyCalibration(cache.calibration, 0);
+    bench.controller.setDeceleration(DomeController::RotDirection::RIGHT, cache.deceleration[DomeController::SPEED_R]);
+    bench.controller.setDeceleration(DomeController::RotDirection::LEFT, cache.deceleration[DomeController::SPEED_L]);
+    while (bench.controller.isCalibrating()) {
+        bench.cycle();
+    }
+    bench.settle();
+
+    bench.controller.moveTo(range360(bench.controller.getAzimuth() + 170));
+    bench.runUntil(0, 10);
+    bench.dome.setJammed(true);
+    uint64_t jammed = bench.dome.getTime();
+    bool stopped = bench.runUntil(DomeController::Event::ROTATION_STALLED, 60);
+    double detection = (bench.dome.getTime() - jammed) / 1e6;
+    printf("jammed: %s after %.2f s, estimate %.3f° off\n", stopped ? "stopped" : "not stopped", detection,
+           angleDiff(bench.controller.getAzimuth(), bench.dome.getAzimuth()));
+    expect(stopped && detection <= SIM_STALL_DETECTION_S, "the jam was %s after %.2f s, the bound is %.2f s",
+           stopped ? "detected" : "not detected", detection, SIM_STALL_DETECTION_S);
+    bench.dome.setJammed(false);
+
+    for (bool failed : {false, true}) {
+        bench.dome.setNorthFailed(failed);
+        unsigned missed = 0;
+        for (DomeController::RotDirection dir : {DomeController::RotDirection::RIGHT, DomeController::RotDirection::LEFT}) {
+            bench.controller.move(dir);
+            double speed = dir == DomeController::RotDirection::RIGHT ? config.speedRight : config.speedLeft;
+            uint64_t until = bench.dome.getTime() + static_cast<uint64_t>(720 / speed * 1e6);
+            while (bench.dome.getTime() < until) {
+                missed += (bench.cycle() & DomeController::Event::NORTH_MISSED) != 0;
+            }
+            bench.controller.stop();
+            bench.settle();
+        }
+        printf("north %s: missed %u times in 4 turns\n", failed ? "failed " : "working", missed);
+        expect(failed ? missed > 0 : missed == 0, "north %s: missed %u times", failed ? "failed" : "working", missed);
+    }
+    bench.dome.setNorthFailed(false);
+}
+
+int main(int argc, char *argv[]) {
+    int slews = 20;
+    double followMinutes = 60;
+    uint32_t periodMs = 10;
+    unsigned seed = 1;
+    double toothJitter = 0;
+    int teeth = 0;
+    const char *recording = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--slews") && i + 1 < argc) {
+            slews = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--period-ms") && i + 1 < argc) {
+            periodMs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--follow-minutes") && i + 1 < argc) {
+            followMinutes = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--tooth-jitter") && i + 1 < argc) {
+            toothJitter = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--teeth") && i + 1 < argc) {
+            teeth = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            recording = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--slews n] [--period-ms ms] [--seed n] [--follow-minutes m] [--tooth-jitter °] [--teeth n] [--record file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    SimulatedDome::Config config = SimulatedDome::defaultConfig();
+    config.seed = seed;
+    config.toothJitter = toothJitter;
+    if (teeth > 0) {
+        config.teeth = teeth;
+    }
+    auto started = std::chrono::steady_clock::now();
+    Bench bench(config, periodMs * 1000);
+    if (!bench.init()) {
+        return 1;
+    }
+    // the main run goes to the flight recorder, see nepo_dome_dump
+    if (recording) {
+        std::string error;
+        if (!bench.controller.getRecorder().open(recording, 1u << 20, bench.controller.getPins(), error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+    }
+
+    // calibration
+    bench.controller.startCalibration();
+    if (!bench.runUntil(DomeController::Event::CALIBRATION_FINISHED | DomeController::Event::CALIBRATION_FAILED, 3600)
+        || bench.controller.isCalibrating()) {
+        printf("calibration failed\n");
+        return 1;
+    }
+    const DomeController::Calibration &calibration = bench.controller.getCalibration();
+    printf("calibration after %.1f s: %g impulses (%d), right %.5f°/ms (%.5f), left %.5f°/ms (%.5f), offset %.3f° (%.3f)\n",
+           bench.dome.getTime() / 1e6, calibration.impCount, config.teeth,
+           calibration.speed[DomeController::SPEED_R], config.speedRight / 1000,
+           calibration.speed[DomeController::SPEED_L], config.speedLeft / 1000,
+           calibration.impToNorthOffset, config.toothOffset);
+    expect(calibration.impCount == config.teeth, "calibrated %g impulses instead of %d", calibration.impCount, config.teeth);
+    for (int i = 0; i < 2; i++) {
+        double speed = (i == DomeController::SPEED_R ? config.speedRight : config.speedLeft) / 1000;
+        expect(std::fabs(calibration.speed[i] / speed - 1) <= SIM_CALIBRATION_SPEED_ERROR, "calibrated speed %.5f°/ms instead of %.5f",
+               calibration.speed[i], speed);
+    }
+    expect(std::fabs(angleDiff(calibration.impToNorthOffset, config.toothOffset)) <= SIM_CALIBRATION_OFFSET_ERROR,
+           "calibrated offset %.3f° instead of %.3f", calibration.impToNorthOffset, config.toothOffset);
+    bench.settle();
+
+    // slews to random targets
+    Stats estimateError;
+    Stats targetError;
+    Stats slewTime;
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> targets(0, 360);
+    for (int i = 0; i < slews; i++) {
+        uint64_t slewStarted = bench.dome.getTime();
+        bench.controller.moveTo(targets(rng));
+        if (!bench.runUntil(DomeController::Event::TARGET_REACHED, 600)) {
+            printf("FAILED: slew %d timed out\n", i);
+            return 1;
+        }
+        bench.settle();
+        slewTime.add((bench.dome.getTime() - slewStarted) / 1e6);
+        estimateError.add(std::fabs(angleDiff(bench.controller.getAzimuth(), bench.dome.getAzimuth())));
+        targetError.add(std::fabs(angleDiff(bench.controller.getTarget(), bench.dome.getAzimuth())));
+    }
+
+    double trueCoastRight = config.speedRight * config.speedRight / (2 * config.acceleration);
+    double trueCoastLeft = config.speedLeft * config.speedLeft / (2 * config.acceleration);
+    printf("learned coast: right %.3f° (%.3f), left %.3f° (%.3f)\n", bench.controller.getCoast(DomeController::RotDirection::RIGHT), trueCoastRight,
+           bench.controller.getCoast(DomeController::RotDirection::LEFT), trueCoastLeft);
+
+    // park cycle: closing the shutter while moving to 0°, then opening it again
+    uint64_t parkStarted = bench.dome.getTime();
+    bench.controller.openShutter();
+    bench.runUntil(DomeController::Event::SHUTTER_OPENED, 600);
+    bench.controller.closeShutter();
+    bench.controller.moveTo(0);
+    bool closed = false;
+    bool reached = false;
+    while (!closed || !reached) {
+        unsigned events = bench.cycle();
+        closed |= (events & DomeController::Event::SHUTTER_CLOSED) != 0;
+        reached |= (events & DomeController::Event::TARGET_REACHED) != 0;
+    }
+    bench.settle();
+    printf("park cycle: %.1f s, parked at %.3f° (estimate %.3f°), shutter %.2f\n", (bench.dome.getTime() - parkStarted) / 1e6,
+           bench.dome.getAzimuth(), bench.controller.getAzimuth(), bench.dome.getShutter());
+    printf("shutter travel learned: open %.1f s, close %.1f s (%.1f)\n", bench.controller.getShutterTravel(DomeController::TRAVEL_OPEN),
+           bench.controller.getShutterTravel(DomeController::TRAVEL_CLOSE), config.shutterTravel);
+
+    // restarts with the cache of this run, the last one with the dome moved while the driver wasn't running
+    CalibrationCache cache;
+    cache.calibration = bench.controller.getCalibration();
+    cache.deceleration[DomeController::SPEED_R] = bench.controller.getDeceleration(DomeController::RotDirection::RIGHT);
+    cache.deceleration[DomeController::SPEED_L] = bench.controller.getDeceleration(DomeController::RotDirection::LEFT);
+    cache.azimuth = bench.controller.getAzimuth();
+    expect(warmStart(config, cache, bench.dome.getAzimuth(), periodMs * 1000), "the warm start where it parked wasn't verified");
+    double warmAzimuths[] = {100, 250};
+    for (double az : warmAzimuths) {
+        cache.azimuth = az;
+        expect(warmStart(config, cache, az, periodMs * 1000), "the warm start from %.3f° wasn't verified", az);
+    }
+    cache.azimuth = 100;
+    expect(!warmStart(config, cache, 130, periodMs * 1000), "the warm start of a moved dome was verified");
+
+    // the same recorded targets planned by arrival time and the shorter way
+    std::vector<SlewCommand> commands = recordTargets(seed, 4 * slews);
+    planSlews(config, cache, commands, false, periodMs * 1000);
+    planSlews(config, cache, commands, true, periodMs * 1000);
+
+    // a changed dome, calibrated incrementally at north or not
+    drift(config, cache, 4 * slews, false, seed, periodMs * 1000);
+    drift(config, cache, 4 * slews, true, seed, periodMs * 1000);
+
+    // stopping from the loop or at an edge, also with a slow loop
+    stopAccuracy(config, cache, 2 * slews, false, seed, periodMs * 1000);
+    stopAccuracy(config, cache, 2 * slews, true, seed, periodMs * 1000);
+    stopAccuracy(config, cache, 2 * slews, false, seed, 5 * periodMs * 1000);
+    stopAccuracy(config, cache, 2 * slews, true, seed, 5 * periodMs * 1000);
+
+    // the encoder watchdog and the check for north
+    faults(config, cache, periodMs * 1000);
+
+    // following the mount through the meridian, where its azimuth changes fastest
+    if (followMinutes > 0) {
+        follow(config, calibration, followMinutes, false, periodMs * 1000);
+        follow(config, calibration, followMinutes, true, periodMs * 1000);
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double simulated = (simulatedUs + bench.dome.getTime()) / 1e6;
+    printf("%d slews, %.1f s simulated in %.2f s (%.0fx real time), the main run %.1f s\n", slews, simulated, wall, simulated / wall,
+           bench.dome.getTime() / 1e6);
+    slewTime.print("slew time", "s");
+    bench.movingError.print("estimate error while moving", "°");
+    bench.movingUncertainty.print("estimated uncertainty", "°");
+    estimateError.print("estimate error after stop", "°");
+    targetError.print("target error after stop", "°");
+    printf("rotation faults: %u encoder stalls, north missed %u times\n", bench.controller.getRotationStalls(), bench.controller.getMissedNorth());
+    bench.loopLatency.print("control loop latency", "µs");
+    LatencyHistogram &edgeLatency = bench.controller.getEdgeLatency();
+    printf("%-28s mean %9.3f  p50 %9.3f  p99 %9.3f  max %9.3f µs (virtual time)\n", "edge to handling latency", edgeLatency.getMean() / 1000,
+           edgeLatency.getQuantile(0.5) / 1000.0, edgeLatency.getQuantile(0.99) / 1000.0, edgeLatency.getMax() / 1000.0);
+    LatencyHistogram &relayLatency = bench.controller.getRelayLatency();
+    printf("%-28s mean %9.3f  p50 %9.3f  p99 %9.3f  max %9.3f µs\n", "relay command latency", relayLatency.getMean() / 1000,
+           relayLatency.getQuantile(0.5) / 1000.0, relayLatency.getQuantile(0.99) / 1000.0, relayLatency.getMax() / 1000.0);
+
+    expect(simulated / wall >= SIM_MIN_SPEEDUP, "%.0fx real time, below %.0fx", simulated / wall, SIM_MIN_SPEEDUP);
+    // the mean target error is bounded in the runs with the learned deceleration, here the first slews learn it
+    expect(targetError.max() <= SIM_POSITION_ERROR_MAX, "target error after stop max %.3f° above %.3f°", targetError.max(),
+           SIM_POSITION_ERROR_MAX);
+    expect(estimateError.max() <= SIM_POSITION_ERROR_MAX, "estimate error after stop max %.3f° above %.3f°", estimateError.max(),
+           SIM_POSITION_ERROR_MAX);
+    expect(bench.controller.getRotationStalls() == 0, "%u encoder stalls without a jam", bench.controller.getRotationStalls());
+    expect(bench.loopLatency.quantile(0.99) <= SIM_LATENCY_P99_US, "control loop latency p99 %.3f µs above %.3f µs",
+           bench.loopLatency.quantile(0.99), SIM_LATENCY_P99_US);
+    expect(relayLatency.getQuantile(0.99) / 1000.0 <= SIM_LATENCY_P99_US, "relay command latency p99 %.3f µs above %.3f µs",
+           relayLatency.getQuantile(0.99) / 1000.0, SIM_LATENCY_P99_US);
+    // an edge waits for the next cycle at most
+    expect(edgeLatency.getMax() <= periodMs * 1000000ull, "edge to handling latency max %.3f µs above the loop period",
+           edgeLatency.getMax() / 1000.0);
+    if (failures) {
+        printf("%d bounds failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
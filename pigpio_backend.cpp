@@ -0,0 +1,133 @@
+#include "gpio_backend.h"
+
+#include <mutex>
+
+// shared by the backends of the process
+static std::mutex usersMutex;
+static int users = 0;
+static int version = 0;
+
+// pigpio calls the dispatcher for every GPIO with an alert, it hands the alert on to the owning backend's function
+// it runs under the lock, so once a function is unregistered none of its calls is still running
+struct AlertSlot {
+    const PigpioBackend *owner = nullptr;
+    gpioAlertFuncEx_t f = nullptr;
+    void *userdata = nullptr;
+};
+static std::mutex slotsMutex;
+static AlertSlot slots[32];
+
+static void dispatchAlert(int gpio, int level, uint32_t tick, void *) {
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    const AlertSlot &slot = slots[gpio];
+    if (slot.f) {
+        slot.f(gpio, level, tick, slot.userdata);
+    }
+}
+
+PigpioBackend::~PigpioBackend() {
+    terminate();
+}
+
+int PigpioBackend::initialise() {
+    std::lock_guard<std::mutex> lock(usersMutex);
+    if (initialised) {
+        return version;
+    }
+    if (users == 0) {
+        int err = gpioInitialise();
+        if (err < 0) {
+            return err;
+        }
+        version = err;
+    }
+    users++;
+    initialised = true;
+    return version;
+}
+
+void PigpioBackend::terminate() {
+    if (!initialised) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(slotsMutex);
+        for (uint32_t bits = owned; bits; bits &= bits - 1) {
+            unsigned gpio = __builtin_ctz(bits);
+            gpioSetWatchdog(gpio, 0);
+            if (slots[gpio].f) {
+                gpioSetAlertFuncEx(gpio, nullptr, nullptr);
+            }
+            slots[gpio] = AlertSlot();
+        }
+        owned = 0;
+    }
+    initialised = false;
+    std::lock_guard<std::mutex> lock(usersMutex);
+    if (--users == 0) {
+        gpioTerminate();
+    }
+}
+
+bool PigpioBackend::claim(unsigned gpio) {
+    // only from the thread setting up the dome, never from an alert
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    if (slots[gpio].owner && slots[gpio].owner != this) {
+        return false;
+    }
+    slots[gpio].owner = this;
+    owned |= 1u << gpio;
+    return true;
+}
+
+int PigpioBackend::setMode(unsigned gpio, unsigned mode) {
+    if (gpio < 32 && !claim(gpio)) {
+        return PI_GPIO_IN_USE;
+    }
+    return gpioSetMode(gpio, mode);
+}
+
+int PigpioBackend::setPullUpDown(unsigned gpio, unsigned pud) {
+    return gpioSetPullUpDown(gpio, pud);
+}
+
+int PigpioBackend::read(unsigned gpio) {
+    return gpioRead(gpio);
+}
+
+uint32_t PigpioBackend::readBits() {
+    return gpioRead_Bits_0_31();
+}
+
+int PigpioBackend::write(unsigned gpio, unsigned level) {
+    return gpioWrite(gpio, level);
+}
+
+int PigpioBackend::writeBitsSet(uint32_t bits) {
+    return gpioWrite_Bits_0_31_Set(bits);
+}
+
+int PigpioBackend::writeBitsClear(uint32_t bits) {
+    return gpioWrite_Bits_0_31_Clear(bits);
+}
+
+uint32_t PigpioBackend::tick() {
+    return gpioTick();
+}
+
+int PigpioBackend::setAlertFunc(unsigned gpio, gpioAlertFuncEx_t f, void *userdata) {
+    if (gpio > 31) {
+        return PI_BAD_USER_GPIO;
+    }
+    if (!claim(gpio)) {
+        return PI_GPIO_IN_USE;
+    }
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    slots[gpio].f = f;
+    slots[gpio].userdata = userdata;
+    return gpioSetAlertFuncEx(gpio, f ? dispatchAlert : nullptr, nullptr);
+}
+
+int PigpioBackend::setWatchdog(unsigned gpio, unsigned timeout) {
+    return gpioSetWatchdog(gpio, timeout);
+}
@@ -0,0 +1,426 @@
+#include "pigpiod_backend.h"
+
+#include <pigpio/pigpiod_if2.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a command and its answer on the pigpiod socket, the answer has the result in res
+struct PigpiodCommand {
+    uint32_t cmd;
+    uint32_t p1;
+    uint32_t p2;
+    uint32_t res;
+};
+static_assert(sizeof(PigpiodCommand) == 16, "pigpiod commands are 16 bytes");
+
+#define PIGPIOD_SYNC_PROBES 8       // TICK round trips of the first tick offset
+#define PIGPIOD_PROBE_MS 1000       // then one every second
+#define PIGPIOD_FLUSH_MS 5000       // longest wait for the pipeline to drain
+#define PIGPIOD_ANSWER_MS 3000      // pigpiod is gone if the oldest command waits longer for its answer
+
+// held by a backend while it connects, see findClientSockets()
+static std::mutex startMutex;
+
+PigpiodBackend::PigpiodBackend(const std::string &host, const std::string &port) : host(host), port(port) {
+}
+
+PigpiodBackend::~PigpiodBackend() {
+    terminate();
+}
+
+int PigpiodBackend::initialise() {
+    if (pi >= 0) {
+        return 0;
+    }
+    // pigpiod_if2 doesn't send with MSG_NOSIGNAL, a lost connection would end the process
+    signal(SIGPIPE, SIG_IGN);
+    {
+        std::lock_guard<std::mutex> lock(startMutex);
+        std::vector<int> before = openSockets();
+        pi = pigpio_start(host.empty() ? nullptr : host.c_str(), port.empty() ? nullptr : port.c_str());
+        if (pi < 0) {
+            return pi;
+        }
+        pipe = openPipe();
+        clientSockets = pipe < 0 ? std::vector<int>() : findClientSockets(before);
+    }
+    levels.store(read_bank_1(pi), std::memory_order_relaxed);
+    int err = pipe < 0 ? pipe : syncTick();
+    if (err < 0) {
+        if (pipe >= 0) {
+            close(pipe);
+            pipe = -1;
+        }
+        pigpio_stop(pi);
+        pi = -1;
+        return err;
+    }
+    // the reader wakes up now and then to probe the tick and to notice terminate()
+    timeval timeout = {0, 200000};
+    setsockopt(pipe, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    broken = false;
+    lost.store(false, std::memory_order_relaxed);
+    running.store(true, std::memory_order_relaxed);
+    reader = std::thread(&PigpiodBackend::readAnswers, this);
+    return 0;
+}
+
+void PigpiodBackend::terminate() {
+    if (pi < 0) {
+        return;
+    }
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(alertMutex);
+        for (Alert &alert : alerts) {
+            alert.f = nullptr;
+        }
+    }
+    if (lost.load(std::memory_order_acquire)) {
+        for (int fd : clientSockets) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    // pigpiod_if2's list of callbacks isn't thread safe, they are cancelled once its notification thread ended
+    pigpio_stop(pi);
+    clientSockets.clear();
+    for (Alert &alert : alerts) {
+        if (alert.callback >= 0) {
+            callback_cancel(alert.callback);
+            alert.callback = -1;
+        }
+    }
+    running.store(false, std::memory_order_relaxed);
+    shutdown(pipe, SHUT_RDWR);
+    if (reader.joinable()) {
+        reader.join();
+    }
+    close(pipe);
+    pipe = -1;
+    pending.clear();
+    pi = -1;
+}
+
+int PigpiodBackend::setMode(unsigned gpio, unsigned mode) {
+    flush();
+    return set_mode(pi, gpio, mode);
+}
+
+int PigpiodBackend::setPullUpDown(unsigned gpio, unsigned pud) {
+    flush();
+    return set_pull_up_down(pi, gpio, pud);
+}
+
+int PigpiodBackend::read(unsigned gpio) {
+    flush();
+    return gpio_read(pi, gpio);
+}
+
+uint32_t PigpiodBackend::readBits() {
+    return levels.load(std::memory_order_acquire);
+}
+
+int PigpiodBackend::write(unsigned gpio, unsigned level) {
+    if (gpio > 53) {
+        return PI_BAD_GPIO;
+    }
+    if (level > 1) {
+        return PI_BAD_LEVEL;
+    }
+    // the levels change only with a write that went out, a lost one leaves them as the Pi has them
+    int err = pipeline(PI_CMD_WRITE, gpio, level);
+    if (err == 0 && gpio < 32) {
+        if (level) {
+            levels.fetch_or(1u << gpio, std::memory_order_release);
+        } else {
+            levels.fetch_and(~(1u << gpio), std::memory_order_release);
+        }
+    }
+    return err;
+}
+
+int PigpiodBackend::writeBitsSet(uint32_t bits) {
+    int err = pipeline(PI_CMD_BS1, bits, 0);
+    if (err == 0) {
+        levels.fetch_or(bits, std::memory_order_release);
+    }
+    return err;
+}
+
+int PigpiodBackend::writeBitsClear(uint32_t bits) {
+    int err = pipeline(PI_CMD_BC1, bits, 0);
+    if (err == 0) {
+        levels.fetch_and(~bits, std::memory_order_release);
+    }
+    return err;
+}
+
+uint32_t PigpiodBackend::tick() {
+    // a new offset may be a little smaller than the last one, the tick doesn't go back for it
+    uint32_t t = localMicros(Clock::now()) + tickOffset.load(std::memory_order_relaxed);
+    uint32_t last = lastTick.load(std::memory_order_relaxed);
+    do {
+        if (static_cast<int32_t>(t - last) < 0) {
+            return last;
+        }
+    } while (!lastTick.compare_exchange_weak(last, t, std::memory_order_relaxed));
+    return t;
+}
+
+int PigpiodBackend::setAlertFunc(unsigned gpio, gpioAlertFuncEx_t f, void *userdata) {
+    if (gpio > 31) {
+        return PI_BAD_USER_GPIO;
+    }
+    std::lock_guard<std::mutex> lock(alertMutex);
+    Alert &alert = alerts[gpio];
+    alert.f = f;
+    alert.userdata = userdata;
+    if (!f || alert.callback >= 0) {
+        return 0;
+    }
+    flush();
+    alert.backend = this;
+    int id = callback_ex(pi, gpio, EITHER_EDGE, onCallback, &alert);
+    if (id < 0) {
+        alert.f = nullptr;
+        return id;
+    }
+    alert.callback = id;
+    // read once the GPIO is reported, so no change between the two gets lost
+    int level = gpio_read(pi, gpio);
+    if (level == PI_HIGH) {
+        levels.fetch_or(1u << gpio, std::memory_order_release);
+    } else if (level == PI_LOW) {
+        levels.fetch_and(~(1u << gpio), std::memory_order_release);
+    }
+    return 0;
+}
+
+int PigpiodBackend::setWatchdog(unsigned gpio, unsigned timeout) {
+    if (gpio > 31) {
+        return PI_BAD_USER_GPIO;
+    }
+    if (timeout > 60000) {
+        return PI_BAD_WDOG_TIMEOUT;
+    }
+    return pipeline(PI_CMD_WDOG, gpio, timeout);
+}
+
+void PigpiodBackend::onCallback(int, unsigned gpio, unsigned level, uint32_t tick, void *userdata) {
+    Alert *alert = static_cast<Alert *>(userdata);
+    PigpiodBackend *backend = alert->backend;
+    if (level == PI_HIGH) {
+        backend->levels.fetch_or(1u << gpio, std::memory_order_release);
+    } else if (level == PI_LOW) {
+        backend->levels.fetch_and(~(1u << gpio), std::memory_order_release);
+    }
+    // pigpio_stop() cancels the notification thread, never in the middle of an alert
+    int cancel;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel);
+    {
+        std::lock_guard<std::mutex> lock(backend->alertMutex);
+        if (alert->f) {
+            alert->f(gpio, level, tick, alert->userdata);
+        }
+    }
+    pthread_setcancelstate(cancel, nullptr);
+}
+
+int PigpiodBackend::openPipe() {
+    // the same address as pigpio_start()
+    const char *addr = host.empty() ? getenv("PIGPIO_ADDR") : host.c_str();
+    const char *service = port.empty() ? getenv("PIGPIO_PORT") : port.c_str();
+    addrinfo hints = {};
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found;
+    if (getaddrinfo(addr && *addr ? addr : "localhost", service && *service ? service : "8888", &hints, &found)) {
+        return pigif_bad_getaddrinfo;
+    }
+    int sock = -1;
+    for (addrinfo *ai = found; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+        // every command goes out right away
+        int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(found);
+    if (sock < 0) {
+        return pigif_bad_connect;
+    }
+    return sock;
+}
+
+int PigpiodBackend::pipeline(uint32_t command, uint32_t p1, uint32_t p2) {
+    PigpiodCommand cmd = {command, p1, p2, 0};
+    std::lock_guard<std::mutex> lock(pipeMutex);
+    if (pipe < 0 || broken) {
+        failedCommands.fetch_add(1, std::memory_order_relaxed);
+        return pigif_unconnected_pi;
+    }
+    Clock::time_point sent = Clock::now();
+    if (send(pipe, &cmd, sizeof(cmd), MSG_NOSIGNAL) != sizeof(cmd)) {
+        failedCommands.fetch_add(1, std::memory_order_relaxed);
+        // a part of the command may have gone out, the stream is out of step
+        broken = true;
+        lost.store(true, std::memory_order_release);
+        drained.notify_all();
+        return pigif_bad_send;
+    }
+    pending.push_back({command, sent});
+    return 0;
+}
+
+void PigpiodBackend::flush() {
+    std::unique_lock<std::mutex> lock(pipeMutex);
+    drained.wait_for(lock, std::chrono::milliseconds(PIGPIOD_FLUSH_MS), [this] { return pending.empty() || broken; });
+}
+
+void PigpiodBackend::readAnswers() {
+    PigpiodCommand answer;
+    size_t got = 0;
+    lastProbe = Clock::now();
+    while (running.load(std::memory_order_relaxed)) {
+        ssize_t n = recv(pipe, reinterpret_cast<char *>(&answer) + got, sizeof(answer) - got, 0);
+        Clock::time_point now = Clock::now();
+        if (n > 0) {
+            got += n;
+        } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            break;
+        }
+        if (got == sizeof(answer)) {
+            got = 0;
+            Pending sent;
+            {
+                std::lock_guard<std::mutex> lock(pipeMutex);
+                if (pending.empty()) {
+                    continue;
+                }
+                sent = pending.front();
+                pending.pop_front();
+                if (pending.empty()) {
+                    drained.notify_all();
+                }
+            }
+            roundTrips.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent.sent).count());
+            if (static_cast<int32_t>(answer.res) < 0) {
+                failedCommands.fetch_add(1, std::memory_order_relaxed);
+            } else if (sent.command == PI_CMD_TICK) {
+                updateTickOffset(answer.res, sent.sent, now);
+            }
+        }
+        if (now - lastProbe >= std::chrono::milliseconds(PIGPIOD_PROBE_MS)) {
+            lastProbe = now;
+            pipeline(PI_CMD_TICK, 0, 0);
+        }
+        // a Pi that dropped off the network closes nothing, its answers just stop coming
+        std::lock_guard<std::mutex> lock(pipeMutex);
+        if (broken || (!pending.empty() && now - pending.front().sent > std::chrono::milliseconds(PIGPIOD_ANSWER_MS))) {
+            break;
+        }
+    }
+    // pigpiod is gone or the backend terminates: nothing gets answered anymore
+    std::lock_guard<std::mutex> lock(pipeMutex);
+    failedCommands.fetch_add(pending.size(), std::memory_order_relaxed);
+    pending.clear();
+    broken = true;
+    if (running.load(std::memory_order_relaxed)) {
+        lost.store(true, std::memory_order_release);
+    }
+    drained.notify_all();
+}
+
+std::vector<int> PigpiodBackend::openSockets() {
+    std::vector<int> sockets;
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return sockets;
+    }
+    while (dirent *entry = readdir(dir)) {
+        struct stat st;
+        int fd = atoi(entry->d_name);
+        if (entry->d_name[0] != '.' && fd != dirfd(dir) && fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            sockets.push_back(fd);
+        }
+    }
+    closedir(dir);
+    return sockets;
+}
+
+std::vector<int> PigpiodBackend::findClientSockets(const std::vector<int> &before) const {
+    std::vector<int> found;
+    sockaddr_storage pigpiod;
+    socklen_t length = sizeof(pigpiod);
+    if (getpeername(pipe, reinterpret_cast<sockaddr *>(&pigpiod), &length) != 0) {
+        return found;
+    }
+    for (int fd : openSockets()) {
+        sockaddr_storage peer;
+        socklen_t peerLength = sizeof(peer);
+        if (fd != pipe && std::find(before.begin(), before.end(), fd) == before.end()
+            && getpeername(fd, reinterpret_cast<sockaddr *>(&peer), &peerLength) == 0 && peerLength == length
+            && memcmp(&peer, &pigpiod, length) == 0) {
+            found.push_back(fd);
+        }
+    }
+    // another thread's connection to the same pigpiod can't be told apart, then none is shut down
+    if (found.size() != 2) {
+        found.clear();
+    }
+    return found;
+}
+
+uint32_t PigpiodBackend::localMicros(Clock::time_point time) {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count());
+}
+
+int PigpiodBackend::syncTick() {
+    bestRoundTrip = INT64_MAX;
+    for (int i = 0; i < PIGPIOD_SYNC_PROBES; i++) {
+        PigpiodCommand cmd = {PI_CMD_TICK, 0, 0, 0};
+        Clock::time_point sent = Clock::now();
+        if (send(pipe, &cmd, sizeof(cmd), MSG_NOSIGNAL) != sizeof(cmd)) {
+            return pigif_bad_send;
+        }
+        if (recv(pipe, &cmd, sizeof(cmd), MSG_WAITALL) != sizeof(cmd)) {
+            return pigif_bad_recv;
+        }
+        updateTickOffset(cmd.res, sent, Clock::now());
+    }
+    lastTick.store(localMicros(Clock::now()) + tickOffset.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return 0;
+}
+
+void PigpiodBackend::updateTickOffset(uint32_t remoteTick, Clock::time_point sent, Clock::time_point answered) {
+    // the Pi took its tick about half way through the round trip, the shorter the round trip the closer, a short one
+    // of the past counts less and less so a slower network gets its offsets after a while
+    int64_t roundTrip = std::chrono::duration_cast<std::chrono::microseconds>(answered - sent).count();
+    if (bestRoundTrip != INT64_MAX) {
+        bestRoundTrip += bestRoundTrip / 8;
+    }
+    if (bestRoundTrip != INT64_MAX && roundTrip > 2 * bestRoundTrip) {
+        return;
+    }
+    bestRoundTrip = std::min(bestRoundTrip, roundTrip);
+    tickOffset.store(remoteTick - localMicros(sent + (answered - sent) / 2), std::memory_order_relaxed);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "gpio_backend.h"
+#include "latency_histogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// a Raspberry Pi somewhere on the network running pigpiod, through pigpiod_if2
+// every pigpiod command is a socket round trip, so none of the calls of the control loop and the alerts waits for one:
+// - readBits() answers from the levels the notification stream reported and this backend wrote
+// - tick() is the local clock plus its offset to the Pi's, measured with a TICK command once a second
+// - writes and watchdogs are pipelined on a command socket of their own, a background thread reads their answers
+// the set up calls (setMode, setPullUpDown, read, setAlertFunc) wait for the pipeline to drain and then for their own
+// round trip, so all commands reach pigpiod in the order they were given
+// once pigpiod closes the connection or stops answering the backend is lost, see isLost(): pigpiod leaves the GPIOs
+// as they are, so the relays keep their last levels on the Pi and a running motor runs on until someone is there
+class PigpiodBackend : public GpioBackend
+{
+public:
+    // like pigpio_start(): empty ones are taken from PIGPIO_ADDR and PIGPIO_PORT, else localhost and 8888
+    PigpiodBackend(const std::string &host, const std::string &port);
+    ~PigpiodBackend() override;
+
+    int initialise() override;
+    void terminate() override;
+
+    int setMode(unsigned gpio, unsigned mode) override;
+    int setPullUpDown(unsigned gpio, unsigned pud) override;
+    int read(unsigned gpio) override;
+    uint32_t readBits() override;
+    int write(unsigned gpio, unsigned level) override;
+    int writeBitsSet(uint32_t bits) override;
+    int writeBitsClear(uint32_t bits) override;
+
+    uint32_t tick() override;
+
+    int setAlertFunc(unsigned gpio, gpioAlertFuncEx_t f, void *userdata) override;
+    int setWatchdog(unsigned gpio, unsigned timeout) override;
+
+    bool isLost() const override { return lost.load(std::memory_order_acquire); }
+
+    // round trips of the pipelined commands, and how many of them failed since the last call
+    LatencyHistogram &getRoundTrips() { return roundTrips; }
+    uint32_t takeFailedCommands() { return failedCommands.exchange(0, std::memory_order_relaxed); }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::string host;
+    std::string port;
+    int pi = -1;
+    // pigpiod_if2 keeps its command and notification sockets to itself, they are the two sockets to the pipeline's
+    // pigpiod that appeared during pigpio_start(), none of the other backends starts meanwhile
+    // pigpio_stop() waits for the answer to a last command, from a lost Pi until TCP gives up, so they are shut down
+    // before it then; without exactly two of them none is
+    std::vector<int> clientSockets;
+    static std::vector<int> openSockets();
+    std::vector<int> findClientSockets(const std::vector<int> &before) const;
+
+    // the pipeline: the commands sent and not answered yet, in order
+    struct Pending {
+        uint32_t command;
+        Clock::time_point sent;
+    };
+    int pipe = -1;
+    std::mutex pipeMutex;
+    std::condition_variable drained;
+    std::deque<Pending> pending;
+    // set by the reader when pigpiod closed the pipeline or terminate() ended it
+    bool broken = false;
+    // the pipeline broke before terminate(), the levels are the last ones known to have reached the Pi
+    std::atomic<bool> lost {false};
+    std::thread reader;
+    std::atomic<bool> running {false};
+    LatencyHistogram roundTrips;
+    std::atomic<uint32_t> failedCommands {0};
+    int openPipe();
+    int pipeline(uint32_t command, uint32_t p1, uint32_t p2);
+    // waits until every pipelined command is answered
+    void flush();
+    void readAnswers();
+
+    // GPIO levels as last reported or written
+    std::atomic<uint32_t> levels {0};
+
+    // the Pi's tick minus the local µs, from the TICK with the shortest round trip of the last ones
+    std::atomic<uint32_t> tickOffset {0};
+    std::atomic<uint32_t> lastTick {0};
+    int64_t bestRoundTrip = INT64_MAX;
+    Clock::time_point lastProbe;
+    static uint32_t localMicros(Clock::time_point time);
+    int syncTick();
+    void updateTickOffset(uint32_t remoteTick, Clock::time_point sent, Clock::time_point answered);
+
+    // pigpiod_if2 calls onCallback() from its notification thread with the slot, it hands the alert on under the lock,
+    // so once a function is unregistered none of its calls is still running
+    struct Alert {
+        PigpiodBackend *backend = nullptr;
+        gpioAlertFuncEx_t f = nullptr;
+        void *userdata = nullptr;
+        int callback = -1;
+    };
+    std::mutex alertMutex;
+    Alert alerts[32];
+    static void onCallback(int pi, unsigned gpio, unsigned level, uint32_t tick, void *userdata);
+};
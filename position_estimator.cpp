@@ -0,0 +1,160 @@
+#include "position_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+// weight of a new impulse interval in the velocity average
+#define VELOCITY_ALPHA 0.1
+// intervals further off than this many standard deviations are spin up, slipping or missed impulses
+#define VELOCITY_OUTLIER_SIGMAS 4.0
+// relative velocity uncertainty assumed for a velocity that wasn't meassured by impulses yet
+#define VELOCITY_INITIAL_SIGMA 0.02
+// lower bound of the relative velocity uncertainty so the outlier check can't lock out every meassurement
+#define VELOCITY_MIN_SIGMA 0.005
+// weight of a new coasting meassurement in the deceleration average
+#define DECELERATION_ALPHA 0.3
+// relative uncertainty of the coasting distance
+#define COAST_SIGMA 0.2
+
+void PositionEstimator::setVelocity(Motion dir, double v) {
+    if (dir == STANDING) {
+        return;
+    }
+    velocity[dir] = v;
+    velocitySigma[dir] = v * VELOCITY_INITIAL_SIGMA;
+    velocityMeassured[dir] = false;
+}
+
+void PositionEstimator::setDeceleration(Motion dir, double a) {
+    if (dir != STANDING) {
+        deceleration[dir] = a;
+    }
+}
+
+double PositionEstimator::getCoast(Motion dir) const {
+    if (dir == STANDING || deceleration[dir] <= 0) {
+        return 0;
+    }
+    return velocity[dir] * velocity[dir] / (2 * deceleration[dir]);
+}
+
+void PositionEstimator::setMotion(Motion m, uint32_t tick) {
+    if (m == motion) {
+        return;
+    }
+    anchorAz = estimate(tick);
+    anchorSigma = uncertainty(tick);
+    anchorTick = tick;
+    if (m == STANDING) {
+        // the dome doesn't stop immediately
+        coastDir = motion;
+        coastTick = tick;
+        coastAz = anchorAz;
+        coastSigma = anchorSigma;
+        coastVelocity = velocity[motion];
+    } else {
+        coastDir = STANDING;
+    }
+    motion = m;
+}
+
+double PositionEstimator::coastDistance(uint32_t tick) const {
+    double a = deceleration[coastDir];
+    if (a <= 0) {
+        return 0;
+    }
+    double t = std::min(static_cast<int32_t>(tick - coastTick) / 1e6, coastVelocity / a);
+    if (t <= 0) {
+        return 0;
+    }
+    return coastVelocity * t - a * t * t / 2;
+}
+
+bool PositionEstimator::isCoasting(uint32_t tick) const {
+    if (motion != STANDING || coastDir == STANDING || deceleration[coastDir] <= 0) {
+        return false;
+    }
+    return static_cast<int32_t>(tick - coastTick) / 1e6 < coastVelocity / deceleration[coastDir];
+}
+
+double PositionEstimator::getCoastVelocity(uint32_t tick) const {
+    if (!isCoasting(tick)) {
+        return 0;
+    }
+    return coastVelocity - deceleration[coastDir] * static_cast<int32_t>(tick - coastTick) / 1e6;
+}
+
+void PositionEstimator::impulse(double az, uint32_t tick, double sigma) {
+    if (motion == STANDING && coastDir != STANDING) {
+        // an impulse while coasting tells how fast the dome decelerates: x = v*t - a*t²/2
+        // right after stopping a*t²/2 is within the uncertainty of both positions and tells nothing
+        double t = static_cast<int32_t>(tick - coastTick) / 1e6;
+        double x = std::remainder(coastDir == RIGHT ? az - coastAz : coastAz - az, 360.0);
+        if (t > 0 && x > 0 && coastVelocity * t - x > coastSigma + sigma) {
+            double a = 2 * (coastVelocity * t - x) / (t * t);
+            if (a > 0) {
+                deceleration[coastDir] = deceleration[coastDir] > 0 ? deceleration[coastDir] + DECELERATION_ALPHA * (a - deceleration[coastDir]) : a;
+            }
+        }
+    }
+    fix(az, tick, sigma);
+}
+
+void PositionEstimator::fix(double az, uint32_t tick, double sigma) {
+    anchorAz = az;
+    anchorSigma = sigma;
+    anchorTick = tick;
+}
+
+void PositionEstimator::lose() {
+    anchorSigma = 360;
+}
+
+void PositionEstimator::impulseInterval(Motion dir, double degrees, uint32_t us) {
+    if (dir == STANDING || us == 0) {
+        return;
+    }
+    double meassured = degrees / (us / 1e6);
+    if (velocity[dir] <= 0) {
+        velocity[dir] = meassured;
+        velocitySigma[dir] = meassured * VELOCITY_INITIAL_SIGMA;
+        return;
+    }
+    double residual = meassured - velocity[dir];
+    double sigma = std::max(velocitySigma[dir], velocity[dir] * VELOCITY_MIN_SIGMA);
+    if (std::fabs(residual) > VELOCITY_OUTLIER_SIGMAS * sigma) {
+        return;
+    }
+    // exponentially weighted mean and variance
+    velocity[dir] += VELOCITY_ALPHA * residual;
+    double variance = velocityMeassured[dir] ? velocitySigma[dir] * velocitySigma[dir] : 0;
+    variance = (1 - VELOCITY_ALPHA) * (variance + VELOCITY_ALPHA * residual * residual);
+    velocitySigma[dir] = std::max(std::sqrt(variance), velocity[dir] * VELOCITY_MIN_SIGMA);
+    velocityMeassured[dir] = true;
+}
+
+double PositionEstimator::estimate(uint32_t tick) const {
+    double dt = static_cast<int32_t>(tick - anchorTick) / 1e6;
+    if (motion == RIGHT) {
+        return anchorAz + velocity[RIGHT] * dt;
+    } else if (motion == LEFT) {
+        return anchorAz - velocity[LEFT] * dt;
+    } else if (coastDir != STANDING) {
+        double coasted = coastDistance(tick) - coastDistance(anchorTick);
+        return coastDir == RIGHT ? anchorAz + coasted : anchorAz - coasted;
+    }
+    return anchorAz;
+}
+
+double PositionEstimator::uncertainty(uint32_t tick) const {
+    if (motion == STANDING) {
+        if (coastDir == STANDING) {
+            return anchorSigma;
+        }
+        double coast = COAST_SIGMA * (coastDistance(tick) - coastDistance(anchorTick));
+        return std::min(360.0, std::sqrt(anchorSigma * anchorSigma + coast * coast));
+    }
+    double dt = std::fabs(static_cast<int32_t>(tick - anchorTick) / 1e6);
+    double drift = velocitySigma[motion] * dt;
+    return std::min(360.0, std::sqrt(anchorSigma * anchorSigma + drift * drift));
+}
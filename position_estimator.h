@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+// azimuth estimate between encoder impulses
+// the position is anchored at the last exactly known point (impulse edge or north) and extrapolated with a
+// per-direction velocity that is refined from the meassured time between impulses
+// after the motor is switched off the dome coasts to a halt with a per-direction deceleration that is learned
+// from the impulses still passing while coasting
+// all times are pigpio ticks (µs, wrapping), angles in °, velocities in °/s
+class PositionEstimator
+{
+public:
+    enum Motion {
+        RIGHT,
+        LEFT,
+        STANDING
+    };
+
+    // the velocity of one direction, e.g. from the calibration
+    void setVelocity(Motion dir, double velocity);
+    double getVelocity(Motion dir) const { return dir == STANDING ? 0 : velocity[dir]; }
+    double getVelocitySigma(Motion dir) const { return dir == STANDING ? 0 : velocitySigma[dir]; }
+
+    // deceleration when the motor is switched off in °/s², 0 if unknown
+    void setDeceleration(Motion dir, double deceleration);
+    double getDeceleration(Motion dir) const { return dir == STANDING ? 0 : deceleration[dir]; }
+    // distance the dome coasts after switching off the motor at full speed
+    double getCoast(Motion dir) const;
+
+    // the motor changed direction or stopped at tick
+    void setMotion(Motion motion, uint32_t tick);
+    Motion getMotion() const { return motion; }
+    // direction the dome is still coasting in after the motor was stopped
+    Motion getCoastDirection() const { return coastDir; }
+    // the dome is still coasting at tick, false if the deceleration isn't known
+    bool isCoasting(uint32_t tick) const;
+    // velocity the dome still coasts with at tick, 0 if it doesn't
+    double getCoastVelocity(uint32_t tick) const;
+
+    // the dome was exactly at az at tick, sigma is the uncertainty of that position
+    void fix(double az, uint32_t tick, double sigma);
+    // like fix() for an encoder impulse, while coasting it also refines the deceleration
+    void impulse(double az, uint32_t tick, double sigma);
+    // nothing is known about the position anymore
+    void lose();
+
+    // two impulses meassured degrees apart took us µs in direction dir
+    void impulseInterval(Motion dir, double degrees, uint32_t us);
+
+    // azimuth at tick (not wrapped to 0..360) and its standard deviation
+    double estimate(uint32_t tick) const;
+    double uncertainty(uint32_t tick) const;
+
+private:
+    double velocity[2] = {0, 0};
+    double velocitySigma[2] = {0, 0};
+    bool velocityMeassured[2] = {false, false};
+    double deceleration[2] = {0, 0};
+
+    // coasting after the motor was stopped at coastTick
+    Motion coastDir = STANDING;
+    uint32_t coastTick = 0;
+    double coastAz = 0;
+    double coastSigma = 0;
+    double coastVelocity = 0;
+    double coastDistance(uint32_t tick) const;
+
+    Motion motion = STANDING;
+    double anchorAz = 0;
+    double anchorSigma = 360;
+    uint32_t anchorTick = 0;
+};
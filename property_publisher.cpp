@@ -0,0 +1,64 @@
+#include "property_publisher.h"
+
+#include <cmath>
+
+void PropertyPublisher::add(INDI::PropertyNumber &property, double deadband) {
+    Entry entry;
+    entry.property = &property;
+    entry.deadband = deadband;
+    entry.published.assign(property.size(), NAN);
+    entry.publishedState = property.getState();
+    entry.forced = true;
+    entries.push_back(entry);
+}
+
+void PropertyPublisher::setRates(double movingRate, double idleRate) {
+    this->movingRate = movingRate;
+    this->idleRate = idleRate;
+}
+
+void PropertyPublisher::touch(INDI::PropertyNumber &property) {
+    for (Entry &entry : entries) {
+        if (entry.property == &property) {
+            entry.forced = true;
+        }
+    }
+}
+
+bool PropertyPublisher::isDirty(const Entry &entry) const {
+    for (size_t i = 0; i < entry.published.size(); i++) {
+        // NAN: never sent
+        double published = entry.published[i];
+        if (std::isnan(published) || std::fabs((*entry.property)[i].getValue() - published) > entry.deadband) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PropertyPublisher::flush(bool moving) {
+    auto now = std::chrono::steady_clock::now();
+    double rate = moving ? movingRate : idleRate;
+    for (Entry &entry : entries) {
+        INDI::PropertyNumber &property = *entry.property;
+        // state changes and forced updates are never held back
+        bool urgent = entry.forced || property.getState() != entry.publishedState;
+        if (!urgent) {
+            if (!isDirty(entry)) {
+                continue;
+            }
+            if (rate > 0 && std::chrono::duration<double>(now - entry.publishedAt).count() < 1 / rate) {
+                suppressed++;
+                continue;
+            }
+        }
+        property.apply();
+        for (size_t i = 0; i < entry.published.size(); i++) {
+            entry.published[i] = property[i].getValue();
+        }
+        entry.publishedState = property.getState();
+        entry.forced = false;
+        entry.publishedAt = now;
+        sent++;
+    }
+}
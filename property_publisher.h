@@ -0,0 +1,45 @@
+#pragma once
+
+#include "libindi/indidome.h"
+
+#include <chrono>
+#include <vector>
+
+// coalesces the publication of frequently changing number properties
+// the values are set on the properties as usual, flush() is called once per loop and sends a property only if
+// its state changed or one of its values moved further than its deadband since it was last sent
+// while the dome moves a property is sent at most movingRate times a second, while idle at most idleRate times a
+// second (0: every change is sent right away)
+class PropertyPublisher
+{
+public:
+    void add(INDI::PropertyNumber &property, double deadband);
+    void setRates(double movingRate, double idleRate);
+
+    // sending the property with the next flush regardless of deadband and rate
+    void touch(INDI::PropertyNumber &property);
+
+    // sending all dirty properties that are due
+    void flush(bool moving);
+
+    // number of properties sent and held back since the start
+    unsigned long getSent() const { return sent; }
+    unsigned long getSuppressed() const { return suppressed; }
+
+private:
+    struct Entry {
+        INDI::PropertyNumber *property;
+        double deadband;
+        std::vector<double> published;
+        IPState publishedState;
+        bool forced;
+        std::chrono::steady_clock::time_point publishedAt;
+    };
+    std::vector<Entry> entries;
+    double movingRate = 5;
+    double idleRate = 0;
+    unsigned long sent = 0;
+    unsigned long suppressed = 0;
+
+    bool isDirty(const Entry &entry) const;
+};
@@ -0,0 +1,140 @@
+// micro-benchmark of the relay command latency
+// compares switching a pair of relays with two single writes against one set and one clear mask write, and times the
+// motor commands of the controller
+// against the simulated dome by default, --pigpio uses the real GPIOs: pass spare pins with --pins, the default
+// ones aren't wired to the dome; --pigpiod host[:port] the GPIOs of a remote Pi, the writes are pipelined there, so
+// their round trips are shown as well
+
+#include "bench_stats.h"
+#include "dome_controller.h"
+#include "pigpiod_backend.h"
+#include "simulated_dome.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedNs(Clock::time_point started) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - started).count();
+}
+
+// reversing between a and b (active low) the way right() and left() used to do it
+static void singleWrites(GpioBackend &gpio, unsigned a, unsigned b, int iterations, Stats &stats) {
+    for (int i = 0; i < iterations; i++) {
+        unsigned on = i % 2 ? a : b;
+        unsigned off = i % 2 ? b : a;
+        auto started = Clock::now();
+        gpio.write(off, PI_ON);
+        gpio.write(on, PI_OFF);
+        stats.add(elapsedNs(started));
+    }
+    gpio.write(a, PI_ON);
+    gpio.write(b, PI_ON);
+}
+
+// the same with masks: releasing first, then switching on
+static void maskWrites(GpioBackend &gpio, unsigned a, unsigned b, int iterations, Stats &stats) {
+    for (int i = 0; i < iterations; i++) {
+        uint32_t on = 1u << (i % 2 ? a : b);
+        uint32_t off = 1u << (i % 2 ? b : a);
+        auto started = Clock::now();
+        gpio.writeBitsSet(off);
+        gpio.writeBitsClear(on);
+        stats.add(elapsedNs(started));
+    }
+    gpio.writeBitsSet((1u << a) | (1u << b));
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = 100000;
+    bool pigpio = false;
+    std::string remote;
+    unsigned pinA = 5;
+    unsigned pinB = 6;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--pigpio")) {
+            pigpio = true;
+        } else if (!strcmp(argv[i], "--pigpiod") && i + 1 < argc) {
+            pigpio = true;
+            remote = argv[++i];
+        } else if (!strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--pins") && i + 1 < argc && sscanf(argv[++i], "%u,%u", &pinA, &pinB) == 2 && pinA < 32 && pinB < 32) {
+        } else {
+            fprintf(stderr, "usage: %s [--iterations n] [--pigpio | --pigpiod host[:port] [--pins a,b]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::unique_ptr<GpioBackend> gpio;
+    PigpiodBackend *pigpiod = nullptr;
+    if (!remote.empty()) {
+        size_t colon = remote.rfind(':');
+        pigpiod = new PigpiodBackend(remote.substr(0, colon), colon == std::string::npos ? "" : remote.substr(colon + 1));
+        gpio.reset(pigpiod);
+    } else if (pigpio) {
+        gpio.reset(new PigpioBackend());
+    } else {
+        gpio.reset(new SimulatedDome(SimulatedDome::defaultConfig()));
+    }
+    if (gpio->initialise() < 0) {
+        fprintf(stderr, "Initialization of PIGPIO failed\n");
+        return 1;
+    }
+    gpio->setMode(pinA, PI_OUTPUT);
+    gpio->setMode(pinB, PI_OUTPUT);
+
+    Stats single;
+    Stats masks;
+    singleWrites(*gpio, pinA, pinB, iterations, single);
+    maskWrites(*gpio, pinA, pinB, iterations, masks);
+    printf("%d reversals between GPIO %u and %u on the %s\n", iterations, pinA, pinB, pigpio ? "GPIOs" : "simulated dome");
+    single.print("two gpioWrite", "ns");
+    masks.print("set + clear mask", "ns");
+    if (pigpiod) {
+        // the answers of the last writes are still on their way
+        gpio->read(pinA);
+        LatencyHistogram &roundTrips = pigpiod->getRoundTrips();
+        printf("%-28s mean %9.3f  p50 %9.3f  p99 %9.3f  max %9.3f ns\n", "pigpiod round trip", roundTrips.getMean(),
+               static_cast<double>(roundTrips.getQuantile(0.5)), static_cast<double>(roundTrips.getQuantile(0.99)),
+               static_cast<double>(roundTrips.getMax()));
+        printf("failed commands: %u\n", pigpiod->takeFailedCommands());
+    }
+
+    // the controller's motor commands, only against the simulated dome: on the real one the dome would turn
+    if (!pigpio) {
+        SimulatedDome dome(SimulatedDome::defaultConfig());
+        DomeController controller(dome);
+        std::string error;
+        if (!controller.init(error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        Stats start;
+        Stats reverse;
+        Stats stop;
+        for (int i = 0; i < iterations; i++) {
+            auto started = Clock::now();
+            controller.move(DomeController::RotDirection::RIGHT);
+            start.add(elapsedNs(started));
+            started = Clock::now();
+            controller.move(DomeController::RotDirection::LEFT);
+            reverse.add(elapsedNs(started));
+            started = Clock::now();
+            controller.stop();
+            stop.add(elapsedNs(started));
+        }
+        start.print("controller start", "ns");
+        reverse.print("controller reverse", "ns");
+        stop.print("controller stop", "ns");
+        printf("relay conflicts: %u\n", dome.getRelayConflicts());
+    }
+
+    gpio->terminate();
+    return 0;
+}
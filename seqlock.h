@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// single writer, many readers snapshot of a trivially copyable value
+// the writer never waits, a reader retries while a write is in progress
+// the value is copied word by word through relaxed atomics so a torn read is detected instead of being a data race
+// the atomics are lock free and hold no pointers, so it works in memory shared between processes as well
+template <typename T>
+class Seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "T has to be trivially copyable");
+
+public:
+    Seqlock() {
+        write(T());
+    }
+
+    void write(const T &value) {
+        uint64_t buffer[WORDS] = {};
+        memcpy(buffer, &value, sizeof(T));
+        uint32_t s = sequence.load(std::memory_order_relaxed);
+        // odd while writing
+        sequence.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) {
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+        sequence.store(s + 2, std::memory_order_release);
+    }
+
+    T read() const {
+        T value;
+        while (!tryRead(value, 1)) {
+        }
+        return value;
+    }
+
+    // gives up after attempts torn reads, for a writer that may have died in the middle of a write
+    bool tryRead(T &value, int attempts) const {
+        uint64_t buffer[WORDS];
+        uint32_t before;
+        uint32_t after;
+        do {
+            if (attempts-- <= 0) {
+                return false;
+            }
+            before = sequence.load(std::memory_order_acquire);
+            for (size_t i = 0; i < WORDS; i++) {
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        memcpy(&value, buffer, sizeof(T));
+        return true;
+    }
+
+private:
+    static const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    std::atomic<uint32_t> sequence {0};
+    std::atomic<uint64_t> words[WORDS];
+};
@@ -0,0 +1,291 @@
+#include "simulated_dome.h"
+#include "angles.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+SimulatedDome::Config SimulatedDome::defaultConfig(const DomePinMap &pins) {
+    Config config;
+    config.pinRight = pins.gpio[SIGNAL_R];
+    config.pinLeft = pins.gpio[SIGNAL_L];
+    config.pinOpen = pins.gpio[SIGNAL_O];
+    config.pinClose = pins.gpio[SIGNAL_C];
+    config.pinIsOpen = pins.gpio[SIGNAL_ISO];
+    config.pinIsClosed = pins.gpio[SIGNAL_ISC];
+    config.pinIsNorth = pins.gpio[SIGNAL_ISN];
+    config.pinRotImp = pins.gpio[SIGNAL_ROT];
+    config.activeHigh = pins.activeHigh;
+    return config;
+}
+
+SimulatedDome::SimulatedDome(const Config &config) : config(config), azimuth(range360(config.azimuth)), shutter(config.shutter) {
+    // the teeth of the real ring aren't evenly spaced either
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<double> jitter(-config.toothJitter, config.toothJitter);
+    double period = 360.0 / config.teeth;
+    for (int i = 0; i < config.teeth; i++) {
+        teeth.push_back(range360(config.toothOffset + i * period + jitter(rng)));
+    }
+    // relays are off and sensors inactive, high unless they are active high
+    std::fill(std::begin(levels), std::end(levels), PI_HIGH);
+    for (unsigned gpio = 0; gpio < 32; gpio++) {
+        if (config.activeHigh & (1u << gpio)) {
+            levels[gpio] = PI_LOW;
+        }
+    }
+    updateSensors();
+}
+
+SimulatedDome::~SimulatedDome() {
+    terminate();
+}
+
+int SimulatedDome::initialise() {
+    return 0;
+}
+
+void SimulatedDome::terminate() {
+    if (running.exchange(false)) {
+        thread.join();
+    }
+}
+
+int SimulatedDome::setMode(unsigned gpio, unsigned mode) {
+    if (gpio > 53) {
+        return PI_BAD_GPIO;
+    }
+    return mode > 7 ? PI_BAD_MODE : 0;
+}
+
+int SimulatedDome::setPullUpDown(unsigned gpio, unsigned pud) {
+    if (gpio > 53) {
+        return PI_BAD_GPIO;
+    }
+    return pud > PI_PUD_UP ? PI_BAD_PUD : 0;
+}
+
+int SimulatedDome::read(unsigned gpio) {
+    if (gpio > 53) {
+        return PI_BAD_GPIO;
+    }
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return levels[gpio];
+}
+
+uint32_t SimulatedDome::readBits() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    uint32_t bits = 0;
+    for (unsigned gpio = 0; gpio < 32; gpio++) {
+        bits |= static_cast<uint32_t>(levels[gpio]) << gpio;
+    }
+    return bits;
+}
+
+int SimulatedDome::write(unsigned gpio, unsigned level) {
+    if (gpio > 53) {
+        return PI_BAD_GPIO;
+    }
+    if (level > 1) {
+        return PI_BAD_LEVEL;
+    }
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    levels[gpio] = level;
+    checkRelays();
+    return 0;
+}
+
+int SimulatedDome::writeBitsSet(uint32_t bits) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for (; bits; bits &= bits - 1) {
+        levels[__builtin_ctz(bits)] = PI_HIGH;
+    }
+    checkRelays();
+    return 0;
+}
+
+int SimulatedDome::writeBitsClear(uint32_t bits) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for (; bits; bits &= bits - 1) {
+        levels[__builtin_ctz(bits)] = PI_LOW;
+    }
+    checkRelays();
+    return 0;
+}
+
+void SimulatedDome::checkRelays() {
+    // the real dome's contactors would fight
+    if ((isOn(config.pinRight) && isOn(config.pinLeft)) || (isOn(config.pinOpen) && isOn(config.pinClose))) {
+        relayConflicts++;
+    }
+}
+
+unsigned SimulatedDome::getRelayConflicts() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return relayConflicts;
+}
+
+uint32_t SimulatedDome::tick() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return static_cast<uint32_t>(now);
+}
+
+int SimulatedDome::setAlertFunc(unsigned gpio, gpioAlertFuncEx_t f, void *userdata) {
+    if (gpio > 31) {
+        return PI_BAD_USER_GPIO;
+    }
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    alerts[gpio].f = f;
+    alerts[gpio].userdata = userdata;
+    return 0;
+}
+
+int SimulatedDome::setWatchdog(unsigned gpio, unsigned timeout) {
+    if (gpio > 31) {
+        return PI_BAD_USER_GPIO;
+    }
+    if (timeout > 60000) {
+        return PI_BAD_WDOG_TIMEOUT;
+    }
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    watchdogs[gpio] = timeout * 1000ull;
+    lastActivity[gpio] = now;
+    if (timeout) {
+        watched |= 1u << gpio;
+    } else {
+        watched &= ~(1u << gpio);
+    }
+    return 0;
+}
+
+void SimulatedDome::advance(uint32_t us) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advanceLocked(now + us);
+}
+
+void SimulatedDome::start(double timeScale) {
+    terminate();
+    running = true;
+    thread = std::thread([this, timeScale] {
+        auto started = std::chrono::steady_clock::now();
+        uint64_t virtualStarted = getTime();
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count();
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            advanceLocked(virtualStarted + static_cast<uint64_t>(elapsed * timeScale));
+        }
+    });
+}
+
+double SimulatedDome::getAzimuth() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return azimuth;
+}
+
+double SimulatedDome::getVelocity() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return velocity;
+}
+
+double SimulatedDome::getShutter() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return shutter;
+}
+
+uint64_t SimulatedDome::getTime() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return now;
+}
+
+bool SimulatedDome::toothActive(double az) const {
+    // only the nearest teeth can cover az as long as the jitter is below half a period
+    double period = 360.0 / config.teeth;
+    double width = config.toothWidth * period;
+    int nearest = static_cast<int>(range360(az - config.toothOffset) / period);
+    for (int i = nearest - 1; i <= nearest + 1; i++) {
+        if (range360(az - teeth[(i + config.teeth) % config.teeth]) < width) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SimulatedDome::setJammed(bool jammed) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    this->jammed = jammed;
+}
+
+void SimulatedDome::setNorthFailed(bool failed) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    northFailed = failed;
+}
+
+void SimulatedDome::setSensor(unsigned gpio, bool active) {
+    int level = active == activeHigh(gpio) ? PI_HIGH : PI_LOW;
+    if (levels[gpio] == level) {
+        return;
+    }
+    levels[gpio] = level;
+    if (gpio < 32) {
+        lastActivity[gpio] = now;
+    }
+    if (gpio < 32 && alerts[gpio].f) {
+        alerts[gpio].f(gpio, level, static_cast<uint32_t>(now), alerts[gpio].userdata);
+    }
+}
+
+void SimulatedDome::updateSensors() {
+    setSensor(config.pinIsNorth, !northFailed && azimuth < config.northWidth);
+    setSensor(config.pinRotImp, toothActive(azimuth));
+    setSensor(config.pinIsOpen, shutter >= 1.0);
+    setSensor(config.pinIsClosed, shutter <= 0.0);
+}
+
+void SimulatedDome::step(double dt) {
+    // both or none switched on means standing still
+    bool r = isOn(config.pinRight);
+    bool l = isOn(config.pinLeft);
+    double target = r == l ? 0 : (r ? config.speedRight : -config.speedLeft);
+    double dv = config.acceleration * dt;
+    if (velocity < target) {
+        velocity = std::min(velocity + dv, target);
+    } else {
+        velocity = std::max(velocity - dv, target);
+    }
+    if (jammed) {
+        velocity = 0;
+    }
+    azimuth = range360(azimuth + velocity * dt);
+
+    bool o = isOn(config.pinOpen);
+    bool c = isOn(config.pinClose);
+    if (o != c) {
+        shutter += (o ? dt : -dt) / config.shutterTravel;
+        shutter = std::min(1.0, std::max(0.0, shutter));
+    }
+}
+
+void SimulatedDome::advanceLocked(uint64_t until) {
+    while (now < until) {
+        uint64_t dt = std::min<uint64_t>(config.stepUs, until - now);
+        now += dt;
+        step(dt / 1e6);
+        updateSensors();
+        if (watched) {
+            checkWatchdogs();
+        }
+    }
+}
+
+void SimulatedDome::checkWatchdogs() {
+    for (unsigned gpio = 0; gpio < 32; gpio++) {
+        if ((watched & (1u << gpio)) && now - lastActivity[gpio] >= watchdogs[gpio]) {
+            lastActivity[gpio] = now;
+            if (alerts[gpio].f) {
+                alerts[gpio].f(gpio, PI_TIMEOUT, static_cast<uint32_t>(now), alerts[gpio].userdata);
+            }
+        }
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "dome_pins.h"
+#include "gpio_backend.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// deterministic model of the dome to run the driver without a Raspberry Pi
+// it reacts to the relay GPIOs like the real dome and drives the sensor GPIOs from its modelled state, by default all
+// are active low
+// time is virtual: it is either advanced explicitly with advance() or by a background thread at a multiple of real time
+class SimulatedDome : public GpioBackend
+{
+public:
+    struct Config {
+        // wiring
+        unsigned pinRight;
+        unsigned pinLeft;
+        unsigned pinOpen;
+        unsigned pinClose;
+        unsigned pinIsOpen;
+        unsigned pinIsClosed;
+        unsigned pinIsNorth;
+        unsigned pinRotImp;
+        uint32_t activeHigh = 0;        // mask of the GPIOs whose signal is active high, the others are active low
+        // rotation
+        double speedRight = 6.0;        // °/s
+        double speedLeft = 5.5;         // °/s
+        double acceleration = 15.0;     // °/s² while spinning up and down, causes the overshoot
+        // encoder
+        int teeth = 48;                 // impulses per rotation
+        double toothWidth = 0.5;        // part of a tooth period the impulse is active
+        double toothOffset = 2.5;       // position of the first impulse right of north in °
+        double toothJitter = 0.0;       // maximal random deviation of a tooth from its ideal position in °
+        double northWidth = 4.0;        // the north sensor is active from 0° to this
+        // shutter
+        double shutterTravel = 25.0;    // s for a full open or close
+        // start state
+        double azimuth = 180.0;
+        double shutter = 0.0;           // 0 closed, 1 open
+        unsigned seed = 1;              // for the tooth jitter
+        uint32_t stepUs = 50;           // integration step
+    };
+
+    // the dome wired like the real one, or like the pin map
+    static Config defaultConfig(const DomePinMap &pins = DomePinMap());
+
+    explicit SimulatedDome(const Config &config);
+    ~SimulatedDome() override;
+
+    int initialise() override;
+    void terminate() override;
+
+    int setMode(unsigned gpio, unsigned mode) override;
+    int setPullUpDown(unsigned gpio, unsigned pud) override;
+    int read(unsigned gpio) override;
+    uint32_t readBits() override;
+    int write(unsigned gpio, unsigned level) override;
+    int writeBitsSet(uint32_t bits) override;
+    int writeBitsClear(uint32_t bits) override;
+
+    uint32_t tick() override;
+
+    int setAlertFunc(unsigned gpio, gpioAlertFuncEx_t f, void *userdata) override;
+    int setWatchdog(unsigned gpio, unsigned timeout) override;
+
+    // advancing the virtual time, alerts are called from the calling thread
+    void advance(uint32_t us);
+    // advancing the virtual time timeScale times as fast as real time in a background thread until terminate()
+    void start(double timeScale);
+
+    // the true state for comparing the driver's estimates against
+    double getAzimuth();
+    double getVelocity();
+    double getShutter();
+    uint64_t getTime();
+    // number of writes after which both motor or both shutter relays were switched on
+    unsigned getRelayConflicts();
+
+    // faults: the dome stuck although the motor runs, the north sensor never becoming active
+    void setJammed(bool jammed);
+    void setNorthFailed(bool failed);
+
+private:
+    Config config;
+    std::vector<double> teeth;
+
+    // recursive: like with pigpio the alert functions may write GPIOs
+    std::recursive_mutex mutex;
+    uint64_t now = 0;
+    unsigned relayConflicts = 0;
+    void checkRelays();
+    double azimuth;
+    double velocity = 0;
+    double shutter;
+    bool jammed = false;
+    bool northFailed = false;
+    int levels[54];
+    bool activeHigh(unsigned gpio) const { return gpio < 32 && (config.activeHigh & (1u << gpio)); }
+    // a relay is switched on at its active level
+    bool isOn(unsigned gpio) const { return levels[gpio] == (activeHigh(gpio) ? PI_HIGH : PI_LOW); }
+    struct Alert {
+        gpioAlertFuncEx_t f = nullptr;
+        void *userdata = nullptr;
+    };
+    Alert alerts[32];
+    // watchdog timeouts in µs, 0 if none, and the last level change or timeout
+    uint64_t watchdogs[32] = {};
+    uint64_t lastActivity[32] = {};
+    uint32_t watched = 0;
+    void checkWatchdogs();
+
+    std::thread thread;
+    std::atomic<bool> running {false};
+
+    bool toothActive(double az) const;
+    void updateSensors();
+    void setSensor(unsigned gpio, bool active);
+    void step(double dt);
+    void advanceLocked(uint64_t until);
+};
@@ -0,0 +1,65 @@
+#include "slew_planner.h"
+#include "angles.h"
+
+#include <algorithm>
+#include <cmath>
+
+SlewPlanner::Plan SlewPlanner::plan(const Dome &dome, double az, double velocity, double target) const {
+    Plan right = planDirection(dome, RIGHT, az, velocity, target);
+    Plan left = planDirection(dome, LEFT, az, velocity, target);
+    if (!config.costBased) {
+        return right.distance <= 180 ? right : left;
+    }
+    return right.eta <= left.eta ? right : left;
+}
+
+SlewPlanner::Plan SlewPlanner::planDirection(const Dome &dome, Direction dir, double az, double velocity, double target) const {
+    Plan plan;
+    plan.direction = dir;
+    plan.distance = dir == RIGHT ? range360(target - az) : range360(az - target);
+    double v = dome.velocity[dir];
+    double a = dome.deceleration[dir];
+    // speed along dir, negative while turning the other way
+    double u = dir == RIGHT ? velocity : -velocity;
+    double distance = plan.distance;
+    double t = 0;
+
+    if (u < 0) {
+        // coming to a halt first, drifting further away meanwhile
+        double reverse = dome.deceleration[dir == RIGHT ? LEFT : RIGHT];
+        if (reverse > 0) {
+            t += -u / reverse;
+            distance += u * u / (2 * reverse);
+        }
+        t += config.reversalDeadTime;
+        u = 0;
+    }
+    if (v <= 0) {
+        plan.eta = INFINITY;
+        return plan;
+    }
+    if (a <= 0) {
+        plan.eta = t + distance / v;
+        plan.stopDistance = distance;
+        return plan;
+    }
+
+    // already too fast to halt before the target it takes another turn
+    if (u * u / (2 * a) > distance) {
+        distance += 360;
+    }
+    u = std::min(u, v);
+    double spinUp = (v * v - u * u) / (2 * a);
+    double coast = v * v / (2 * a);
+    if (spinUp + coast <= distance) {
+        t += (v - u) / a + (distance - spinUp - coast) / v + v / a;
+        plan.stopDistance = distance - coast;
+    } else {
+        // too short to reach full speed: spinning up to w, then coasting from there
+        double w = std::sqrt((2 * a * distance + u * u) / 2);
+        t += (w - u) / a + w / a;
+        plan.stopDistance = distance - w * w / (2 * a);
+    }
+    plan.eta = t;
+    return plan;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// picks the direction of a slew by its expected arrival time instead of the shorter way
+// the dome turns right and left at different speeds, spins up and coasts to a halt with the learned deceleration and
+// has to come to a halt before it can be reversed
+// the spin up is assumed as steep as the coasting, without a learned deceleration the speed changes at once
+// all times in s, angles in °, velocities in °/s
+class SlewPlanner
+{
+public:
+    enum Direction {
+        RIGHT,
+        LEFT
+    };
+
+    struct Config {
+        bool costBased = true;          // false: always the shorter way like before
+        double reversalDeadTime = 0.5;  // pause between coming to a halt and starting the other way
+    };
+
+    // what is known about the dome, indexed by Direction
+    struct Dome {
+        double velocity[2] = {0, 0};
+        double deceleration[2] = {0, 0};    // 0 if unknown
+    };
+
+    struct Plan {
+        Direction direction = RIGHT;
+        double distance = 0;    // to the target in direction
+        double eta = 0;         // expected time until the dome halts at the target
+        double stopDistance = 0;    // the motor is switched off after this, the rest it coasts
+    };
+
+    void setConfig(const Config &config) { this->config = config; }
+    const Config &getConfig() const { return config; }
+
+    // the dome at az moving with velocity (positive right, also while coasting) and the target to halt at
+    Plan plan(const Dome &dome, double az, double velocity, double target) const;
+    // the same going in direction dir
+    Plan planDirection(const Dome &dome, Direction dir, double az, double velocity, double target) const;
+
+private:
+    Config config;
+};
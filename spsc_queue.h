@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// lock-free single producer / single consumer ring buffer
+// the producer is the pigpio alert thread, the consumer is the control loop
+// capacity has to be a power of two, one slot is kept free to distinguish full from empty
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity has to be a power of two");
+
+public:
+    // returns false if the queue is full, the element is dropped then
+    bool push(const T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t next = (h + 1) & (Capacity - 1);
+        if (next == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        buffer[h] = item;
+        head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // returns false if the queue is empty
+    bool pop(T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = buffer[t];
+        tail.store((t + 1) & (Capacity - 1), std::memory_order_release);
+        return true;
+    }
+
+    // only to be called by the consumer
+    bool empty() const {
+        return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+    // only to be called by the consumer
+    void clear() {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    T buffer[Capacity];
+    alignas(64) std::atomic<size_t> head {0};
+    alignas(64) std::atomic<size_t> tail {0};
+};
@@ -0,0 +1,60 @@
+#include "tooth_table.h"
+#include "angles.h"
+
+#include <algorithm>
+#include <cmath>
+
+void ToothTable::resize(int count) {
+    teeth = std::max(count, 0);
+    edges[RIGHT].resize(edgeCount());
+    edges[LEFT].resize(edgeCount());
+}
+
+void ToothTable::fillEven(int count, double offset, double width) {
+    resize(count);
+    double period = 360.0 / count;
+    for (int i = 0; i < teeth; i++) {
+        for (int dir = RIGHT; dir <= LEFT; dir++) {
+            edges[dir][2 * i] = offset + i * period;
+            edges[dir][2 * i + 1] = offset + i * period + width * period;
+        }
+    }
+    northLeft = 0;
+}
+
+int ToothTable::locate(double az, bool inTooth) const {
+    // teeth run from an even edge to the next odd one, gaps from an odd edge to the next even one
+    int best = 0;
+    double bestDistance = INFINITY;
+    for (int e = inTooth ? 0 : 1; e < edgeCount(); e += 2) {
+        int end = next(e);
+        double from = (edges[RIGHT][e] + edges[LEFT][e]) / 2;
+        double to = (edges[RIGHT][end] + edges[LEFT][end]) / 2;
+        double width = range360(to - from);
+        if (range360(az - from) <= width) {
+            return end;
+        }
+        double d = std::fabs(std::remainder(az - (from + width / 2), 360.0));
+        if (d < bestDistance) {
+            bestDistance = d;
+            best = end;
+        }
+    }
+    return best;
+}
+
+double ToothTable::distance(int dir, int a, int b) const {
+    return range360(edges[dir][b] - edges[dir][a]);
+}
+
+void ToothTable::shift(double degrees) {
+    for (int dir = RIGHT; dir <= LEFT; dir++) {
+        for (int e = 0; e < edgeCount(); e++) {
+            edges[dir][e] += degrees;
+        }
+    }
+}
+
+void ToothTable::refine(int dir, int e, double az, double gain) {
+    edges[dir][e] += gain * std::remainder(az - edges[dir][e], 360.0);
+}
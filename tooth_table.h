@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+// azimuth of every encoder edge, the teeth of the ring aren't evenly spaced
+// the edges are numbered from north to the right: edge 2i is where tooth i starts and 2i + 1 where it ends, tooth 0
+// is the first one starting right of north
+// turning right the even edges are the rising ones (the impulse becomes active), turning left the odd ones
+// each direction has its own angles because the sensor switches a little late in both
+// angles are in ° from north to the right, an edge beyond 360° is kept there so the angles keep increasing
+struct ToothTable {
+    enum {
+        RIGHT,
+        LEFT
+    };
+
+    int teeth = 0;
+    // 2 * teeth per direction, of any ring size
+    std::vector<double> edges[2];
+    // where turning left enters the north zone, turning right it is entered at 0°
+    double northLeft = 0;
+
+    int edgeCount() const { return 2 * teeth; }
+    // room for count teeth, the angles are undefined until filled
+    void resize(int count);
+    // evenly spaced teeth starting at offset, width is the active part of a period
+    void fillEven(int teeth, double offset, double width);
+
+    // index of the edge next to the right of the dome at az, inTooth is the current impulse level
+    // az is placed into the tooth or gap containing it, or the nearest one if it isn't in one of that kind
+    int locate(double az, bool inTooth) const;
+    // the edge index after passing edge e in a direction, and the one before
+    int next(int e) const { return e + 1 < edgeCount() ? e + 1 : 0; }
+    int previous(int e) const { return e > 0 ? e - 1 : edgeCount() - 1; }
+    // distance between two edges of a direction going right from a to b
+    double distance(int dir, int a, int b) const;
+    // moving edge e of direction dir towards the measured azimuth az by gain
+    void refine(int dir, int e, double az, double gain);
+    // turning all edges of both directions against north
+    void shift(double degrees);
+};
@@ -0,0 +1,358 @@
+#include "trace_replay.h"
+#include "dome_controller.h"
+#include "dome_pins.h"
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+#define VCD_WIRING_COMMENT "nepo_dome wiring "
+
+bool loadFlightTrace(const std::string &path, Trace &trace, std::string &error) {
+    std::vector<FlightRecord> records;
+    DomePinMap pins;
+    if (!readFlightRecording(path, records, pins, error)) {
+        return false;
+    }
+    if (records.empty()) {
+        error = path + " has no records";
+        return false;
+    }
+    std::vector<uint64_t> times = unwrapFlightTicks(records);
+    trace = Trace();
+    trace.pins = pins;
+    trace.levels = ~pins.activeHigh;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        const FlightRecord &r = records[i];
+        uint64_t time = times[i];
+        if (time == 0) {
+            trace.startTick = r.tick;
+        }
+        trace.duration = std::max(trace.duration, time);
+        switch (r.type) {
+        case FlightRecord::EDGE:
+            // the watchdog timeouts come from the replayed driver's own watchdogs
+            if (r.a.bits > 1 || r.arg > 31) {
+                break;
+            }
+            trace.edges.push_back({time, r.arg, r.a.bits});
+            // before its first edge a sensor had the other level
+            if (!(seen & (1u << r.arg))) {
+                seen |= 1u << r.arg;
+                trace.levels = r.a.bits ? trace.levels & ~(1u << r.arg) : trace.levels | (1u << r.arg);
+            }
+            break;
+        case FlightRecord::RELAYS:
+            trace.relays.push_back({time, r.a.bits});
+            break;
+        case FlightRecord::COMMAND:
+            trace.commands.push_back({time, r.arg, r.arg == FlightRecord::MOVE ? static_cast<float>(r.a.bits) : r.a.value});
+            break;
+        }
+    }
+    // the edges were recorded when the control loop handled them, a little after they happened
+    std::stable_sort(trace.edges.begin(), trace.edges.end(), [](const Trace::Edge &a, const Trace::Edge &b) { return a.time < b.time; });
+    std::stable_sort(trace.relays.begin(), trace.relays.end(), [](const Trace::Relays &a, const Trace::Relays &b) { return a.time < b.time; });
+    return true;
+}
+
+// pig2vcd names the wires by their GPIO, nepo_dome_dump like the signals with '_' for the spaces
+static int vcdGpio(const DomePinMap &pins, const std::string &name) {
+    if (!name.empty() && std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isdigit(c); })) {
+        int gpio = std::stoi(name);
+        return gpio < 32 ? gpio : -1;
+    }
+    for (int i = 0; i < SIGNAL_COUNT; i++) {
+        std::string wire = DOME_SIGNAL_NAMES[i];
+        std::replace(wire.begin(), wire.end(), ' ', '_');
+        if (wire == name) {
+            return pins.gpio[i];
+        }
+    }
+    return -1;
+}
+
+static double vcdTimescale(const std::string &scale) {
+    // µs per unit of the time stamps, like "1 us" or "10ns"
+    size_t digits = 0;
+    while (digits < scale.size() && std::isdigit(static_cast<unsigned char>(scale[digits]))) {
+        digits++;
+    }
+    double factor = digits ? std::stod(scale.substr(0, digits)) : 1;
+    std::string unit = scale.substr(digits);
+    if (unit == "s") {
+        return factor * 1e6;
+    } else if (unit == "ms") {
+        return factor * 1e3;
+    } else if (unit == "ns") {
+        return factor * 1e-3;
+    } else if (unit == "ps") {
+        return factor * 1e-6;
+    }
+    return factor;
+}
+
+bool loadVcdTrace(const std::string &path, const DomePinMap &pins, Trace &trace, std::string &error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "Opening " + path + " failed: " + strerror(errno);
+        return false;
+    }
+    trace = Trace();
+    trace.pins = pins;
+    std::map<std::string, std::string> names;
+    double timescale = 1;
+    std::string token;
+
+    // header: the wiring, the wires and the time unit
+    bool defined = false;
+    while (!defined && in >> token) {
+        if (token == "$comment") {
+            std::string comment;
+            while (in >> token && token != "$end") {
+                comment += (comment.empty() ? "" : " ") + token;
+            }
+            if (comment.compare(0, strlen(VCD_WIRING_COMMENT), VCD_WIRING_COMMENT) == 0
+                && !trace.pins.fromText(comment.substr(strlen(VCD_WIRING_COMMENT)))) {
+                error = path + " has a broken wiring: " + comment;
+                return false;
+            }
+        } else if (token == "$timescale") {
+            std::string scale;
+            while (in >> token && token != "$end") {
+                scale += token;
+            }
+            timescale = vcdTimescale(scale);
+        } else if (token == "$var") {
+            std::vector<std::string> fields;
+            while (in >> token && token != "$end") {
+                fields.push_back(token);
+            }
+            // type, size, id, name and maybe a bit range
+            if (fields.size() >= 4 && fields[1] == "1") {
+                names[fields[2]] = fields[3];
+            }
+        } else if (token == "$enddefinitions") {
+            defined = true;
+        }
+    }
+    if (!defined) {
+        error = path + " isn't a VCD";
+        return false;
+    }
+    // the wiring comment may come after the wires
+    std::map<std::string, int> wires;
+    for (const auto &name : names) {
+        int gpio = vcdGpio(trace.pins, name.second);
+        if (gpio >= 0) {
+            wires[name.first] = gpio;
+        }
+    }
+    if (wires.empty()) {
+        error = path + " has none of the dome's GPIOs";
+        return false;
+    }
+
+    // changes: the ones at the first time stamp are the levels at the start, later sensor changes are edges and
+    // relay changes become commands
+    const DomePinMap &wiring = trace.pins;
+    bool started = false;
+    bool first = true;
+    double firstTime = 0;
+    uint64_t time = 0;
+    uint32_t relaysOn = 0;
+    uint32_t levels = ~wiring.activeHigh;
+    auto settle = [&]() {
+        uint32_t on = wiring.active(levels) & wiring.relays();
+        if (on == relaysOn) {
+            return;
+        }
+        trace.relays.push_back({time, on});
+        if ((on & wiring.rotationRelays()) != (relaysOn & wiring.rotationRelays())) {
+            DomeController::RotDirection dir = on & wiring.mask(SIGNAL_R) ? DomeController::RotDirection::RIGHT
+                                             : on & wiring.mask(SIGNAL_L) ? DomeController::RotDirection::LEFT
+                                                                          : DomeController::RotDirection::NONE;
+            trace.commands.push_back({time, FlightRecord::MOVE, static_cast<float>(dir)});
+        }
+        if ((on & wiring.shutterRelays()) != (relaysOn & wiring.shutterRelays())) {
+            uint8_t command = on & wiring.mask(SIGNAL_O) ? FlightRecord::OPEN_SHUTTER
+                            : on & wiring.mask(SIGNAL_C) ? FlightRecord::CLOSE_SHUTTER : FlightRecord::STOP_SHUTTER;
+            trace.commands.push_back({time, command, 0});
+        }
+        relaysOn = on;
+    };
+    while (in >> token) {
+        if (token[0] == '#') {
+            double stamp = std::stod(token.substr(1));
+            if (!started) {
+                firstTime = stamp;
+                started = true;
+            } else {
+                if (first) {
+                    trace.levels = levels;
+                    relaysOn = wiring.active(levels) & wiring.relays();
+                    first = false;
+                } else {
+                    settle();
+                }
+            }
+            time = static_cast<uint64_t>((stamp - firstTime) * timescale);
+            trace.duration = std::max(trace.duration, time);
+        } else if (token[0] == 'b' || token[0] == 'B' || token[0] == 'r' || token[0] == 'R') {
+            // vectors and reals are followed by their id
+            in >> token;
+        } else if (token[0] == '0' || token[0] == '1') {
+            auto wire = wires.find(token.substr(1));
+            if (wire == wires.end()) {
+                continue;
+            }
+            uint32_t mask = 1u << wire->second;
+            unsigned level = token[0] - '0';
+            if (((levels & mask) != 0) == (level != 0)) {
+                continue;
+            }
+            levels = level ? levels | mask : levels & ~mask;
+            if (!first && (mask & wiring.sensors())) {
+                trace.edges.push_back({time, static_cast<unsigned>(wire->second), level});
+            }
+        }
+    }
+    if (first) {
+        trace.levels = levels;
+    } else {
+        settle();
+    }
+    return true;
+}
+
+ReplayBackend::ReplayBackend(const Trace &trace) : trace(trace), levels(trace.levels) {
+}
+
+int ReplayBackend::initialise() {
+    return 0;
+}
+
+void ReplayBackend::terminate() {
+}
+
+int ReplayBackend::setMode(unsigned gpio, unsigned mode) {
+    if (gpio > 53) {
+        return PI_BAD_GPIO;
+    }
+    return mode > 7 ? PI_BAD_MODE : 0;
+}
+
+int ReplayBackend::setPullUpDown(unsigned gpio, unsigned pud) {
+    if (gpio > 53) {
+        return PI_BAD_GPIO;
+    }
+    return pud > PI_PUD_UP ? PI_BAD_PUD : 0;
+}
+
+int ReplayBackend::read(unsigned gpio) {
+    if (gpio > 53) {
+        return PI_BAD_GPIO;
+    }
+    return gpio < 32 ? (levels >> gpio) & 1 : PI_HIGH;
+}
+
+uint32_t ReplayBackend::readBits() {
+    return levels;
+}
+
+int ReplayBackend::write(unsigned gpio, unsigned level) {
+    if (gpio > 53) {
+        return PI_BAD_GPIO;
+    }
+    if (gpio < 32) {
+        levels = level ? levels | (1u << gpio) : levels & ~(1u << gpio);
+    }
+    return 0;
+}
+
+int ReplayBackend::writeBitsSet(uint32_t bits) {
+    levels |= bits;
+    return 0;
+}
+
+int ReplayBackend::writeBitsClear(uint32_t bits) {
+    levels &= ~bits;
+    return 0;
+}
+
+uint32_t ReplayBackend::tick() {
+    return static_cast<uint32_t>(trace.startTick + now);
+}
+
+int ReplayBackend::setAlertFunc(unsigned gpio, gpioAlertFuncEx_t f, void *userdata) {
+    if (gpio > 31) {
+        return PI_BAD_USER_GPIO;
+    }
+    alerts[gpio].f = f;
+    alerts[gpio].userdata = userdata;
+    return 0;
+}
+
+int ReplayBackend::setWatchdog(unsigned gpio, unsigned timeout) {
+    if (gpio > 31) {
+        return PI_BAD_USER_GPIO;
+    }
+    if (timeout > 60000) {
+        return PI_BAD_WDOG_TIMEOUT;
+    }
+    watchdogs[gpio] = timeout * 1000ull;
+    lastActivity[gpio] = now;
+    if (timeout) {
+        watched |= 1u << gpio;
+    } else {
+        watched &= ~(1u << gpio);
+    }
+    return 0;
+}
+
+uint64_t ReplayBackend::nextTimeout(unsigned &gpio) const {
+    uint64_t earliest = UINT64_MAX;
+    for (unsigned g = 0; g < 32; g++) {
+        if ((watched & (1u << g)) && lastActivity[g] + watchdogs[g] < earliest) {
+            earliest = lastActivity[g] + watchdogs[g];
+            gpio = g;
+        }
+    }
+    return earliest;
+}
+
+void ReplayBackend::alert(unsigned gpio, int level) {
+    lastActivity[gpio] = now;
+    if (alerts[gpio].f) {
+        alerts[gpio].f(gpio, level, tick(), alerts[gpio].userdata);
+    }
+}
+
+void ReplayBackend::advance(uint64_t until) {
+    for (;;) {
+        uint64_t edgeTime = nextEdge < trace.edges.size() ? trace.edges[nextEdge].time : UINT64_MAX;
+        unsigned watchdog = 0;
+        uint64_t timeout = nextTimeout(watchdog);
+        uint64_t next = std::min(edgeTime, timeout);
+        if (next > until) {
+            break;
+        }
+        now = std::max(now, next);
+        if (edgeTime <= timeout) {
+            const Trace::Edge &edge = trace.edges[nextEdge++];
+            uint32_t mask = 1u << edge.gpio;
+            if (((levels & mask) != 0) != (edge.level != 0)) {
+                levels ^= mask;
+                alert(edge.gpio, edge.level);
+            }
+        } else {
+            alert(watchdog, PI_TIMEOUT);
+        }
+    }
+    now = std::max(now, until);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "dome_pins.h"
+#include "gpio_backend.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// what the dome did in a recorded session: the sensor edges, the relays and the commands the driver got
+// times are µs since the start of the trace
+struct Trace {
+    struct Edge {
+        uint64_t time;
+        unsigned gpio;
+        unsigned level;
+    };
+    struct Relays {
+        uint64_t time;
+        uint32_t on;        // mask of the switched on relays afterwards
+    };
+    struct Command {
+        uint64_t time;
+        uint8_t command;    // FlightRecord::Command
+        float a;            // its argument, for MOVE the RotDirection
+    };
+
+    DomePinMap pins;                // the wiring the GPIOs belong to
+    uint32_t startTick = 0;         // the tick at time 0
+    uint32_t levels = 0xffffffff;   // GPIO levels before the first edge, all signals inactive
+    uint64_t duration = 0;
+    std::vector<Edge> edges;
+    std::vector<Relays> relays;
+    std::vector<Command> commands;
+};
+
+// from a flight recording of the driver, see FlightRecorder, with the wiring it was recorded with
+bool loadFlightTrace(const std::string &path, Trace &trace, std::string &error);
+// from a VCD of pig2vcd, wires named by their GPIO number, or of nepo_dome_dump --vcd, wires named like the signals
+// the dome is wired like pins unless the VCD has the wiring comment of nepo_dome_dump
+// it has no commands, they are derived from the relays: a motor relay switched on becomes a move in its direction
+bool loadVcdTrace(const std::string &path, const DomePinMap &pins, Trace &trace, std::string &error);
+
+// plays the sensor edges of a trace back to the driver, open loop: the relays the driver switches don't change them
+// like the simulated dome the watchdogs are emulated and the time is virtual, advanced with advance()
+class ReplayBackend : public GpioBackend
+{
+public:
+    explicit ReplayBackend(const Trace &trace);
+
+    int initialise() override;
+    void terminate() override;
+
+    int setMode(unsigned gpio, unsigned mode) override;
+    int setPullUpDown(unsigned gpio, unsigned pud) override;
+    int read(unsigned gpio) override;
+    uint32_t readBits() override;
+    int write(unsigned gpio, unsigned level) override;
+    int writeBitsSet(uint32_t bits) override;
+    int writeBitsClear(uint32_t bits) override;
+
+    uint32_t tick() override;
+
+    int setAlertFunc(unsigned gpio, gpioAlertFuncEx_t f, void *userdata) override;
+    int setWatchdog(unsigned gpio, unsigned timeout) override;
+
+    // advancing the virtual time to until, the edges and watchdog timeouts up to then are alerted from the calling
+    // thread in the order they happened
+    void advance(uint64_t until);
+    uint64_t getTime() const { return now; }
+
+private:
+    const Trace &trace;
+    size_t nextEdge = 0;
+    uint64_t now = 0;
+    uint32_t levels;
+    struct Alert {
+        gpioAlertFuncEx_t f = nullptr;
+        void *userdata = nullptr;
+    };
+    Alert alerts[32];
+    // watchdog timeouts in µs, 0 if none, and the last level change or timeout
+    uint64_t watchdogs[32] = {};
+    uint64_t lastActivity[32] = {};
+    uint32_t watched = 0;
+    // the earliest watchdog timeout and its GPIO, UINT64_MAX if none is watched
+    uint64_t nextTimeout(unsigned &gpio) const;
+    void alert(unsigned gpio, int level);
+};